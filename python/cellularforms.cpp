@@ -0,0 +1,391 @@
+// Python bindings for the simulation core, built by setup.py:
+//
+//   import cellularforms
+//   pool = cellularforms.ThreadPool()
+//   model = cellularforms.Model(pool, seed=1, DiffusionSteps=4)
+//   model.Update(1000)
+//   positions = model.Positions()  # (n, 3) float32, no copy
+//
+// Model wraps a Model<float> and Model64 a Model<double>, each together
+// with the pool it updates on. Update releases the GIL while the pool
+// works, so other Python threads keep running.
+//
+// Positions, Normals and Food are read-only NumPy views of the model's own
+// arrays, and have to be fetched again after an Update or Defragment to see
+// its changes. Views that outlive one take over the array they were made
+// of, leaving the model a copy, so they never dangle and arrays that aren't
+// viewed are never copied. Rows are cell slots; a slot freed by cell death
+// has no links until it is reused. The link rings aren't stored
+// contiguously, so Links flattens them into new offset and id arrays, once
+// per Update.
+
+#include <pybind11/numpy.h>
+#include <pybind11/pybind11.h>
+
+#include <fstream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "model.h"
+#include "pool.h"
+#include "settings.h"
+#include "sphere.h"
+#include "stl.h"
+#include "triangle.h"
+#include "util.h"
+
+namespace py = pybind11;
+
+namespace {
+
+// ViewOwner is the base of the views of one array. It is empty while the
+// model holds the array, and keeps it once Detach hands it over.
+template <typename V>
+struct ViewOwner {
+    std::unique_ptr<V> Kept;
+};
+
+// ViewBase returns the owner of the views of array, making one if none
+// were handed out since the array last changed
+template <typename V>
+py::handle ViewBase(py::object &owner, const V &) {
+    if (!owner) {
+        owner = py::capsule(new ViewOwner<V>(), [](void *p) {
+            delete static_cast<ViewOwner<V> *>(p);
+        });
+    }
+    return owner;
+}
+
+// Detach returns where the owner keeps its array if views of it are still
+// alive, to pass to Model::TakeArrays, and nullptr otherwise. Either way
+// the next view gets a new owner.
+template <typename V>
+V *Detach(py::object &owner) {
+    V *kept = nullptr;
+    if (owner && owner.ref_count() > 1) {
+        auto *views = py::reinterpret_borrow<py::capsule>(owner)
+            .get_pointer<ViewOwner<V>>();
+        views->Kept.reset(new V());
+        kept = views->Kept.get();
+    }
+    owner = py::object();
+    return kept;
+}
+
+// Simulation is a model and the pool it updates on
+template <typename T>
+struct Simulation {
+    Simulation(
+        const std::shared_ptr<ThreadPool> &pool,
+        const std::vector<Triangle> &triangles,
+        const Settings &settings) :
+        Pool(pool),
+        Form(MakeModel<T>(triangles, settings, *pool))
+    {
+        Form.Calibrate(*Pool);
+    }
+
+    ~Simulation() {
+        DetachViews();
+    }
+
+    // DetachViews runs before anything that can change or move the arrays
+    void DetachViews() {
+        using Vec3s = MappedVector<glm::vec<3, T>>;
+        Form.TakeArrays(
+            Detach<Vec3s>(PositionsOwner),
+            Detach<Vec3s>(NormalsOwner),
+            Detach<MappedVector<T>>(FoodOwner));
+    }
+
+    std::shared_ptr<ThreadPool> Pool;
+    Model<T> Form;
+    uint64_t Iterations = 0;
+
+    // owners of the views handed out since the arrays last changed
+    py::object PositionsOwner;
+    py::object NormalsOwner;
+    py::object FoodOwner;
+
+    // bumped whenever the cells may have moved in memory or been
+    // renumbered, to know when the flattened links are stale
+    uint64_t Version = 0;
+    uint64_t LinksVersion = UINT64_MAX;
+    py::object LinkOffsets;
+    py::object LinkIds;
+};
+
+// View returns a read-only array of rows by cols values at data, with
+// owner as its base; cols = 1 gives a 1-D array
+template <typename S>
+py::array View(
+    const S *data, const size_t rows, const size_t cols,
+    const py::handle owner)
+{
+    std::vector<py::ssize_t> shape{py::ssize_t(rows)};
+    std::vector<py::ssize_t> strides{py::ssize_t(cols * sizeof(S))};
+    if (cols > 1) {
+        shape.push_back(cols);
+        strides.push_back(sizeof(S));
+    }
+    py::array result(py::dtype::of<S>(), shape, strides, data, owner);
+    result.attr("flags").attr("writeable") = false;
+    return result;
+}
+
+// ParseTriangles takes the seed mesh as None for the default sphere, the
+// path of a binary STL or an (n, 3, 3) array of corners
+std::vector<Triangle> ParseTriangles(const py::object &triangles) {
+    if (triangles.is_none()) {
+        return SphereTriangles(1);
+    }
+    if (py::isinstance<py::str>(triangles)) {
+        // LoadBinarySTL panics on a missing file, which would end the
+        // interpreter
+        const std::string path = triangles.cast<std::string>();
+        if (!std::ifstream(path)) {
+            throw py::value_error("failed to open " + path);
+        }
+        return LoadBinarySTL(path);
+    }
+    const auto corners = py::array_t<
+        float, py::array::c_style | py::array::forcecast>::ensure(triangles);
+    if (!corners || corners.ndim() != 3 ||
+        corners.shape(1) != 3 || corners.shape(2) != 3)
+    {
+        throw py::value_error("triangles must be an (n, 3, 3) array");
+    }
+    std::vector<Triangle> result;
+    result.reserve(corners.shape(0));
+    const float *v = corners.data();
+    for (py::ssize_t i = 0; i < corners.shape(0); i++, v += 9) {
+        result.emplace_back(
+            glm::vec3(v[0], v[1], v[2]),
+            glm::vec3(v[3], v[4], v[5]),
+            glm::vec3(v[6], v[7], v[8]));
+    }
+    if (result.empty()) {
+        throw py::value_error("triangles is empty");
+    }
+    return result;
+}
+
+// ParseSettings draws the model parameters as main does, from seed if it
+// isn't None, then applies the keyword arguments, which take the names of
+// the Settings fields (see SetSetting). The precision is the model class's,
+// so Double can only repeat it.
+Settings ParseSettings(
+    const std::vector<Triangle> &triangles, const py::object &seed,
+    const bool isDouble, const py::kwargs &kwargs)
+{
+    Settings settings;
+    if (!seed.is_none()) {
+        settings.Seed = seed.cast<unsigned int>();
+        SeedRandom(settings.Seed);
+    }
+    RandomizeSettings(settings, triangles);
+    settings.Double = isDouble;
+    for (const auto &item : kwargs) {
+        const std::string key = py::str(item.first);
+        const py::handle value = item.second;
+        const std::string text = py::isinstance<py::bool_>(value) ?
+            (value.cast<bool>() ? "1" : "0") :
+            std::string(py::str(value));
+        if (!SetSetting(settings, key, text)) {
+            throw py::type_error("unknown parameter: " + key + "=" + text);
+        }
+    }
+    if (settings.Double != isDouble) {
+        throw py::value_error(isDouble ?
+            "Model64 is double precision, use Model for float" :
+            "Model is float precision, use Model64 for double");
+    }
+    return settings;
+}
+
+template <typename T>
+void BindModel(py::module &m, const char *name, const char *doc) {
+    typedef Simulation<T> S;
+    static_assert(sizeof(glm::vec<3, T>) == 3 * sizeof(T),
+        "Positions and Normals are viewed as packed rows");
+
+    py::class_<S>(m, name, doc)
+        .def(py::init([](
+            const py::object &pool, const py::object &triangles,
+            const py::object &seed, const py::kwargs &kwargs)
+        {
+            const std::shared_ptr<ThreadPool> threads = pool.is_none() ?
+                std::make_shared<ThreadPool>() :
+                pool.cast<std::shared_ptr<ThreadPool>>();
+            const auto seedTriangles = ParseTriangles(triangles);
+            const Settings settings = ParseSettings(
+                seedTriangles, seed, std::is_same<T, double>::value, kwargs);
+            py::gil_scoped_release release;
+            return new S(threads, seedTriangles, settings);
+        }),
+            py::arg("pool") = py::none(),
+            py::arg("triangles") = py::none(),
+            py::arg("seed") = py::none(),
+            "Grows a form from triangles: None for a sphere, a binary STL "
+            "path or an (n, 3, 3) array. Unset model parameters are drawn "
+            "at random, from seed if given; keyword arguments set Settings "
+            "fields, e.g. SplitThreshold=500, FastMath=True, "
+            "DiffusionSteps=4, FoodSource='up' or DeathNeighbors=40.")
+
+        .def("Update", [](S &s, const int n, const bool split) {
+            for (int i = 0; i < n; i++) {
+                s.DetachViews();
+                {
+                    py::gil_scoped_release release;
+                    s.Form.Update(*s.Pool, split);
+                }
+                s.Iterations++;
+                s.Version++;
+                if (PyErr_CheckSignals() != 0) {
+                    throw py::error_already_set();
+                }
+            }
+        }, py::arg("n") = 1, py::arg("split") = true,
+            "Runs n iterations without holding the GIL.")
+
+        .def("Defragment", [](S &s) {
+            s.DetachViews();
+            {
+                py::gil_scoped_release release;
+                s.Form.Defragment(*s.Pool);
+            }
+            s.Version++;
+        }, "Renumbers the live cells in order, dropping the free slots.")
+
+        .def("Positions", [](S &s) {
+            const auto &p = s.Form.Positions();
+            return View((const T *)p.data(), p.size(), 3,
+                ViewBase(s.PositionsOwner, p));
+        }, "(n, 3) read-only view of the cell positions.")
+
+        .def("Normals", [](S &s) {
+            const auto &p = s.Form.Normals();
+            return View((const T *)p.data(), p.size(), 3,
+                ViewBase(s.NormalsOwner, p));
+        }, "(n, 3) read-only view of the cell normals.")
+
+        .def("Food", [](S &s) {
+            const auto &p = s.Form.Food();
+            return View(p.data(), p.size(), 1, ViewBase(s.FoodOwner, p));
+        }, "(n,) read-only view of the cell food levels.")
+
+        .def("Links", [](S &s) {
+            if (s.LinksVersion != s.Version) {
+                const auto &links = s.Form.Links();
+                const int n = links.size();
+                py::array_t<int> offsets(n + 1);
+                int *o = offsets.mutable_data();
+                o[0] = 0;
+                for (int i = 0; i < n; i++) {
+                    o[i + 1] = o[i] + links[i].size();
+                }
+                py::array_t<int> ids(o[n]);
+                int *dst = ids.mutable_data();
+                {
+                    py::gil_scoped_release release;
+                    ParallelFor(*s.Pool, n, [&](const uint64_t i) {
+                        std::copy(links[i].begin(), links[i].end(), dst + o[i]);
+                    });
+                }
+                // read-only, as the same arrays are handed out until the
+                // next Update
+                offsets.attr("flags").attr("writeable") = false;
+                ids.attr("flags").attr("writeable") = false;
+                s.LinkOffsets = offsets;
+                s.LinkIds = ids;
+                s.LinksVersion = s.Version;
+            }
+            return py::make_tuple(s.LinkOffsets, s.LinkIds);
+        }, "The link rings in CSR form: (offsets, ids), ring i being "
+            "ids[offsets[i]:offsets[i + 1]], in order around the cell.")
+
+        .def("TriangleIndexes", [](S &s) {
+            ThreadPool &pool = *s.Pool;
+            const auto offsets = s.Form.TriangleOffsets(pool);
+            py::array_t<uint32_t> result(std::vector<py::ssize_t>{
+                py::ssize_t(offsets.back()), 3});
+            uint32_t *dst = result.mutable_data();
+            {
+                py::gil_scoped_release release;
+                s.Form.ForEachTriangle(pool, offsets, [dst](
+                    const uint64_t t, const int a, const int b, const int c)
+                {
+                    dst[t * 3 + 0] = a;
+                    dst[t * 3 + 1] = b;
+                    dst[t * 3 + 2] = c;
+                });
+            }
+            return result;
+        }, "(m, 3) array of the triangles' cell indexes.")
+
+        .def("NumCells", [](const S &s) {
+            return s.Form.NumCells();
+        }, "The number of live cells.")
+
+        .def("FreeCells", [](const S &s) {
+            return s.Form.FreeCells();
+        }, "The number of slots freed by cell death.")
+
+        .def_readonly("Iterations", &S::Iterations)
+
+        .def("Bounds", [](const S &s) {
+            glm::vec<3, T> lo, hi;
+            s.Form.Bounds(lo, hi);
+            return py::make_tuple(
+                py::make_tuple(lo.x, lo.y, lo.z),
+                py::make_tuple(hi.x, hi.y, hi.z));
+        }, "((x, y, z), (x, y, z)) min and max of the cell positions.")
+
+        .def("Parameters", [](const S &s) {
+            const Model<T> &model = s.Form;
+            py::dict result;
+            result["SplitThreshold"] = model.SplitThreshold();
+            result["LinkRestLength"] = model.LinkRestLength();
+            result["RadiusOfInfluence"] = model.RadiusOfInfluence();
+            result["RepulsionFactor"] = model.RepulsionFactor();
+            result["SpringFactor"] = model.SpringFactor();
+            result["PlanarFactor"] = model.PlanarFactor();
+            result["BulgeFactor"] = model.BulgeFactor();
+            return result;
+        }, "The model parameters as a dict.")
+
+        .def("LastUpdate", [](const S &s) {
+            const UpdateStats &u = s.Form.LastUpdate();
+            py::dict result;
+            result["Ensure"] = u.Ensure;
+            result["Force"] = u.Force;
+            result["Recenter"] = u.Recenter;
+            result["Index"] = u.Index;
+            result["Commit"] = u.Commit;
+            result["Diffuse"] = u.Diffuse;
+            result["Split"] = u.Split;
+            result["Death"] = u.Death;
+            result["Splits"] = u.Splits;
+            result["Deaths"] = u.Deaths;
+            return result;
+        }, "Seconds per phase of the last Update, and its splits and "
+            "deaths.");
+}
+
+}
+
+PYBIND11_MODULE(cellularforms, m) {
+    m.doc() = "Bindings for the CellularForms simulation core.";
+
+    py::class_<ThreadPool, std::shared_ptr<ThreadPool>>(m, "ThreadPool")
+        .def(py::init<int>(),
+            py::arg("threads") = int(std::thread::hardware_concurrency()))
+        .def("NumThreads", &ThreadPool::NumThreads);
+
+    BindModel<float>(m, "Model", "A form simulated in float precision.");
+    BindModel<double>(m, "Model64", "A form simulated in double precision.");
+}
@@ -0,0 +1,44 @@
+# Builds the cellularforms Python module from the simulation core in src/,
+# leaving out the window and the command line (see cellularforms.cpp):
+#
+#   pip install ./python
+#   python python/test_cellularforms.py
+#
+# or build it in place and run the test with make python.
+#
+# Needs pybind11, numpy, boost and glm.
+
+import glob
+import os
+
+from pybind11.setup_helpers import Pybind11Extension, build_ext
+from setuptools import setup
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+SRC = os.path.join(HERE, '..', 'src')
+
+# main.cpp, gui.cpp and program.cpp need GLFW and OpenGL
+EXCLUDE = {'main.cpp', 'gui.cpp', 'program.cpp'}
+
+sources = [os.path.join(HERE, 'cellularforms.cpp')] + sorted(
+    path for path in glob.glob(os.path.join(SRC, '*.cpp'))
+    if os.path.basename(path) not in EXCLUDE)
+
+extension = Pybind11Extension(
+    'cellularforms',
+    sources,
+    include_dirs=[SRC],
+    cxx_std=14,
+    define_macros=[('NDEBUG', None)],
+    extra_compile_args=['-O3', '-Wno-sign-compare'],
+    libraries=['pthread'],
+)
+
+setup(
+    name='cellularforms',
+    version='0.1',
+    description='Python bindings for the CellularForms simulation core',
+    ext_modules=[extension],
+    cmdclass={'build_ext': build_ext},
+    install_requires=['numpy'],
+)
@@ -0,0 +1,59 @@
+# Smoke test for the bindings, after pip install ./python:
+#
+#   python python/test_cellularforms.py
+#
+# or under pytest.
+
+import numpy as np
+
+import cellularforms
+
+
+def test_update_and_views():
+    pool = cellularforms.ThreadPool(2)
+    model = cellularforms.Model(pool, seed=1, SplitThreshold=50)
+    model.Update(200)
+    assert model.Iterations == 200
+
+    positions = model.Positions()
+    n = model.NumCells() + model.FreeCells()
+    assert positions.shape == (n, 3) and positions.dtype == np.float32
+    assert np.isfinite(positions).all()
+    assert not positions.flags.writeable
+    assert model.Normals().shape == (n, 3)
+    assert model.Food().shape == (n,)
+
+    offsets, ids = model.Links()
+    assert offsets.shape == (n + 1,) and offsets[-1] == len(ids)
+    assert ids.min() >= 0 and ids.max() < n
+    triangles = model.TriangleIndexes()
+    assert triangles.shape[1] == 3 and triangles.max() < n
+
+    # views kept across an Update or the model's end keep their values
+    before = positions.copy()
+    model.Update(10)
+    assert (positions == before).all()
+    assert not np.array_equal(model.Positions()[:len(before)], before)
+    food = model.Food()
+    del model
+    assert np.isfinite(food).all()
+
+
+def test_precision():
+    model = cellularforms.Model64(seed=2)
+    model.Update(5)
+    assert model.Positions().dtype == np.float64
+    for cls, double in ((cellularforms.Model, True),
+                        (cellularforms.Model64, False)):
+        try:
+            cls(Double=double)
+        except ValueError:
+            pass
+        else:
+            raise AssertionError('Double mismatch accepted')
+
+
+if __name__ == '__main__':
+    test_update_and_views()
+    test_precision()
+    print('ok')
@@ -0,0 +1,379 @@
+#include "bench.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <sys/stat.h>
+#include <thread>
+
+#include "checkpoint.h"
+#include "cpu.h"
+#include "decimate.h"
+#include "index.h"
+#include "model.h"
+#include "pool.h"
+#include "settings.h"
+#include "sphere.h"
+#include "stl.h"
+#include "util.h"
+
+// ModelBench reaches into Model to time its private stages
+struct ModelBench {
+    template <typename T>
+    static void Prepare(Model<T> &model) {
+        model.Ensure();
+        model.ResizeBuffers();
+    }
+
+    template <typename T>
+    static void UpdateBatch(Model<T> &model, ThreadPool &pool) {
+        pool.Run(pool.NumThreads(), [&model](const int wi, const int wn) {
+            model.UpdateBatch(wi, wn);
+        });
+    }
+
+    // IndexUpdate moves every cell to its new position in the index; the
+    // second call with reverse = true moves them back
+    template <typename T>
+    static void IndexUpdate(
+        Model<T> &model, ThreadPool &pool, const bool reverse)
+    {
+        const auto &p0 = reverse ? model.m_NewPositions : model.m_Positions;
+        const auto &p1 = reverse ? model.m_Positions : model.m_NewPositions;
+        pool.Run(pool.NumThreads(), [&](const int wi, const int wn) {
+            for (int i = wi; i < p0.size(); i += wn) {
+                model.m_Index.Update(glm::vec3(p0[i]), glm::vec3(p1[i]), i);
+            }
+        });
+    }
+
+    // IndexEnsure fills a fresh index with every cell and times growing it
+    // past its padding and the default grid, which copies every index cell
+    template <typename T>
+    static double IndexEnsure(Model<T> &model) {
+        typedef typename Model<T>::vec3 vec3;
+        vec3 min, max;
+        model.Bounds(min, max);
+        const T padding =
+            std::max(model.m_LinkRestLength, model.m_RadiusOfInfluence) * 10;
+        min -= padding;
+        max += padding;
+        const T cellSize = model.m_RadiusOfInfluence * 1.2;
+        Index index(cellSize);
+        index.Ensure(glm::vec3(min), glm::vec3(max));
+        for (int i = 0; i < model.m_Positions.size(); i++) {
+            index.Add(glm::vec3(model.m_Positions[i]), i);
+        }
+        const auto grow = glm::max(max - min, vec3(cellSize * 51));
+        const auto startTime = std::chrono::steady_clock::now();
+        index.Ensure(glm::vec3(min - grow), glm::vec3(max + grow));
+        const std::chrono::duration<double> elapsed =
+            std::chrono::steady_clock::now() - startTime;
+        return elapsed.count();
+    }
+
+    template <typename T>
+    static void Diffuse(Model<T> &model, ThreadPool &pool) {
+        model.Diffuse(pool);
+    }
+
+    template <typename T>
+    static void Split(Model<T> &model, const int i) {
+        model.Split(i);
+    }
+};
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+bool FileExists(const std::string &path) {
+    return std::ifstream(path).good();
+}
+
+// Median runs f once to warm up, then reps more times, and returns the
+// median of the times f reports
+template <typename F>
+double Median(const int reps, F f) {
+    f();
+    std::vector<double> seconds;
+    for (int i = 0; i < reps; i++) {
+        seconds.push_back(f());
+    }
+    std::sort(seconds.begin(), seconds.end());
+    return seconds[seconds.size() / 2];
+}
+
+template <typename F>
+double Time(F f) {
+    const auto startTime = Clock::now();
+    f();
+    const std::chrono::duration<double> elapsed = Clock::now() - startTime;
+    return elapsed.count();
+}
+
+// Fixture loads the fixture with the given number of cells, growing and
+// saving it first if needed. Fixtures start from the largest subdivided
+// sphere that fits and split a capped number of cells per iteration until
+// they hit the count exactly, all from a fixed seed.
+Model<float> Fixture(const std::string &directory, const int cells) {
+    const std::string path =
+        directory + "/cells" + std::to_string(cells) + ".bin";
+    if (!FileExists(path)) {
+        int detail = 0;
+        while (10 * (1 << (2 * (detail + 1))) + 2 <= cells) {
+            detail++;
+        }
+        const auto triangles = SphereTriangles(detail);
+
+        SeedRandom(1);
+        Settings settings;
+        RandomizeSettings(settings, triangles);
+        settings.SplitThreshold = 20;
+        settings.RadiusOfInfluence = settings.LinkRestLength * 2.5;
+        settings.RepulsionFactor = 0.05;
+        settings.SpringFactor = 0.05;
+        settings.PlanarFactor = 0.05;
+        settings.BulgeFactor = 0.05;
+
+        ThreadPool pool;
+        Model<float> model = MakeModel<float>(triangles, settings, pool);
+        model.Calibrate(pool);
+        uint64_t iterations = 0;
+        while (model.Positions().size() < cells) {
+            model.SetSplitLimits(cells - model.Positions().size(), 0);
+            model.Update(pool);
+            iterations++;
+        }
+        SaveCheckpoint(path, model, iterations);
+        std::cerr << "created fixture " << path << std::endl;
+    }
+    uint64_t iterations;
+    ThreadPool pool;
+    return LoadCheckpoint<float>(path, iterations, pool);
+}
+
+// AsScalar returns the fixture in the scalar type being benchmarked
+Model<float> AsScalar(Model<float> &&model, float) {
+    return std::move(model);
+}
+
+Model<double> AsScalar(Model<float> &&model, double) {
+    const auto convert = [](const MappedVector<glm::vec3> &v) {
+        return MappedVector<glm::dvec3>(v.begin(), v.end());
+    };
+    ThreadPool pool;
+    return Model<double>(
+        model.SplitThreshold(), model.LinkRestLength(),
+        model.RadiusOfInfluence(), model.RepulsionFactor(),
+        model.SpringFactor(), model.PlanarFactor(), model.BulgeFactor(),
+        convert(model.Positions()), convert(model.Normals()),
+        MappedVector<double>(model.Food().begin(), model.Food().end()),
+        model.Links(), pool);
+}
+
+// Reporter prints results as JSON lines and appends them to a file
+class Reporter {
+public:
+    Reporter(const std::string &path) :
+        m_File(path, std::ios_base::app)
+    {
+        if (!m_File) {
+            Panic("failed to open " + path);
+        }
+    }
+
+    void Report(
+        const std::string &bench, const std::string &scaling,
+        const std::string &scalar, const bool fast, const int cells,
+        const int threads, const int reps, const uint64_t ops,
+        const double seconds)
+    {
+        std::ostringstream line;
+        line
+            << "{\"bench\":\"" << bench << "\""
+            << ",\"scaling\":\"" << scaling << "\""
+            << ",\"scalar\":\"" << scalar << "\""
+            << ",\"fast\":" << (fast ? "true" : "false")
+            << ",\"isa\":\"" << ISAName(ActiveISA()) << "\""
+            << ",\"cells\":" << cells
+            << ",\"threads\":" << threads
+            << ",\"reps\":" << reps
+            << ",\"ops\":" << ops
+            << ",\"seconds\":" << seconds
+            << ",\"ns_per_op\":" << seconds * 1e9 / std::max<uint64_t>(ops, 1)
+            << "}";
+        std::cout << line.str() << std::endl;
+        m_File << line.str() << std::endl;
+    }
+
+    void ReportMemory(
+        const std::string &scalar, const bool compact, const int cells,
+        const MemoryUsages &memory)
+    {
+        std::ostringstream line;
+        line
+            << "{\"bench\":\"MemoryReport\""
+            << ",\"scalar\":\"" << scalar << "\""
+            << ",\"compact\":" << (compact ? "true" : "false")
+            << ",\"cells\":" << cells
+            << ",\"rss_bytes\":" << ResidentBytes()
+            << ",\"memory\":" << MemoryReportJSON(memory)
+            << "}";
+        std::cout << line.str() << std::endl;
+        m_File << line.str() << std::endl;
+    }
+
+private:
+    std::ofstream m_File;
+};
+
+// Measure runs every parallel benchmark on one model with one thread count
+template <typename T>
+void Measure(
+    Model<T> &model, const std::string &scaling, const std::string &scalar,
+    const int threads, const BenchOptions &options, Reporter &reporter)
+{
+    ThreadPool pool(threads);
+    const int reps = options.Reps;
+    const int cells = model.Positions().size();
+    const auto report = [&](
+        const std::string &bench, const bool fast, const uint64_t ops,
+        const double seconds)
+    {
+        reporter.Report(
+            bench, scaling, scalar, fast, cells, threads, reps, ops, seconds);
+    };
+
+    ModelBench::Prepare(model);
+
+    for (const bool fast : {false, true}) {
+        model.SetFastMath(fast);
+        report("UpdateBatch", fast, cells, Median(reps, [&]() {
+            return Time([&]() { ModelBench::UpdateBatch(model, pool); });
+        }));
+    }
+    model.SetFastMath(false);
+
+    // compact mode writes packed normals; the food rounding it applies on
+    // the way in doesn't matter to the benchmarks below
+    model.SetCompact(true);
+    ModelBench::Prepare(model);
+    report("UpdateBatchCompact", false, cells, Median(reps, [&]() {
+        return Time([&]() { ModelBench::UpdateBatch(model, pool); });
+    }));
+    model.SetCompact(false);
+    ModelBench::Prepare(model);
+
+    // four sub-steps per iteration, with a uniform feed so that the time
+    // doesn't include drawing random numbers
+    model.SetDiffusion(4, 0.5, 0, FoodSource::Uniform);
+    report("Diffuse", false, cells, Median(reps, [&]() {
+        return Time([&]() { ModelBench::Diffuse(model, pool); });
+    }));
+    model.SetDiffusion(0, 0, 0, FoodSource::Random);
+
+    report("Index::Update", false, cells, Median(reps, [&]() {
+        const double seconds = Time([&]() {
+            ModelBench::IndexUpdate(model, pool, false);
+        });
+        ModelBench::IndexUpdate(model, pool, true);
+        return seconds;
+    }));
+
+    std::vector<glm::uvec3> indexes;
+    report("TriangleIndexes", false, cells, Median(reps, [&]() {
+        return Time([&]() { model.TriangleIndexes(indexes, pool); });
+    }));
+
+    // decimation to a quarter of the triangles, on copies of the mesh
+    report("Decimate", false, indexes.size(), Median(reps, [&]() {
+        std::vector<glm::vec3> positions(
+            model.Positions().begin(), model.Positions().end());
+        std::vector<glm::uvec3> faces = indexes;
+        DecimateOptions decimate;
+        decimate.TargetTriangles = indexes.size() / 4;
+        return Decimate(positions, faces, decimate, pool).Seconds;
+    }));
+
+    const std::string stlPath = options.Directory + "/bench.stl";
+    report("SaveBinarySTL", false, indexes.size(), Median(reps, [&]() {
+        return Time([&]() { SaveBinarySTL(stlPath, model, pool); });
+    }));
+    std::remove(stlPath.c_str());
+}
+
+// MeasureSerial runs the single threaded benchmarks; Split changes the
+// model, so it has to come last
+template <typename T>
+void MeasureSerial(
+    Model<T> &model, const std::string &scalar,
+    const BenchOptions &options, Reporter &reporter)
+{
+    const int reps = options.Reps;
+    const int cells = model.Positions().size();
+
+    reporter.Report(
+        "Index::Ensure", "serial", scalar, false, cells, 1, reps, cells,
+        Median(reps, [&]() { return ModelBench::IndexEnsure(model); }));
+
+    const int splits = std::min(1000, cells / 10);
+    int next = 0;
+    reporter.Report(
+        "Split", "serial", scalar, false, cells, 1, reps, splits,
+        Median(reps, [&]() {
+            return Time([&]() {
+                for (int i = 0; i < splits; i++) {
+                    ModelBench::Split(model, uint64_t(next++) * 7919 % cells);
+                }
+            });
+        }));
+}
+
+template <typename T>
+void RunScalar(
+    const std::string &scalar, const std::vector<int> &threads,
+    const BenchOptions &options, Reporter &reporter)
+{
+    for (const int cells : options.Cells) {
+        Model<T> model = AsScalar(Fixture(options.Directory, cells), T());
+        reporter.ReportMemory(scalar, false, cells, model.MemoryReport());
+        model.SetCompact(true);
+        reporter.ReportMemory(scalar, true, cells, model.MemoryReport());
+        model.SetCompact(false);
+        for (const int t : threads) {
+            Measure(model, "strong", scalar, t, options, reporter);
+        }
+        MeasureSerial(model, scalar, options, reporter);
+    }
+
+    if (options.WeakCells > 0) {
+        for (const int t : threads) {
+            Model<T> model = AsScalar(
+                Fixture(options.Directory, options.WeakCells * t), T());
+            Measure(model, "weak", scalar, t, options, reporter);
+        }
+    }
+}
+
+}
+
+void RunBench(const BenchOptions &options) {
+    mkdir(options.Directory.c_str(), 0755);
+
+    std::vector<int> threads = options.Threads;
+    if (threads.empty()) {
+        const int cores = std::max(1u, std::thread::hardware_concurrency());
+        for (int t = 1; t < cores; t *= 2) {
+            threads.push_back(t);
+        }
+        threads.push_back(cores);
+    }
+
+    Reporter reporter(options.Directory + "/bench.jsonl");
+    RunScalar<float>("float", threads, options, reporter);
+    RunScalar<double>("double", threads, options, reporter);
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// BenchOptions configures RunBench
+struct BenchOptions {
+    // directory for fixtures and results
+    std::string Directory = "bench";
+
+    // fixture sizes for strong scaling
+    std::vector<int> Cells = {10000, 100000, 1000000, 10000000};
+
+    // thread counts, empty = 1, 2, 4, ... up to the number of cores
+    std::vector<int> Threads;
+
+    // cells per thread for weak scaling, 0 = skip
+    int WeakCells = 10000;
+
+    // timed repetitions per measurement; the median is reported
+    int Reps = 5;
+};
+
+// RunBench times the stages of the simulation core one at a time: the
+// force kernel (UpdateBatch, exact and fast math), Index::Update,
+// Index::Ensure, Split, TriangleIndexes, Decimate and SaveBinarySTL, and
+// reports the MemoryReport of every fixture after loading it. Each stage is
+// run in float and double for every fixture size and thread count (strong
+// scaling) and with a fixed number of cells per thread (weak scaling).
+//
+// Fixtures are forms grown from a seeded sphere to an exact cell count and
+// saved as checkpoints in the directory, so later runs reuse them. Results
+// are printed and appended to bench.jsonl in the directory, one JSON object
+// per line.
+void RunBench(const BenchOptions &options);
@@ -0,0 +1,268 @@
+#include "checkpoint.h"
+
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <vector>
+
+#include "profile.h"
+#include "util.h"
+
+using namespace boost::interprocess;
+
+namespace {
+
+const char Magic[8] = {'C', 'E', 'L', 'L', 'F', 'O', 'R', 'M'};
+const uint32_t Version = 1;
+
+struct Header {
+    char Magic[8];
+    uint32_t Version;
+    uint32_t ScalarSize;
+    uint64_t Iteration;
+    uint64_t NumCells;
+    uint64_t NumLinks;
+    uint64_t RandomStateSize;
+    double SplitThreshold;
+    double LinkRestLength;
+    double RadiusOfInfluence;
+    double RepulsionFactor;
+    double SpringFactor;
+    double PlanarFactor;
+    double BulgeFactor;
+};
+
+uint64_t Align(const uint64_t n) {
+    return (n + 7) & ~uint64_t(7);
+}
+
+const Header &ReadHeader(const mapped_region &mr, const std::string &path) {
+    if (mr.get_size() < sizeof(Header)) {
+        Panic("truncated checkpoint: " + path);
+    }
+    const Header &header = *(const Header *)mr.get_address();
+    if (memcmp(header.Magic, Magic, 8) != 0) {
+        Panic("not a checkpoint: " + path);
+    }
+    if (header.Version != Version) {
+        Panic("unsupported checkpoint version: " + path);
+    }
+    return header;
+}
+
+}
+
+int CheckpointScalarSize(const std::string &path) {
+    file_mapping fm(path.c_str(), read_only);
+    mapped_region mr(fm, read_only);
+    return ReadHeader(mr, path).ScalarSize;
+}
+
+template <typename T>
+void SaveCheckpoint(
+    const std::string &path, const Model<T> &model, const uint64_t iteration)
+{
+    PROFILE_SCOPE("SaveCheckpoint");
+    const auto &positions = model.Positions();
+    const auto &normals = model.Normals();
+    const auto &food = model.Food();
+    const auto &links = model.Links();
+    const std::string randomState = RandomState();
+
+    // flatten link rings
+    std::vector<uint64_t> offsets;
+    std::vector<int32_t> ids;
+    offsets.reserve(links.size() + 1);
+    offsets.push_back(0);
+    for (const auto &ring : links) {
+        ids.insert(ids.end(), ring.begin(), ring.end());
+        offsets.push_back(ids.size());
+    }
+
+    Header header;
+    memcpy(header.Magic, Magic, 8);
+    header.Version = Version;
+    header.ScalarSize = sizeof(T);
+    header.Iteration = iteration;
+    header.NumCells = positions.size();
+    header.NumLinks = ids.size();
+    header.RandomStateSize = randomState.size();
+    header.SplitThreshold = model.SplitThreshold();
+    header.LinkRestLength = model.LinkRestLength();
+    header.RadiusOfInfluence = model.RadiusOfInfluence();
+    header.RepulsionFactor = model.RepulsionFactor();
+    header.SpringFactor = model.SpringFactor();
+    header.PlanarFactor = model.PlanarFactor();
+    header.BulgeFactor = model.BulgeFactor();
+
+    // gather every section, with zero padding to keep them 8-byte aligned
+    const uint64_t zeros = 0;
+    std::vector<iovec> iov;
+    const auto add = [&iov, &zeros](const void *data, const uint64_t size) {
+        iov.push_back({const_cast<void *>(data), size});
+        if (Align(size) != size) {
+            iov.push_back({(void *)&zeros, Align(size) - size});
+        }
+    };
+    add(&header, sizeof(header));
+    add(randomState.data(), randomState.size());
+    add(positions.data(), positions.size() * sizeof(positions[0]));
+    add(normals.data(), normals.size() * sizeof(normals[0]));
+    add(food.data(), food.size() * sizeof(food[0]));
+    add(offsets.data(), offsets.size() * sizeof(offsets[0]));
+    add(ids.data(), ids.size() * sizeof(ids[0]));
+
+    // write to a temporary file, flush it to disk and rename it, so that a
+    // crash at any point leaves either the old or the new checkpoint
+    const std::string tmp = path + ".tmp";
+    const int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        Panic("failed to create checkpoint: " + tmp);
+    }
+    int i = 0;
+    while (i < iov.size()) {
+        const ssize_t n = writev(fd, iov.data() + i, iov.size() - i);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            Panic("failed to write checkpoint: " + tmp);
+        }
+        // skip the sections that were written completely
+        size_t written = n;
+        while (i < iov.size() && written >= iov[i].iov_len) {
+            written -= iov[i].iov_len;
+            i++;
+        }
+        if (i < iov.size()) {
+            iov[i].iov_base = (uint8_t *)iov[i].iov_base + written;
+            iov[i].iov_len -= written;
+        }
+    }
+    model.ReleaseDecoded();
+    if (fsync(fd) != 0) {
+        Panic("failed to sync checkpoint: " + tmp);
+    }
+    if (close(fd) != 0) {
+        Panic("failed to close checkpoint: " + tmp);
+    }
+    if (rename(tmp.c_str(), path.c_str()) != 0) {
+        Panic("failed to rename checkpoint: " + tmp);
+    }
+
+    // and the rename itself
+    const auto slash = path.rfind('/');
+    const std::string directory =
+        slash == std::string::npos ? "." : path.substr(0, slash + 1);
+    const int dirfd = open(directory.c_str(), O_RDONLY);
+    if (dirfd < 0) {
+        Panic("failed to open checkpoint directory: " + directory);
+    }
+    if (fsync(dirfd) != 0 && errno != EINVAL) {
+        Panic("failed to sync checkpoint directory: " + directory);
+    }
+    close(dirfd);
+}
+
+template <typename T>
+Model<T> LoadCheckpoint(
+    const std::string &path, uint64_t &iteration, ThreadPool &pool)
+{
+    typedef typename Model<T>::vec3 vec3;
+
+    file_mapping fm(path.c_str(), read_only);
+    mapped_region mr(fm, read_only);
+    mr.advise(mapped_region::advice_sequential);
+    const Header &header = ReadHeader(mr, path);
+    if (header.ScalarSize != sizeof(T)) {
+        Panic("checkpoint scalar size mismatch: " + path);
+    }
+
+    const uint64_t n = header.NumCells;
+    const uint64_t m = header.NumLinks;
+    const uint64_t expected =
+        Align(sizeof(Header)) +
+        Align(header.RandomStateSize) +
+        Align(n * sizeof(vec3)) * 2 +
+        Align(n * sizeof(T)) +
+        Align((n + 1) * sizeof(uint64_t)) +
+        Align(m * sizeof(int32_t));
+    if (mr.get_size() < expected) {
+        Panic("truncated checkpoint: " + path);
+    }
+
+    const uint8_t *src = (const uint8_t *)mr.get_address();
+    const auto next = [&src](const uint64_t size) {
+        const uint8_t *p = src;
+        src += Align(size);
+        return p;
+    };
+    next(sizeof(Header));
+
+    const char *state = (const char *)next(header.RandomStateSize);
+    SetRandomState(std::string(state, header.RandomStateSize));
+
+    const vec3 *positions = (const vec3 *)next(n * sizeof(vec3));
+    const vec3 *normals = (const vec3 *)next(n * sizeof(vec3));
+    const T *food = (const T *)next(n * sizeof(T));
+    const uint64_t *offsets =
+        (const uint64_t *)next((n + 1) * sizeof(uint64_t));
+    const int32_t *ids = (const int32_t *)next(m * sizeof(int32_t));
+
+    // rebuild the rings on the pool; a bad ring is reported once they are
+    // all done
+    std::vector<std::vector<int>> links(n);
+    std::atomic<bool> badOffsets(false);
+    std::atomic<bool> badIds(false);
+    pool.Run(pool.NumThreads(), [&](const int wi, const int wn) {
+        const uint64_t i0 = n * wi / wn;
+        const uint64_t i1 = n * (wi + 1) / wn;
+        for (uint64_t i = i0; i < i1; i++) {
+            if (offsets[i] > offsets[i + 1] || offsets[i + 1] > m) {
+                badOffsets = true;
+                return;
+            }
+            links[i].assign(ids + offsets[i], ids + offsets[i + 1]);
+            for (const int j : links[i]) {
+                if (j < 0 || j >= n) {
+                    badIds = true;
+                    return;
+                }
+            }
+        }
+    });
+    if (badOffsets) {
+        Panic("corrupt link offsets in checkpoint: " + path);
+    }
+    if (badIds) {
+        Panic("corrupt link ids in checkpoint: " + path);
+    }
+
+    iteration = header.Iteration;
+    return Model<T>(
+        header.SplitThreshold, header.LinkRestLength,
+        header.RadiusOfInfluence, header.RepulsionFactor,
+        header.SpringFactor, header.PlanarFactor, header.BulgeFactor,
+        MappedVector<vec3>(positions, positions + n),
+        MappedVector<vec3>(normals, normals + n),
+        MappedVector<T>(food, food + n),
+        std::move(links), pool);
+}
+
+template void SaveCheckpoint(
+    const std::string &path, const Model<float> &model,
+    const uint64_t iteration);
+template void SaveCheckpoint(
+    const std::string &path, const Model<double> &model,
+    const uint64_t iteration);
+
+template Model<float> LoadCheckpoint(
+    const std::string &path, uint64_t &iteration, ThreadPool &pool);
+template Model<double> LoadCheckpoint(
+    const std::string &path, uint64_t &iteration, ThreadPool &pool);
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "model.h"
+#include "pool.h"
+
+// A checkpoint stores everything needed to resume a run: parameters,
+// positions, normals, food, the ordered link rings (flattened as offsets +
+// ids) and the state of the calling thread's random generator.
+//
+// The file is a fixed header followed by the arrays, each 8-byte aligned,
+// written back to back in a single gathered write, synced to disk before it
+// replaces the previous checkpoint. Loading memory-maps the file and copies
+// the arrays straight out of the mapping; the link rings and the spatial
+// index are rebuilt on the pool. The new index reorders the repulsion sums,
+// so float runs pick up rounding-level differences after a resume.
+
+// CheckpointScalarSize returns sizeof(T) of the model saved at path, so the
+// caller can pick the matching Model instantiation
+int CheckpointScalarSize(const std::string &path);
+
+template <typename T>
+void SaveCheckpoint(
+    const std::string &path, const Model<T> &model, const uint64_t iteration);
+
+template <typename T>
+Model<T> LoadCheckpoint(
+    const std::string &path, uint64_t &iteration, ThreadPool &pool);
@@ -0,0 +1,61 @@
+#include "cpu.h"
+
+#include "util.h"
+
+namespace {
+
+ISA &Selected() {
+    static ISA isa = DetectISA();
+    return isa;
+}
+
+}
+
+ISA DetectISA() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") &&
+        __builtin_cpu_supports("avx512vl") &&
+        __builtin_cpu_supports("avx512dq"))
+    {
+        return ISA::AVX512;
+    }
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        return ISA::AVX2;
+    }
+    if (__builtin_cpu_supports("sse4.2")) {
+        return ISA::SSE42;
+    }
+#endif
+    return ISA::Default;
+}
+
+ISA ActiveISA() {
+    return Selected();
+}
+
+void SetISA(const ISA isa) {
+    if (isa > DetectISA()) {
+        Panic(ISAName(isa) + " is not supported by this CPU");
+    }
+    Selected() = isa;
+}
+
+bool ParseISA(const std::string &name, ISA &isa) {
+    for (const ISA i : {ISA::Default, ISA::SSE42, ISA::AVX2, ISA::AVX512}) {
+        if (name == ISAName(i)) {
+            isa = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+std::string ISAName(const ISA isa) {
+    switch (isa) {
+    case ISA::SSE42: return "sse4.2";
+    case ISA::AVX2: return "avx2";
+    case ISA::AVX512: return "avx512";
+    default: return "default";
+    }
+}
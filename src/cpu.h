@@ -0,0 +1,39 @@
+#pragma once
+
+#include <string>
+
+// instruction set variants that the hot kernels are compiled for
+enum class ISA {
+    Default,
+    SSE42,
+    AVX2,
+    AVX512,
+};
+
+// DetectISA returns the best variant supported by this CPU
+ISA DetectISA();
+
+// ActiveISA returns the variant that kernels dispatch to. It is the detected
+// one unless SetISA has been used to force a variant for benchmarking.
+ISA ActiveISA();
+
+void SetISA(const ISA isa);
+
+bool ParseISA(const std::string &name, ISA &isa);
+
+std::string ISAName(const ISA isa);
+
+// kernels are written once as an always-inline body and wrapped in one
+// function per target so the compiler generates code for each ISA
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+
+#if defined(__x86_64__) || defined(__i386__)
+    #define TARGET_SSE42 __attribute__((target("sse4.2")))
+    #define TARGET_AVX2 __attribute__((target("avx2,fma")))
+    #define TARGET_AVX512 \
+        __attribute__((target("avx512f,avx512vl,avx512dq,avx2,fma")))
+#else
+    #define TARGET_SSE42
+    #define TARGET_AVX2
+    #define TARGET_AVX512
+#endif
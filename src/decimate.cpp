@@ -0,0 +1,584 @@
+#include "decimate.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <numeric>
+
+namespace {
+
+// Quadric sums the squared distances to a set of planes, as a symmetric
+// 4x4 matrix stored as its upper triangle
+struct Quadric {
+    double Q[10];
+
+    Quadric() {
+        std::fill(Q, Q + 10, 0.0);
+    }
+
+    // plane n.p + d = 0, n of unit length
+    Quadric(const glm::dvec3 &n, const double d) {
+        Q[0] = n.x * n.x; Q[1] = n.x * n.y; Q[2] = n.x * n.z; Q[3] = n.x * d;
+        Q[4] = n.y * n.y; Q[5] = n.y * n.z; Q[6] = n.y * d;
+        Q[7] = n.z * n.z; Q[8] = n.z * d;
+        Q[9] = d * d;
+    }
+
+    Quadric &operator+=(const Quadric &other) {
+        for (int i = 0; i < 10; i++) {
+            Q[i] += other.Q[i];
+        }
+        return *this;
+    }
+
+    Quadric operator+(const Quadric &other) const {
+        Quadric result = *this;
+        result += other;
+        return result;
+    }
+
+    double Error(const glm::dvec3 &p) const {
+        const double x = p.x, y = p.y, z = p.z;
+        return
+            Q[0] * x * x + 2 * Q[1] * x * y + 2 * Q[2] * x * z + 2 * Q[3] * x +
+            Q[4] * y * y + 2 * Q[5] * y * z + 2 * Q[6] * y +
+            Q[7] * z * z + 2 * Q[8] * z +
+            Q[9];
+    }
+
+    // Minimum finds the point of least error, returning false if the planes
+    // are too close to parallel to pin one down
+    bool Minimum(glm::dvec3 &p) const {
+        // Cramer's rule on the upper left 3x3 against the last column
+        const glm::dvec3 c0(Q[0], Q[1], Q[2]);
+        const glm::dvec3 c1(Q[1], Q[4], Q[5]);
+        const glm::dvec3 c2(Q[2], Q[5], Q[7]);
+        const glm::dvec3 r = -glm::dvec3(Q[3], Q[6], Q[8]);
+        const double det = glm::dot(c0, glm::cross(c1, c2));
+        const double trace = Q[0] + Q[4] + Q[7];
+        if (std::abs(det) <= 1e-9 * trace * trace * trace) {
+            return false;
+        }
+        p = glm::dvec3(
+            glm::dot(r, glm::cross(c1, c2)),
+            glm::dot(c0, glm::cross(r, c2)),
+            glm::dot(c0, glm::cross(c1, r))) / det;
+        return true;
+    }
+};
+
+// Collapse is a vertex's cheapest valid edge, Other = -1 if it has none
+struct Collapse {
+    float Cost;
+    int Other;
+    glm::vec3 Position;
+
+    bool operator<(const Collapse &other) const {
+        if (Cost != other.Cost) {
+            return Cost < other.Cost;
+        }
+        return Other < other.Other;
+    }
+};
+
+// Rings lists the faces around each vertex, flattened as offsets + face ids
+// in increasing order
+class Rings {
+public:
+    void Build(
+        const std::vector<glm::uvec3> &indexes, const int nv,
+        ThreadPool &pool)
+    {
+        m_Offsets.assign(nv + 1, 0);
+        m_Faces.resize(indexes.size() * 3);
+        if (m_NumCursors < nv) {
+            m_Cursors.reset(new std::atomic<int>[nv]);
+            m_NumCursors = nv;
+        }
+        for (int v = 0; v < nv; v++) {
+            m_Cursors[v].store(0, std::memory_order_relaxed);
+        }
+
+        const uint64_t nf = indexes.size();
+        pool.Run(pool.NumThreads(), [&](const int wi, const int wn) {
+            const uint64_t i0 = nf * wi / wn;
+            const uint64_t i1 = nf * (wi + 1) / wn;
+            for (uint64_t i = i0; i < i1; i++) {
+                for (int j = 0; j < 3; j++) {
+                    m_Cursors[indexes[i][j]].fetch_add(
+                        1, std::memory_order_relaxed);
+                }
+            }
+        });
+        for (int v = 0; v < nv; v++) {
+            const int count = m_Cursors[v].load(std::memory_order_relaxed);
+            m_Offsets[v + 1] = m_Offsets[v] + count;
+            m_Cursors[v].store(m_Offsets[v], std::memory_order_relaxed);
+        }
+        pool.Run(pool.NumThreads(), [&](const int wi, const int wn) {
+            const uint64_t i0 = nf * wi / wn;
+            const uint64_t i1 = nf * (wi + 1) / wn;
+            for (uint64_t i = i0; i < i1; i++) {
+                for (int j = 0; j < 3; j++) {
+                    const int k = m_Cursors[indexes[i][j]].fetch_add(
+                        1, std::memory_order_relaxed);
+                    m_Faces[k] = i;
+                }
+            }
+        });
+
+        // the fill order depends on thread timing; sort it out so that the
+        // result doesn't
+        pool.Run(pool.NumThreads(), [&](const int wi, const int wn) {
+            const int v0 = uint64_t(nv) * wi / wn;
+            const int v1 = uint64_t(nv) * (wi + 1) / wn;
+            for (int v = v0; v < v1; v++) {
+                std::sort(
+                    m_Faces.begin() + m_Offsets[v],
+                    m_Faces.begin() + m_Offsets[v + 1]);
+            }
+        });
+    }
+
+    int Degree(const int v) const {
+        return m_Offsets[v + 1] - m_Offsets[v];
+    }
+
+    const int *Begin(const int v) const {
+        return m_Faces.data() + m_Offsets[v];
+    }
+
+    const int *End(const int v) const {
+        return m_Faces.data() + m_Offsets[v + 1];
+    }
+
+    // ForEachCorner calls f with each corner of the faces around v, most of
+    // them twice
+    template <typename F>
+    void ForEachCorner(
+        const std::vector<glm::uvec3> &indexes, const int v, F f) const
+    {
+        for (const int *face = Begin(v); face != End(v); face++) {
+            f(indexes[*face].x);
+            f(indexes[*face].y);
+            f(indexes[*face].z);
+        }
+    }
+
+    // Neighbors sets result to the vertices that share a face with v, sorted
+    void Neighbors(
+        const std::vector<glm::uvec3> &indexes, const int v,
+        std::vector<int> &result) const
+    {
+        result.clear();
+        for (const int *f = Begin(v); f != End(v); f++) {
+            for (int j = 0; j < 3; j++) {
+                if (indexes[*f][j] != v) {
+                    result.push_back(indexes[*f][j]);
+                }
+            }
+        }
+        std::sort(result.begin(), result.end());
+        result.erase(std::unique(result.begin(), result.end()), result.end());
+    }
+
+private:
+    std::vector<int> m_Offsets;
+    std::vector<int> m_Faces;
+    std::unique_ptr<std::atomic<int>[]> m_Cursors;
+    int m_NumCursors = 0;
+};
+
+// Evaluate finds where collapsing the edge a-b would put the merged vertex
+// and the error there, the same whichever end asks
+float Evaluate(
+    int a, int b,
+    const std::vector<glm::vec3> &positions,
+    const std::vector<Quadric> &quadrics,
+    glm::vec3 &position)
+{
+    if (a > b) {
+        std::swap(a, b);
+    }
+    const Quadric q = quadrics[a] + quadrics[b];
+    const glm::dvec3 pa(positions[a]);
+    const glm::dvec3 pb(positions[b]);
+    const glm::dvec3 mid = (pa + pb) * 0.5;
+
+    // the optimum, unless it lands far from the edge; then the better of
+    // the ends and the midpoint
+    glm::dvec3 best;
+    double error;
+    if (q.Minimum(best) && glm::distance(best, mid) <= glm::distance(pa, pb)) {
+        error = q.Error(best);
+    } else {
+        best = pa;
+        error = q.Error(pa);
+        for (const glm::dvec3 &p : {pb, mid}) {
+            const double e = q.Error(p);
+            if (e < error) {
+                best = p;
+                error = e;
+            }
+        }
+    }
+    position = glm::vec3(best);
+    return std::max(error, 0.0);
+}
+
+// Valid reports whether collapsing a-b to position keeps the mesh manifold
+// and flips no face; na and nb are the neighbors of a and b
+bool Valid(
+    const int a, const int b, const glm::vec3 &position,
+    const std::vector<int> &na, const std::vector<int> &nb,
+    const std::vector<glm::vec3> &positions,
+    const std::vector<glm::uvec3> &indexes,
+    const Rings &rings)
+{
+    // link condition: a and b share exactly the two vertices across their
+    // edge, and those keep at least three neighbors
+    int common = 0;
+    for (const int c : na) {
+        if (std::binary_search(nb.begin(), nb.end(), c)) {
+            if (rings.Degree(c) <= 3) {
+                return false;
+            }
+            common++;
+        }
+    }
+    if (common != 2 || na.size() + nb.size() < 7) {
+        return false;
+    }
+
+    // the faces that stay must not turn over
+    for (const int v : {a, b}) {
+        for (const int *f = rings.Begin(v); f != rings.End(v); f++) {
+            const glm::uvec3 &t = indexes[*f];
+            const bool hasA = t.x == a || t.y == a || t.z == a;
+            const bool hasB = t.x == b || t.y == b || t.z == b;
+            if (hasA && hasB) {
+                continue;
+            }
+            glm::vec3 p[3];
+            for (int j = 0; j < 3; j++) {
+                p[j] = t[j] == v ? position : positions[t[j]];
+            }
+            const glm::vec3 before = glm::cross(
+                positions[t.y] - positions[t.x],
+                positions[t.z] - positions[t.x]);
+            const glm::vec3 after = glm::cross(p[1] - p[0], p[2] - p[0]);
+            if (glm::dot(before, after) <= 0) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Key orders the claimed collapses by cost, then by the vertex that claims
+// them, which claims at most one
+uint64_t Key(const float cost, const int a) {
+    uint32_t bits;
+    memcpy(&bits, &cost, sizeof(bits));
+    return uint64_t(bits) << 32 | uint32_t(a);
+}
+
+void AtomicMin(std::atomic<uint64_t> &value, const uint64_t key) {
+    uint64_t current = value.load(std::memory_order_relaxed);
+    while (key < current && !value.compare_exchange_weak(
+        current, key, std::memory_order_relaxed))
+    {
+    }
+}
+
+}
+
+DecimateStats Decimate(
+    std::vector<glm::vec3> &positions,
+    std::vector<glm::uvec3> &indexes,
+    const DecimateOptions &options,
+    ThreadPool &pool,
+    std::vector<int> *sources)
+{
+    const auto startTime = std::chrono::steady_clock::now();
+    const int nv = positions.size();
+    DecimateStats stats;
+    stats.TrianglesBefore = indexes.size();
+    if (sources) {
+        sources->resize(nv);
+        std::iota(sources->begin(), sources->end(), 0);
+    }
+    if (!options.Enabled()) {
+        stats.TrianglesAfter = indexes.size();
+        return stats;
+    }
+
+    const float maxCost = options.MaxError > 0 ?
+        options.MaxError * options.MaxError :
+        std::numeric_limits<float>::infinity();
+    const int numBatches = std::max(1, pool.NumThreads());
+
+    Rings rings;
+    std::vector<Quadric> quadrics(nv);
+    std::vector<Collapse> best(nv);
+    std::unique_ptr<std::atomic<uint64_t>[]> claims(
+        new std::atomic<uint64_t>[nv]);
+    std::vector<int> remap(nv);
+    std::iota(remap.begin(), remap.end(), 0);
+    std::vector<std::vector<int>> active(numBatches);
+    std::vector<std::vector<int>> winners(numBatches);
+    std::vector<uint8_t> locked(nv);
+    std::vector<std::vector<glm::uvec3>> kept(numBatches);
+    std::vector<int> collapses;
+
+    // vertices whose faces, position or quadric changed in the last pass;
+    // only those within two rings of one need to pick again
+    std::vector<uint8_t> changed(nv, 1);
+
+    // isCandidate reports whether a claims its edge; an edge picked from
+    // both ends is claimed by its lower vertex
+    const auto isCandidate = [&best](const int a) {
+        const int b = best[a].Other;
+        return b >= 0 && !(b < a && best[b].Other == a);
+    };
+
+    while (options.TargetTriangles == 0 ||
+        indexes.size() > options.TargetTriangles)
+    {
+        rings.Build(indexes, nv, pool);
+
+        // plane quadrics of the original faces, summed at their corners
+        if (stats.Passes == 0) {
+            pool.Run(numBatches, [&](const int wi, const int wn) {
+                const int v0 = uint64_t(nv) * wi / wn;
+                const int v1 = uint64_t(nv) * (wi + 1) / wn;
+                for (int v = v0; v < v1; v++) {
+                    const int *end = rings.End(v);
+                    for (const int *f = rings.Begin(v); f != end; f++) {
+                        const glm::uvec3 &t = indexes[*f];
+                        const glm::dvec3 p0(positions[t.x]);
+                        const glm::dvec3 p1(positions[t.y]);
+                        const glm::dvec3 p2(positions[t.z]);
+                        glm::dvec3 n = glm::cross(p1 - p0, p2 - p0);
+                        const double length = glm::length(n);
+                        if (length == 0) {
+                            continue;
+                        }
+                        n /= length;
+                        quadrics[v] += Quadric(n, -glm::dot(n, p0));
+                    }
+                }
+            });
+        }
+
+        // each vertex picks its cheapest valid collapse
+        pool.Run(numBatches, [&](const int wi, const int wn) {
+            const int v0 = uint64_t(nv) * wi / wn;
+            const int v1 = uint64_t(nv) * (wi + 1) / wn;
+            std::vector<int> na, nb;
+            std::vector<Collapse> choices;
+            for (int v = v0; v < v1; v++) {
+                claims[v].store(UINT64_MAX, std::memory_order_relaxed);
+                locked[v] = 0;
+                bool dirty = changed[v];
+                rings.ForEachCorner(indexes, v, [&](const int c) {
+                    dirty |= changed[c];
+                });
+                if (!dirty) {
+                    continue;
+                }
+                best[v].Other = -1;
+                if (rings.Degree(v) == 0) {
+                    continue;
+                }
+                rings.Neighbors(indexes, v, na);
+                choices.clear();
+                for (const int b : na) {
+                    Collapse c;
+                    c.Other = b;
+                    c.Cost = Evaluate(v, b, positions, quadrics, c.Position);
+                    if (c.Cost <= maxCost) {
+                        choices.push_back(c);
+                    }
+                }
+                std::sort(choices.begin(), choices.end());
+                for (const Collapse &c : choices) {
+                    rings.Neighbors(indexes, c.Other, nb);
+                    if (Valid(v, c.Other, c.Position, na, nb,
+                        positions, indexes, rings))
+                    {
+                        best[v] = c;
+                        break;
+                    }
+                }
+            }
+        });
+
+        // the picked edges claim the vertices around them in rounds; the
+        // ones that win all of their claims lock those vertices, the ones
+        // that touch a locked vertex drop out and the rest try again, until
+        // the winners are a maximal set of edges with disjoint neighborhoods
+        pool.Run(numBatches, [&](const int wi, const int wn) {
+            const int v0 = uint64_t(nv) * wi / wn;
+            const int v1 = uint64_t(nv) * (wi + 1) / wn;
+            active[wi].clear();
+            winners[wi].clear();
+            for (int a = v0; a < v1; a++) {
+                changed[a] = 0;
+                if (isCandidate(a)) {
+                    active[wi].push_back(a);
+                }
+            }
+        });
+        const auto forEachCorner = [&](const int a, const auto &f) {
+            rings.ForEachCorner(indexes, a, f);
+            rings.ForEachCorner(indexes, best[a].Other, f);
+        };
+        while (std::any_of(active.begin(), active.end(),
+            [](const std::vector<int> &a) { return !a.empty(); }))
+        {
+            pool.Run(numBatches, [&](const int wi, const int) {
+                auto &list = active[wi];
+                list.erase(std::remove_if(list.begin(), list.end(),
+                    [&](const int a) {
+                        bool blocked = false;
+                        forEachCorner(a, [&](const int c) {
+                            blocked |= locked[c];
+                        });
+                        if (!blocked) {
+                            const uint64_t key = Key(best[a].Cost, a);
+                            forEachCorner(a, [&](const int c) {
+                                AtomicMin(claims[c], key);
+                            });
+                        }
+                        return blocked;
+                    }), list.end());
+            });
+            pool.Run(numBatches, [&](const int wi, const int) {
+                auto &list = active[wi];
+                list.erase(std::remove_if(list.begin(), list.end(),
+                    [&](const int a) {
+                        const uint64_t key = Key(best[a].Cost, a);
+                        bool won = true;
+                        forEachCorner(a, [&](const int c) {
+                            won &= claims[c].load(
+                                std::memory_order_relaxed) == key;
+                        });
+                        if (won) {
+                            winners[wi].push_back(a);
+                            forEachCorner(a, [&](const int c) {
+                                locked[c] = 1;
+                            });
+                        }
+                        return won;
+                    }), list.end());
+            });
+            pool.Run(numBatches, [&](const int wi, const int) {
+                for (const int a : active[wi]) {
+                    forEachCorner(a, [&](const int c) {
+                        claims[c].store(UINT64_MAX, std::memory_order_relaxed);
+                    });
+                }
+            });
+        }
+
+        collapses.clear();
+        for (const auto &w : winners) {
+            collapses.insert(collapses.end(), w.begin(), w.end());
+        }
+        if (collapses.empty()) {
+            break;
+        }
+
+        // a collapse removes two faces; take only the cheapest ones needed
+        if (options.TargetTriangles > 0) {
+            const uint64_t needed =
+                (indexes.size() - options.TargetTriangles + 1) / 2;
+            if (collapses.size() > needed) {
+                std::nth_element(
+                    collapses.begin(), collapses.begin() + needed,
+                    collapses.end(), [&best](const int a, const int b) {
+                        return Key(best[a].Cost, a) < Key(best[b].Cost, b);
+                    });
+                collapses.resize(needed);
+            }
+        }
+
+        // collapse b into a; the winners own the corners around them, so
+        // marking those as changed doesn't race
+        const uint64_t nc = collapses.size();
+        pool.Run(numBatches, [&](const int wi, const int wn) {
+            const uint64_t i0 = nc * wi / wn;
+            const uint64_t i1 = nc * (wi + 1) / wn;
+            for (uint64_t i = i0; i < i1; i++) {
+                const int a = collapses[i];
+                const int b = best[a].Other;
+                positions[a] = best[a].Position;
+                quadrics[a] += quadrics[b];
+                remap[b] = a;
+                for (const int v : {a, b}) {
+                    rings.ForEachCorner(indexes, v, [&](const int c) {
+                        changed[c] = 1;
+                    });
+                }
+            }
+        });
+
+        // rewrite the faces, dropping the ones that collapsed
+        const uint64_t nf = indexes.size();
+        pool.Run(numBatches, [&](const int wi, const int wn) {
+            const uint64_t i0 = nf * wi / wn;
+            const uint64_t i1 = nf * (wi + 1) / wn;
+            kept[wi].clear();
+            for (uint64_t i = i0; i < i1; i++) {
+                const glm::uvec3 t(
+                    remap[indexes[i].x], remap[indexes[i].y],
+                    remap[indexes[i].z]);
+                if (t.x != t.y && t.y != t.z && t.z != t.x) {
+                    kept[wi].push_back(t);
+                }
+            }
+        });
+        indexes.clear();
+        for (const auto &k : kept) {
+            indexes.insert(indexes.end(), k.begin(), k.end());
+        }
+        stats.Passes++;
+    }
+
+    // drop the vertices no face uses any more
+    std::vector<int> renumber(nv, -1);
+    for (const glm::uvec3 &t : indexes) {
+        for (int j = 0; j < 3; j++) {
+            renumber[t[j]] = 0;
+        }
+    }
+    int count = 0;
+    for (int v = 0; v < nv; v++) {
+        if (renumber[v] < 0) {
+            continue;
+        }
+        renumber[v] = count;
+        positions[count] = positions[v];
+        if (sources) {
+            (*sources)[count] = v;
+        }
+        count++;
+    }
+    positions.resize(count);
+    if (sources) {
+        sources->resize(count);
+    }
+    for (glm::uvec3 &t : indexes) {
+        t = glm::uvec3(renumber[t.x], renumber[t.y], renumber[t.z]);
+    }
+
+    stats.TrianglesAfter = indexes.size();
+    const std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - startTime;
+    stats.Seconds = elapsed.count();
+    return stats;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <vector>
+
+#include "pool.h"
+
+// Decimate simplifies an indexed triangle mesh by quadric error edge
+// collapses (Garland and Heckbert), for previews that don't need every
+// cell. The collapses run in passes on the pool: each vertex picks its
+// cheapest valid edge, the edges claim the vertices around them with an
+// atomic min of their cost in rounds until the winners are a maximal set
+// with disjoint neighborhoods, and the winners collapse together. A pass
+// keeps only the cheapest winners if fewer reach the target. Only vertices
+// near a collapse pick again in the next pass.
+//
+// A collapse is valid if it keeps the mesh manifold and flips no face.
+// Boundary edges are never collapsed.
+
+struct DecimateOptions {
+    // stop at this many triangles, 0 = no target
+    uint64_t TargetTriangles = 0;
+
+    // largest error of a collapse, as the root of the summed squared
+    // distances from the merged vertex to the original planes around it,
+    // 0 = no bound
+    float MaxError = 0;
+
+    // with neither set, Decimate leaves the mesh alone
+    bool Enabled() const { return TargetTriangles > 0 || MaxError > 0; }
+};
+
+struct DecimateStats {
+    uint64_t TrianglesBefore = 0;
+    uint64_t TrianglesAfter = 0;
+    int Passes = 0;
+    double Seconds = 0;
+
+    double Ratio() const {
+        return TrianglesBefore ? double(TrianglesAfter) / TrianglesBefore : 1;
+    }
+};
+
+// Decimate replaces positions and indexes with the simplified mesh. If
+// sources is given it is set to the original vertex each new one came from,
+// to carry per-vertex attributes over.
+DecimateStats Decimate(
+    std::vector<glm::vec3> &positions,
+    std::vector<glm::uvec3> &indexes,
+    const DecimateOptions &options,
+    ThreadPool &pool,
+    std::vector<int> *sources = nullptr);
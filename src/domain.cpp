@@ -0,0 +1,734 @@
+#include "domain.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <limits>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "checkpoint.h"
+#include "exporter.h"
+#include "profile.h"
+#include "util.h"
+
+template <typename T>
+void Domain<T>::Cells::Clear() {
+    Ids.clear();
+    Positions.clear();
+    Normals.clear();
+    Food.clear();
+    Links.clear();
+}
+
+template <typename T>
+void Domain<T>::Cells::Write(Buffer &buffer, const int i) const {
+    BufferWriter writer(buffer);
+    writer.Write(Ids[i]);
+    writer.Write(Positions[i]);
+    writer.Write(Normals[i]);
+    writer.Write(Food[i]);
+    writer.Write(uint32_t(Links[i].size()));
+    for (const int64_t j : Links[i]) {
+        writer.Write(j);
+    }
+}
+
+template <typename T>
+void Domain<T>::Cells::Read(const Buffer &buffer) {
+    BufferReader reader(buffer);
+    while (!reader.Done()) {
+        Ids.push_back(reader.Read<int64_t>());
+        Positions.push_back(reader.Read<vec3>());
+        Normals.push_back(reader.Read<vec3>());
+        Food.push_back(reader.Read<T>());
+        Links.emplace_back(reader.Read<uint32_t>());
+        for (int64_t &j : Links.back()) {
+            j = reader.Read<int64_t>();
+        }
+    }
+}
+
+template <typename T>
+void Domain<T>::Cells::Remove(const int i) {
+    Ids[i] = Ids.back();
+    Positions[i] = Positions.back();
+    Normals[i] = Normals.back();
+    Food[i] = Food.back();
+    Links[i].swap(Links.back());
+    Ids.pop_back();
+    Positions.pop_back();
+    Normals.pop_back();
+    Food.pop_back();
+    Links.pop_back();
+}
+
+template <typename T>
+Domain<T>::Domain(
+    Transport &transport, const std::vector<Triangle> &triangles,
+    const Settings &settings, ThreadPool &pool) :
+    m_Transport(transport),
+    m_Pool(pool),
+    m_Settings(settings),
+    m_HaloWidth(2 * std::max(
+        settings.RadiusOfInfluence, settings.LinkRestLength)),
+    m_Boundaries(
+        transport.Size() - 1, std::numeric_limits<T>::max()),
+    m_SeedCells(0),
+    m_NextChild(0)
+{
+    // only rank 0 builds the seed and keeps its cells until the first
+    // rebalance; every rank needs its size to number children
+    double seedCells = 0;
+    if (transport.Rank() == 0) {
+        const Model<T> seed = MakeModel<T>(triangles, settings, pool);
+        seedCells = seed.Positions().size();
+        const auto &links = seed.Links();
+        for (int i = 0; i < seed.Positions().size(); i++) {
+            m_Owned.Ids.push_back(i);
+            m_Owned.Positions.push_back(seed.Positions()[i]);
+            m_Owned.Normals.push_back(seed.Normals()[i]);
+            m_Owned.Food.push_back(seed.Food()[i]);
+            m_Owned.Links.emplace_back(links[i].begin(), links[i].end());
+        }
+    }
+    m_SeedCells = transport.Sum({seedCells})[0];
+    Rebalance();
+}
+
+template <typename T>
+int Domain<T>::SlabOf(const T x) const {
+    return std::upper_bound(m_Boundaries.begin(), m_Boundaries.end(), x) -
+        m_Boundaries.begin();
+}
+
+template <typename T>
+void Domain<T>::ExchangeGhosts() {
+    PROFILE_SCOPE("ExchangeGhosts");
+    const int rank = m_Transport.Rank();
+    std::vector<Buffer> send(m_Transport.Size());
+    for (int i = 0; i < m_Owned.Ids.size(); i++) {
+        const T x = m_Owned.Positions[i].x;
+        const int q0 = SlabOf(x - m_HaloWidth);
+        const int q1 = SlabOf(x + m_HaloWidth);
+        for (int q = q0; q <= q1; q++) {
+            if (q != rank) {
+                m_Owned.Write(send[q], i);
+            }
+        }
+    }
+    const auto received = m_Transport.Exchange(send);
+    m_Ghosts.Clear();
+    m_GhostRanks.clear();
+    for (int q = 0; q < received.size(); q++) {
+        m_Ghosts.Read(received[q]);
+        m_GhostRanks.resize(m_Ghosts.Ids.size(), q);
+    }
+
+    // a burst of neighboring splits can stretch links past the halo, so
+    // ask every rank for the linked cells that are still missing
+    std::unordered_set<int64_t> known(
+        m_Owned.Ids.begin(), m_Owned.Ids.end());
+    known.insert(m_Ghosts.Ids.begin(), m_Ghosts.Ids.end());
+    Buffer request;
+    BufferWriter writer(request);
+    for (const auto &ring : m_Owned.Links) {
+        for (const int64_t id : ring) {
+            if (known.insert(id).second) {
+                writer.Write(id);
+            }
+        }
+    }
+    const auto requests = m_Transport.AllGather(request);
+    std::unordered_map<int64_t, int> index;
+    std::fill(send.begin(), send.end(), Buffer());
+    for (int q = 0; q < requests.size(); q++) {
+        if (q == rank || requests[q].empty()) {
+            continue;
+        }
+        if (index.empty()) {
+            for (int i = 0; i < m_Owned.Ids.size(); i++) {
+                index[m_Owned.Ids[i]] = i;
+            }
+        }
+        BufferReader reader(requests[q]);
+        while (!reader.Done()) {
+            const auto it = index.find(reader.Read<int64_t>());
+            if (it != index.end()) {
+                m_Owned.Write(send[q], it->second);
+            }
+        }
+    }
+    const auto fetched = m_Transport.Exchange(send);
+    for (int q = 0; q < fetched.size(); q++) {
+        m_Ghosts.Read(fetched[q]);
+        m_GhostRanks.resize(m_Ghosts.Ids.size(), q);
+    }
+    m_LastStep.Ghosts = m_Ghosts.Ids.size();
+}
+
+template <typename T>
+Model<T> &Domain<T>::BuildModel() {
+    const int numOwned = m_Owned.Ids.size();
+    const int numGhosts = m_Ghosts.Ids.size();
+    const int n = numOwned + numGhosts;
+
+    std::unordered_map<int64_t, int> local;
+    local.reserve(n);
+    for (int i = 0; i < numOwned; i++) {
+        local[m_Owned.Ids[i]] = i;
+    }
+    for (int i = 0; i < numGhosts; i++) {
+        local[m_Ghosts.Ids[i]] = numOwned + i;
+    }
+
+    // copy the cells and translate their rings on the pool, leaving -1 for
+    // links to cells outside the halo
+    MappedVector<vec3> positions(n);
+    MappedVector<vec3> normals(n);
+    MappedVector<T> food(n);
+    std::vector<std::vector<int>> links(n);
+    std::atomic<bool> missing(false);
+    ParallelFor(m_Pool, n, [&](const uint64_t i) {
+        const bool owned = i < numOwned;
+        const Cells &cells = owned ? m_Owned : m_Ghosts;
+        const int j = owned ? i : i - numOwned;
+        positions[i] = cells.Positions[j];
+        normals[i] = cells.Normals[j];
+        food[i] = cells.Food[j];
+        auto &ring = links[i];
+        ring.reserve(cells.Links[j].size());
+        for (const int64_t id : cells.Links[j]) {
+            const auto it = local.find(id);
+            if (it != local.end()) {
+                ring.push_back(it->second);
+            } else {
+                ring.push_back(-1);
+                if (owned) {
+                    missing = true;
+                }
+            }
+        }
+    });
+    if (missing) {
+        Panic("owned cell links to a cell no rank sent");
+    }
+
+    // number the placeholders in order of first appearance
+    m_Unknown.clear();
+    std::unordered_map<int64_t, int> unknown;
+    for (int i = 0; i < numGhosts; i++) {
+        auto &ring = links[numOwned + i];
+        for (int k = 0; k < ring.size(); k++) {
+            if (ring[k] != -1) {
+                continue;
+            }
+            const int64_t id = m_Ghosts.Links[i][k];
+            const auto u = unknown.find(id);
+            if (u != unknown.end()) {
+                ring[k] = u->second;
+                continue;
+            }
+            const int placeholder = -2 - int(m_Unknown.size());
+            unknown[id] = placeholder;
+            m_Unknown.push_back(id);
+            ring[k] = placeholder;
+        }
+    }
+
+    // the local model and its index live on between phases, so that only
+    // the slots whose position changed index cell are touched
+    if (m_Model) {
+        m_Model->Reload(
+            std::move(positions), std::move(normals), std::move(food),
+            std::move(links), m_Pool);
+    } else {
+        const Settings &s = m_Settings;
+        m_Model.reset(new Model<T>(
+            s.SplitThreshold, s.LinkRestLength, s.RadiusOfInfluence,
+            s.RepulsionFactor, s.SpringFactor, s.PlanarFactor, s.BulgeFactor,
+            std::move(positions), std::move(normals), std::move(food),
+            std::move(links), m_Pool));
+        m_Model->SetFastMath(s.FastMath);
+    }
+    return *m_Model;
+}
+
+template <typename T>
+std::vector<Buffer> Domain<T>::Extract(const Model<T> &model) {
+    const int rank = m_Transport.Rank();
+    const int size = m_Transport.Size();
+    const int numOwned = m_Owned.Ids.size();
+    const int numGhosts = m_Ghosts.Ids.size();
+    const int n = numOwned + numGhosts;
+    const int total = model.m_Positions.size();
+
+    // global ids, numbering the new children
+    std::vector<int64_t> ids(total);
+    for (int i = 0; i < numOwned; i++) {
+        ids[i] = m_Owned.Ids[i];
+    }
+    for (int i = 0; i < numGhosts; i++) {
+        ids[numOwned + i] = m_Ghosts.Ids[i];
+    }
+    for (int i = n; i < total; i++) {
+        ids[i] = m_SeedCells + m_NextChild++ * size + rank;
+    }
+    const auto global = [&](const std::vector<int> &ring) {
+        std::vector<int64_t> result(ring.size());
+        for (int k = 0; k < ring.size(); k++) {
+            const int j = ring[k];
+            result[k] = j >= 0 ? ids[j] : m_Unknown[-2 - j];
+        }
+        return result;
+    };
+
+    const auto &normals = model.Normals();
+    const auto &food = model.Food();
+    Cells owned;
+    const auto keep = [&](const int i) {
+        owned.Ids.push_back(ids[i]);
+        owned.Positions.push_back(model.m_Positions[i]);
+        owned.Normals.push_back(normals[i]);
+        owned.Food.push_back(food[i]);
+        owned.Links.push_back(global(model.m_Links[i]));
+    };
+    for (int i = 0; i < numOwned; i++) {
+        keep(i);
+    }
+    for (int i = n; i < total; i++) {
+        keep(i);
+    }
+    std::swap(m_Owned, owned);
+
+    std::vector<Buffer> edits(size);
+    for (int i = 0; i < numGhosts; i++) {
+        const auto ring = global(model.m_Links[numOwned + i]);
+        if (ring == m_Ghosts.Links[i]) {
+            continue;
+        }
+        BufferWriter writer(edits[m_GhostRanks[i]]);
+        writer.Write(m_Ghosts.Ids[i]);
+        writer.Write(uint32_t(ring.size()));
+        for (const int64_t j : ring) {
+            writer.Write(j);
+        }
+    }
+    return edits;
+}
+
+template <typename T>
+void Domain<T>::SplitPass(const bool interiorOnly, const bool active) {
+    ExchangeGhosts();
+
+    const int numOwned = m_Owned.Ids.size();
+    const T threshold = m_Settings.SplitThreshold;
+    const bool any = std::any_of(
+        m_Owned.Food.begin(), m_Owned.Food.end(),
+        [threshold](const T food) { return food > threshold; });
+
+    Model<T> *model = nullptr;
+    std::vector<int> candidates;
+    if (active && any) {
+        model = &BuildModel();
+        const int n = model->m_Positions.size();
+        const auto interior = [&](const int i) {
+            for (const int j : model->m_Links[i]) {
+                if (j < 0 || (j >= numOwned && j < n)) {
+                    return false;
+                }
+            }
+            return true;
+        };
+        for (int i = 0; i < numOwned; i++) {
+            if (model->FoodLevel(i) > threshold &&
+                (!interiorOnly || interior(i)))
+            {
+                candidates.push_back(i);
+            }
+        }
+    }
+    if (!interiorOnly) {
+        DeferConflicts(model, candidates);
+    }
+
+    std::vector<Buffer> edits(m_Transport.Size());
+    if (model) {
+        PROFILE_SCOPE("Split");
+        for (const int i : candidates) {
+            model->Split(i);
+        }
+        edits = Extract(*model);
+    }
+
+    // apply the ring edits other ranks made to this rank's cells;
+    // DeferConflicts leaves one writer per cell, so a second edit means
+    // the rings are corrupt
+    const auto received = m_Transport.Exchange(edits);
+    std::unordered_map<int64_t, int> index;
+    std::unordered_set<int64_t> edited;
+    for (const Buffer &buffer : received) {
+        if (buffer.empty()) {
+            continue;
+        }
+        if (index.empty()) {
+            for (int i = 0; i < m_Owned.Ids.size(); i++) {
+                index[m_Owned.Ids[i]] = i;
+            }
+        }
+        BufferReader reader(buffer);
+        while (!reader.Done()) {
+            const int64_t id = reader.Read<int64_t>();
+            const auto it = index.find(id);
+            if (it == index.end()) {
+                Panic("ring edit for a cell this rank doesn't own");
+            }
+            if (!edited.insert(id).second) {
+                Panic("conflicting ring edits, a link spans a whole slab");
+            }
+            auto &ring = m_Owned.Links[it->second];
+            ring.resize(reader.Read<uint32_t>());
+            for (int64_t &j : ring) {
+                j = reader.Read<int64_t>();
+            }
+        }
+    }
+}
+
+template <typename T>
+void Domain<T>::DeferConflicts(
+    const Model<T> *model, std::vector<int> &candidates)
+{
+    const int rank = m_Transport.Rank();
+    const int size = m_Transport.Size();
+    const int numOwned = m_Owned.Ids.size();
+
+    // claim the ghosts the splits would edit from their owners, and note
+    // the owned cells they would edit, as an owner
+    std::vector<Buffer> claims(size);
+    std::unordered_set<int64_t> touched;
+    if (model) {
+        std::vector<bool> claimed(m_Ghosts.Ids.size(), false);
+        for (const int i : candidates) {
+            touched.insert(m_Owned.Ids[i]);
+            for (const int j : model->m_Links[i]) {
+                if (j < numOwned) {
+                    touched.insert(m_Owned.Ids[j]);
+                    continue;
+                }
+                const int g = j - numOwned;
+                if (!claimed[g]) {
+                    claimed[g] = true;
+                    BufferWriter writer(claims[m_GhostRanks[g]]);
+                    writer.Write(m_Ghosts.Ids[g]);
+                }
+            }
+        }
+    }
+
+    // the owner's own splits win a cell, then the lowest claiming rank;
+    // the others hear which of their claims they lost
+    const auto received = m_Transport.Exchange(claims);
+    std::unordered_map<int64_t, int> winners;
+    for (int q = 0; q < size; q++) {
+        BufferReader reader(received[q]);
+        while (!reader.Done()) {
+            const int64_t id = reader.Read<int64_t>();
+            winners.emplace(id, touched.count(id) ? rank : q);
+        }
+    }
+    std::vector<Buffer> losses(size);
+    for (int q = 0; q < size; q++) {
+        BufferReader reader(received[q]);
+        while (!reader.Done()) {
+            const int64_t id = reader.Read<int64_t>();
+            if (winners[id] != q) {
+                BufferWriter writer(losses[q]);
+                writer.Write(id);
+            }
+        }
+    }
+
+    // lost cells stay over the threshold and split in a later pass
+    std::unordered_set<int64_t> lost;
+    for (const Buffer &buffer : m_Transport.Exchange(losses)) {
+        BufferReader reader(buffer);
+        while (!reader.Done()) {
+            lost.insert(reader.Read<int64_t>());
+        }
+    }
+    if (lost.empty()) {
+        return;
+    }
+    const auto conflicts = [&](const int i) {
+        for (const int j : model->m_Links[i]) {
+            if (j >= numOwned && lost.count(m_Ghosts.Ids[j - numOwned])) {
+                return true;
+            }
+        }
+        return false;
+    };
+    candidates.erase(
+        std::remove_if(candidates.begin(), candidates.end(), conflicts),
+        candidates.end());
+}
+
+template <typename T>
+void Domain<T>::Migrate() {
+    PROFILE_SCOPE("Migrate");
+    const int rank = m_Transport.Rank();
+    std::vector<Buffer> send(m_Transport.Size());
+    for (int i = int(m_Owned.Ids.size()) - 1; i >= 0; i--) {
+        const int q = SlabOf(m_Owned.Positions[i].x);
+        if (q != rank) {
+            m_Owned.Write(send[q], i);
+            m_Owned.Remove(i);
+        }
+    }
+    for (const Buffer &buffer : m_Transport.Exchange(send)) {
+        m_Owned.Read(buffer);
+    }
+}
+
+template <typename T>
+void Domain<T>::Step() {
+    PROFILE_SCOPE("DomainStep");
+
+    using Clock = std::chrono::steady_clock;
+    auto lapTime = Clock::now();
+    const auto lap = [&lapTime]() {
+        const auto now = Clock::now();
+        const std::chrono::duration<double> elapsed = now - lapTime;
+        lapTime = now;
+        return elapsed.count();
+    };
+
+    // forces on the owned cells, from the ghosts' current positions
+    ExchangeGhosts();
+    const int numOwned = m_Owned.Ids.size();
+    std::vector<double> sum(4, 0);
+    if (numOwned > 0) {
+        Model<T> &model = BuildModel();
+        m_LastStep.Exchange = lap();
+        model.ResizeBuffers();
+        m_Pool.Run(m_Pool.NumThreads(),
+            [&model, numOwned](const int wi, const int wn)
+            {
+                model.UpdateCells(
+                    uint64_t(numOwned) * wi / wn,
+                    uint64_t(numOwned) * (wi + 1) / wn, 1);
+            });
+        for (int i = 0; i < numOwned; i++) {
+            const vec3 d = model.m_NewPositions[i] - model.m_Positions[i];
+            sum[0] += d.x;
+            sum[1] += d.y;
+            sum[2] += d.z;
+            m_Owned.Positions[i] = model.m_NewPositions[i];
+            m_Owned.Normals[i] = model.m_NewNormals[i];
+        }
+        sum[3] = numOwned;
+    } else {
+        m_LastStep.Exchange = lap();
+    }
+
+    // recenter by the mean displacement of every cell
+    const auto total = m_Transport.Sum(sum);
+    const vec3 offset = -vec3(total[0], total[1], total[2]) /
+        static_cast<T>(std::max(1.0, total[3]));
+    for (auto &p : m_Owned.Positions) {
+        p += offset;
+    }
+    m_LastStep.Force = lap();
+
+    // feed, then split interior cells, then boundary cells by parity
+    for (T &food : m_Owned.Food) {
+        food += Random(0, 1);
+    }
+    const int rank = m_Transport.Rank();
+    SplitPass(true, true);
+    SplitPass(false, rank % 2 == 0);
+    SplitPass(false, rank % 2 == 1);
+    m_LastStep.Split = lap();
+
+    Migrate();
+    m_LastStep.Migrate = lap();
+}
+
+template <typename T>
+void Domain<T>::Rebalance() {
+    PROFILE_SCOPE("Rebalance");
+    const int size = m_Transport.Size();
+
+    // every rank shares up to 256 evenly spaced quantiles of its cells' x
+    // and how many cells each stands for
+    std::vector<T> xs;
+    xs.reserve(m_Owned.Ids.size());
+    for (const auto &p : m_Owned.Positions) {
+        xs.push_back(p.x);
+    }
+    std::sort(xs.begin(), xs.end());
+    const int n = xs.size();
+    const int k = std::min(256, n);
+    Buffer buffer;
+    BufferWriter writer(buffer);
+    writer.Write(uint64_t(n));
+    writer.Write(uint32_t(k));
+    for (int i = 0; i < k; i++) {
+        writer.Write(xs[(uint64_t(2 * i + 1) * n) / (2 * k)]);
+    }
+
+    std::vector<std::pair<T, double>> samples;
+    double total = 0;
+    for (const Buffer &other : m_Transport.AllGather(buffer)) {
+        BufferReader reader(other);
+        const uint64_t count = reader.Read<uint64_t>();
+        const uint32_t numSamples = reader.Read<uint32_t>();
+        for (uint32_t i = 0; i < numSamples; i++) {
+            samples.emplace_back(
+                reader.Read<T>(), double(count) / numSamples);
+        }
+        total += count;
+    }
+    if (total == 0) {
+        return;
+    }
+    std::sort(samples.begin(), samples.end());
+
+    // boundaries at the weighted quantiles, at least two halos apart
+    int j = 0;
+    double cumulative = 0;
+    for (int r = 1; r < size; r++) {
+        const double target = total * r / size;
+        while (j < samples.size() - 1 &&
+            cumulative + samples[j].second < target)
+        {
+            cumulative += samples[j].second;
+            j++;
+        }
+        T boundary = samples[j].first;
+        if (r > 1) {
+            boundary = std::max(
+                boundary, m_Boundaries[r - 2] + 2 * m_HaloWidth);
+        }
+        m_Boundaries[r - 1] = boundary;
+    }
+
+    Migrate();
+}
+
+template <typename T>
+std::unique_ptr<Model<T>> Domain<T>::Gather() {
+    std::vector<Buffer> send(m_Transport.Size());
+    for (int i = 0; i < m_Owned.Ids.size(); i++) {
+        m_Owned.Write(send[0], i);
+    }
+    const auto received = m_Transport.Exchange(send);
+    if (m_Transport.Rank() != 0) {
+        return nullptr;
+    }
+
+    Cells cells;
+    for (const Buffer &buffer : received) {
+        cells.Read(buffer);
+    }
+    const int n = cells.Ids.size();
+    std::unordered_map<int64_t, int> index;
+    index.reserve(n);
+    for (int i = 0; i < n; i++) {
+        index[cells.Ids[i]] = i;
+    }
+    std::vector<std::vector<int>> links(n);
+    for (int i = 0; i < n; i++) {
+        for (const int64_t id : cells.Links[i]) {
+            const auto it = index.find(id);
+            if (it == index.end()) {
+                Panic("gathered form links to a missing cell");
+            }
+            links[i].push_back(it->second);
+        }
+    }
+
+    const Settings &s = m_Settings;
+    return std::unique_ptr<Model<T>>(new Model<T>(
+        s.SplitThreshold, s.LinkRestLength, s.RadiusOfInfluence,
+        s.RepulsionFactor, s.SpringFactor, s.PlanarFactor, s.BulgeFactor,
+        MappedVector<vec3>(cells.Positions.begin(), cells.Positions.end()),
+        MappedVector<vec3>(cells.Normals.begin(), cells.Normals.end()),
+        MappedVector<T>(cells.Food.begin(), cells.Food.end()),
+        std::move(links), m_Pool));
+}
+
+template <typename T>
+void RunDomain(
+    const std::vector<Triangle> &triangles, const Settings &settings)
+{
+    // fork before any threads start; each rank then draws its own numbers
+    const auto transport = SocketTransport::Fork(settings.Ranks);
+    const int rank = transport->Rank();
+    const int size = transport->Size();
+    SeedRandom(RandomIntN(1 << 30) + rank);
+
+    const int cores = std::max(1u, std::thread::hardware_concurrency());
+    ThreadPool pool(std::max(1, cores / size));
+    Domain<T> domain(*transport, triangles, settings, pool);
+
+    std::unique_ptr<Exporter> exporter;
+    if (rank == 0) {
+        exporter.reset(new Exporter(
+            settings.ExportPattern, settings.ExportIterations, 0, 0));
+        exporter->SetDecimation(settings.Decimate);
+    }
+
+    const auto startTime = std::chrono::steady_clock::now();
+    for (uint64_t iterations = 1; ; iterations++) {
+        domain.Step();
+        if (iterations % 100 == 0) {
+            domain.Rebalance();
+        }
+
+        const bool exportDue = settings.ExportIterations > 0 &&
+            iterations % settings.ExportIterations == 0;
+        const bool checkpointDue = settings.CheckpointIterations > 0 &&
+            iterations % settings.CheckpointIterations == 0;
+        if (exportDue || checkpointDue) {
+            const auto model = domain.Gather();
+            if (model && exportDue) {
+                exporter->Update(*model, iterations);
+            }
+            if (model && checkpointDue) {
+                SaveCheckpoint(settings.CheckpointPath, *model, iterations);
+            }
+        }
+
+        if (iterations % 1000 == 0) {
+            std::vector<double> cells(size, 0);
+            cells[rank] = domain.OwnedCells();
+            cells = transport->Sum(cells);
+            const auto &stats = domain.LastStep();
+            const auto times = transport->Sum({
+                stats.Exchange, stats.Force, stats.Split, stats.Migrate});
+            if (rank == 0) {
+                const std::chrono::duration<double> elapsed =
+                    std::chrono::steady_clock::now() - startTime;
+                std::cout << iterations << " " << elapsed.count() << " cells";
+                for (const double c : cells) {
+                    std::cout << " " << c;
+                }
+                std::cout << " exchange " << times[0] / size
+                    << " force " << times[1] / size
+                    << " split " << times[2] / size
+                    << " migrate " << times[3] / size << std::endl;
+            }
+        }
+    }
+}
+
+template class Domain<float>;
+template class Domain<double>;
+
+template void RunDomain<float>(
+    const std::vector<Triangle> &triangles, const Settings &settings);
+template void RunDomain<double>(
+    const std::vector<Triangle> &triangles, const Settings &settings);
@@ -0,0 +1,146 @@
+#pragma once
+
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <memory>
+#include <vector>
+
+#include "model.h"
+#include "pool.h"
+#include "settings.h"
+#include "transport.h"
+#include "triangle.h"
+
+// DomainStats holds the wall time in seconds of the phases of the last
+// Domain::Step on one rank. Exchange is the ghost exchange and model build
+// before the force kernel; the ones before each split pass count as Split.
+struct DomainStats {
+    double Exchange = 0;
+    double Force = 0;
+    double Split = 0;
+    double Migrate = 0;
+    int Ghosts = 0;
+};
+
+// Domain runs one rank of a form split across processes. Space is cut into
+// slabs along x, one per rank. Each rank owns the cells in its slab and
+// their links, keyed by global id, and for each phase builds a local Model
+// of its cells followed by ghost copies of the other ranks' cells within
+// HaloWidth of its slab, plus any cells linked to its own that lie beyond
+// it. A step is:
+//
+//   1. exchange ghosts, run the force kernel on the owned cells and
+//      recenter by the mean displacement over all ranks
+//   2. feed the owned cells, exchange ghosts and split the eligible cells
+//      whose link rings are entirely owned
+//   3. twice, for even and then odd ranks: exchange ghosts and split the
+//      remaining eligible cells, sending the link rings they changed on
+//      ghosts back to the ghosts' owners. Slabs are at least two halo
+//      widths wide, so ranks splitting in the same pass rarely share a
+//      cell; when a stretched link makes them, the conflicting splits wait
+//      for a later pass
+//   4. hand cells that left their slab to the new owner
+//
+// Rebalance moves the slab boundaries to the quantiles of all cells' x, so
+// that each rank owns about the same number.
+//
+// The halo is twice the larger of RadiusOfInfluence and LinkRestLength.
+template <typename T>
+class Domain {
+public:
+    typedef glm::vec<3, T> vec3;
+
+    // rank 0 builds the seed model; Rebalance then spreads its cells
+    Domain(
+        Transport &transport, const std::vector<Triangle> &triangles,
+        const Settings &settings, ThreadPool &pool);
+
+    void Step();
+
+    void Rebalance();
+
+    // Gather collects every rank's cells into one model on rank 0, and
+    // returns null on the other ranks
+    std::unique_ptr<Model<T>> Gather();
+
+    int OwnedCells() const { return m_Owned.Ids.size(); }
+    int Ghosts() const { return m_Ghosts.Ids.size(); }
+    T HaloWidth() const { return m_HaloWidth; }
+    const std::vector<T> &Boundaries() const { return m_Boundaries; }
+    const DomainStats &LastStep() const { return m_LastStep; }
+
+private:
+    // Cells holds cells with their links as global ids
+    struct Cells {
+        std::vector<int64_t> Ids;
+        std::vector<vec3> Positions;
+        std::vector<vec3> Normals;
+        std::vector<T> Food;
+        std::vector<std::vector<int64_t>> Links;
+
+        void Clear();
+
+        // Write appends cell i to buffer; Read appends every cell in buffer
+        void Write(Buffer &buffer, const int i) const;
+        void Read(const Buffer &buffer);
+
+        // Remove moves the last cell into slot i
+        void Remove(const int i);
+    };
+
+    // SlabOf returns the rank whose slab holds x
+    int SlabOf(const T x) const;
+
+    void ExchangeGhosts();
+
+    // BuildModel loads the owned cells followed by the ghosts into the
+    // local model, which keeps its spatial index from phase to phase.
+    // Ghost links to cells outside the halo are stored as negative
+    // placeholders into m_Unknown, which only splits ever compare.
+    Model<T> &BuildModel();
+
+    // Extract copies the owned cells and any children split off them back
+    // from model, and returns the ghost link rings it changed, addressed to
+    // the ghosts' owners
+    std::vector<Buffer> Extract(const Model<T> &model);
+
+    // SplitPass splits the owned cells over the threshold, either only
+    // those with entirely owned rings or all of them, then applies the
+    // ring edits the other ranks sent back
+    void SplitPass(const bool interiorOnly, const bool active);
+
+    // DeferConflicts drops the split candidates that would edit a cell
+    // another rank's splits in the same pass edit too, which a link
+    // stretched past the halo allows. Every rank takes part, with a null
+    // model if it isn't splitting.
+    void DeferConflicts(const Model<T> *model, std::vector<int> &candidates);
+
+    void Migrate();
+
+    Transport &m_Transport;
+    ThreadPool &m_Pool;
+    Settings m_Settings;
+    T m_HaloWidth;
+
+    // rank r owns x in [m_Boundaries[r - 1], m_Boundaries[r])
+    std::vector<T> m_Boundaries;
+
+    // children get ids m_SeedCells + m_NextChild * size + rank
+    int64_t m_SeedCells;
+    int64_t m_NextChild;
+
+    Cells m_Owned;
+    Cells m_Ghosts;
+    std::vector<int> m_GhostRanks;
+    std::vector<int64_t> m_Unknown;
+    std::unique_ptr<Model<T>> m_Model;
+
+    DomainStats m_LastStep;
+};
+
+// RunDomain forks Settings::Ranks processes connected by a SocketTransport
+// and runs the form split across them forever, gathering it on rank 0 for
+// exports and checkpoints
+template <typename T>
+void RunDomain(
+    const std::vector<Triangle> &triangles, const Settings &settings);
@@ -0,0 +1,292 @@
+#include "exporter.h"
+
+#include <algorithm>
+#include <cstdio>
+
+#include "ply.h"
+#include "profile.h"
+#include "rings.h"
+#include "stl.h"
+
+namespace {
+
+// STL frames are triangulated and written this many cells, or decimated
+// triangles, at a time: about 9 MB of triangles per chunk
+const int ChunkCells = 1 << 17;
+const int ChunkTriangles = 1 << 18;
+
+}
+
+Exporter::Exporter(
+    const std::string &pattern,
+    const int everyIterations,
+    const double everySeconds,
+    const uint64_t everyBytes) :
+    m_Pattern(pattern),
+    m_PLY(pattern.size() >= 4 &&
+        pattern.compare(pattern.size() - 4, 4, ".ply") == 0),
+    m_EveryIterations(everyIterations),
+    m_EverySeconds(everySeconds),
+    m_EveryBytes(everyBytes),
+    m_LastTime(std::chrono::steady_clock::now()),
+    m_LastBytes(0),
+    m_Iteration(0),
+    m_Pool(std::max(1u, std::thread::hardware_concurrency() / 4)),
+    m_Frames(0),
+    m_BytesWritten(0),
+    m_StallSeconds(0),
+    m_WriteSeconds(0),
+    m_Pending(false),
+    m_Stop(false)
+{
+    if (pattern.size() >= 7 &&
+        pattern.compare(pattern.size() - 7, 7, ".series") == 0)
+    {
+        m_Series.reset(new SeriesWriter(pattern));
+    }
+    m_Thread = std::thread([this]() {
+        Run();
+    });
+}
+
+Exporter::~Exporter() {
+    {
+        std::unique_lock<std::mutex> lock(m_Mutex);
+        m_Condition.wait(lock, [this]() {
+            return !m_Pending;
+        });
+        m_Stop = true;
+    }
+    m_Condition.notify_all();
+    m_Thread.join();
+}
+
+template <typename T>
+bool Exporter::Update(
+    const Model<T> &model, const uint64_t iteration, const bool force)
+{
+    PROFILE_SCOPE("Exporter::Update");
+    const auto &positions = model.Positions();
+    const auto &links = model.Links();
+
+    // each cell contributes one vertex and about two triangles; a series
+    // frame grows about as a keyframe of a few bytes per coordinate and link
+    const uint64_t bytes =
+        m_Series ? uint64_t(positions.size()) * 16 :
+        m_PLY ? uint64_t(positions.size()) * (28 + 26) :
+        uint64_t(positions.size()) * 100 + 84;
+    const auto now = std::chrono::steady_clock::now();
+    const std::chrono::duration<double> sinceLast = now - m_LastTime;
+    const bool due = force ||
+        (m_EveryIterations > 0 && iteration % m_EveryIterations == 0) ||
+        (m_EverySeconds > 0 && sinceLast.count() >= m_EverySeconds) ||
+        (m_EveryBytes > 0 && bytes >= m_LastBytes + m_EveryBytes);
+    if (!due) {
+        return false;
+    }
+
+    // backpressure: the snapshot buffers are reused, so wait for the
+    // previous frame to be written before overwriting them
+    Wait();
+    const std::chrono::duration<double> stall =
+        std::chrono::steady_clock::now() - now;
+
+    m_Iteration = iteration;
+    m_Positions.resize(positions.size());
+    for (int i = 0; i < positions.size(); i++) {
+        m_Positions[i] = glm::vec3(positions[i]);
+    }
+    if (m_PLY) {
+        // in compact mode these decode the packed arrays, so only frames
+        // that are written pay for it, and the caches are dropped again
+        const auto &normals = model.Normals();
+        const auto &food = model.Food();
+        m_Normals.resize(normals.size());
+        m_Food.resize(food.size());
+        for (int i = 0; i < normals.size(); i++) {
+            m_Normals[i] = glm::vec3(normals[i]);
+            m_Food[i] = food[i];
+        }
+        model.ReleaseDecoded();
+    }
+    m_LinkOffsets.resize(0);
+    m_LinkIds.resize(0);
+    m_LinkOffsets.push_back(0);
+    for (const auto &ring : links) {
+        m_LinkIds.insert(m_LinkIds.end(), ring.begin(), ring.end());
+        m_LinkOffsets.push_back(m_LinkIds.size());
+    }
+
+    m_LastTime = now;
+    m_LastBytes = bytes;
+
+    {
+        std::lock_guard<std::mutex> guard(m_Mutex);
+        m_StallSeconds += stall.count();
+        m_Pending = true;
+    }
+    m_Condition.notify_all();
+    return true;
+}
+
+void Exporter::SetDecimation(const DecimateOptions &options) {
+    Wait();
+    m_Decimate = options;
+}
+
+void Exporter::Wait() {
+    std::unique_lock<std::mutex> lock(m_Mutex);
+    m_Condition.wait(lock, [this]() {
+        return !m_Pending;
+    });
+}
+
+void Exporter::Run() {
+    while (1) {
+        {
+            std::unique_lock<std::mutex> lock(m_Mutex);
+            m_Condition.wait(lock, [this]() {
+                return m_Stop || m_Pending;
+            });
+            if (m_Stop) {
+                return;
+            }
+        }
+
+        const auto startTime = std::chrono::steady_clock::now();
+        const uint64_t bytes = Write();
+        const std::chrono::duration<double> elapsed =
+            std::chrono::steady_clock::now() - startTime;
+
+        {
+            std::lock_guard<std::mutex> guard(m_Mutex);
+            m_Frames++;
+            m_BytesWritten += bytes;
+            m_WriteSeconds += elapsed.count();
+            m_Pending = false;
+        }
+        m_Condition.notify_all();
+    }
+}
+
+uint64_t Exporter::Write() {
+    PROFILE_SCOPE("Exporter::Write");
+    if (m_Series) {
+        return m_Series->Append(
+            m_Iteration, m_Positions, m_LinkOffsets, m_LinkIds);
+    }
+
+    char filename[1024];
+    snprintf(filename, sizeof(filename), m_Pattern.c_str(), int(m_Iteration));
+
+    const int n = m_Positions.size();
+    const auto ring = [this](const int i, int &size) {
+        size = m_LinkOffsets[i + 1] - m_LinkOffsets[i];
+        return m_LinkIds.data() + m_LinkOffsets[i];
+    };
+
+    // full frames go straight from the rings into the file
+    if (!m_Decimate.Enabled()) {
+        if (m_PLY) {
+            return SaveBinaryPLY(
+                filename, m_Positions, m_Normals, m_Food,
+                m_LinkOffsets, m_LinkIds, m_Pool);
+        }
+        STLWriter writer(filename);
+        for (int i0 = 0; i0 < n; i0 += ChunkCells) {
+            const int i1 = std::min(n, i0 + ChunkCells);
+            const auto offsets = RingTriangleOffsets(m_Pool, i0, i1, ring);
+            m_Triangles.resize(offsets.back());
+            ForEachRingTriangle(m_Pool, offsets, i0, i1, ring,
+                [this](
+                    const uint64_t t, const int a, const int b, const int c)
+                {
+                    m_Triangles[t] = Triangle(
+                        m_Positions[a], m_Positions[b], m_Positions[c]);
+                });
+            writer.Write(m_Triangles, m_Pool);
+        }
+        writer.Close();
+        return writer.Count() * 50 + 84;
+    }
+
+    // triangulate the snapshot in parallel into exactly sized indexes
+    const auto offsets = RingTriangleOffsets(m_Pool, 0, n, ring);
+    m_Indexes.resize(offsets.back());
+    ForEachRingTriangle(m_Pool, offsets, 0, n, ring,
+        [this](const uint64_t t, const int a, const int b, const int c) {
+            m_Indexes[t] = glm::uvec3(a, b, c);
+        });
+
+    const DecimateStats stats = Decimate(
+        m_Positions, m_Indexes, m_Decimate, m_Pool,
+        m_PLY ? &m_Sources : nullptr);
+    {
+        std::lock_guard<std::mutex> guard(m_Mutex);
+        m_Decimation.TrianglesBefore += stats.TrianglesBefore;
+        m_Decimation.TrianglesAfter += stats.TrianglesAfter;
+        m_Decimation.Passes += stats.Passes;
+        m_Decimation.Seconds += stats.Seconds;
+    }
+
+    if (m_PLY) {
+        // sources only ever point back, so this can run in place
+        for (int i = 0; i < m_Sources.size(); i++) {
+            m_Normals[i] = m_Normals[m_Sources[i]];
+            m_Food[i] = m_Food[m_Sources[i]];
+        }
+        m_Normals.resize(m_Sources.size());
+        m_Food.resize(m_Sources.size());
+        return SaveBinaryPLY(
+            filename, m_Positions, m_Normals, m_Food, m_Indexes, m_Pool);
+    }
+
+    STLWriter writer(filename);
+    for (uint64_t t0 = 0; t0 < m_Indexes.size(); t0 += ChunkTriangles) {
+        const uint64_t t1 =
+            std::min<uint64_t>(m_Indexes.size(), t0 + ChunkTriangles);
+        m_Triangles.resize(t1 - t0);
+        m_Pool.Run(m_Pool.NumThreads(), [&](const int wi, const int wn) {
+            const uint64_t i0 = t0 + (t1 - t0) * wi / wn;
+            const uint64_t i1 = t0 + (t1 - t0) * (wi + 1) / wn;
+            for (uint64_t i = i0; i < i1; i++) {
+                const glm::uvec3 &f = m_Indexes[i];
+                m_Triangles[i - t0] = Triangle(
+                    m_Positions[f.x], m_Positions[f.y], m_Positions[f.z]);
+            }
+        });
+        writer.Write(m_Triangles, m_Pool);
+    }
+    writer.Close();
+    return writer.Count() * 50 + 84;
+}
+
+int Exporter::Frames() const {
+    std::lock_guard<std::mutex> guard(m_Mutex);
+    return m_Frames;
+}
+
+uint64_t Exporter::BytesWritten() const {
+    std::lock_guard<std::mutex> guard(m_Mutex);
+    return m_BytesWritten;
+}
+
+double Exporter::StallSeconds() const {
+    std::lock_guard<std::mutex> guard(m_Mutex);
+    return m_StallSeconds;
+}
+
+double Exporter::WriteSeconds() const {
+    std::lock_guard<std::mutex> guard(m_Mutex);
+    return m_WriteSeconds;
+}
+
+DecimateStats Exporter::Decimation() const {
+    std::lock_guard<std::mutex> guard(m_Mutex);
+    return m_Decimation;
+}
+
+template bool Exporter::Update(
+    const Model<float> &model, const uint64_t iteration, const bool force);
+template bool Exporter::Update(
+    const Model<double> &model, const uint64_t iteration, const bool force);
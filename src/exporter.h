@@ -0,0 +1,118 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "decimate.h"
+#include "model.h"
+#include "pool.h"
+#include "series.h"
+#include "triangle.h"
+
+// Exporter writes STL frames, or indexed PLY frames with normals and food
+// when the pattern ends in .ply, or appends every frame to one series (see
+// series.h) when it ends in .series, on a background thread so the
+// simulation does not stop for triangulation and I/O. When an export is
+// due, Update copies positions and the flattened link rings into a reusable
+// snapshot buffer and hands it to the writer thread. If the previous frame
+// is still being written, Update blocks until it is done (backpressure).
+//
+// An export is due when any enabled cadence is met: every N iterations,
+// every N seconds, or whenever the frame has grown by N bytes since the last
+// one. Zero disables a cadence.
+//
+// STL and PLY frames can be decimated for previews (see decimate.h); the
+// writer thread decimates with its own pool.
+class Exporter {
+public:
+    Exporter(
+        const std::string &pattern,
+        const int everyIterations,
+        const double everySeconds,
+        const uint64_t everyBytes);
+
+    ~Exporter();
+
+    // Update exports the model if a frame is due, or force is set, and
+    // returns true if it did
+    template <typename T>
+    bool Update(
+        const Model<T> &model, const uint64_t iteration,
+        const bool force = false);
+
+    // SetDecimation decimates the STL and PLY frames written from here on
+    void SetDecimation(const DecimateOptions &options);
+
+    // Wait blocks until the frame in flight, if any, has been written
+    void Wait();
+
+    // stats
+    int Frames() const;
+    uint64_t BytesWritten() const;
+    double StallSeconds() const;
+    double WriteSeconds() const;
+
+    // Decimation sums the decimation stats of the frames written so far
+    DecimateStats Decimation() const;
+
+private:
+    void Run();
+
+    // Write triangulates and saves the snapshot, returning the bytes written.
+    // STL frames are streamed through an STLWriter in chunks, so the full
+    // triangle soup is never in memory.
+    uint64_t Write();
+
+    // output filename pattern, e.g. out%08d.stl or out%08d.ply, or the path
+    // of a series
+    std::string m_Pattern;
+    bool m_PLY;
+    std::unique_ptr<SeriesWriter> m_Series;
+
+    // cadence
+    int m_EveryIterations;
+    double m_EverySeconds;
+    uint64_t m_EveryBytes;
+    std::chrono::steady_clock::time_point m_LastTime;
+    uint64_t m_LastBytes;
+
+    // snapshot handed to the writer thread
+    uint64_t m_Iteration;
+    std::vector<glm::vec3> m_Positions;
+    std::vector<glm::vec3> m_Normals;
+    std::vector<float> m_Food;
+    std::vector<int> m_LinkOffsets;
+    std::vector<int> m_LinkIds;
+    std::vector<glm::uvec3> m_Indexes;
+
+    // one chunk of an STL frame, see Write
+    std::vector<Triangle> m_Triangles;
+
+    // preview decimation, and the snapshot vertex each decimated vertex
+    // came from
+    DecimateOptions m_Decimate;
+    std::vector<int> m_Sources;
+
+    // threads for decimating and filling files in parallel, kept separate
+    // from the simulation's pool
+    ThreadPool m_Pool;
+
+    // stats, written by the writer thread under m_Mutex
+    int m_Frames;
+    uint64_t m_BytesWritten;
+    double m_StallSeconds;
+    double m_WriteSeconds;
+    DecimateStats m_Decimation;
+
+    std::thread m_Thread;
+    mutable std::mutex m_Mutex;
+    std::condition_variable m_Condition;
+    bool m_Pending;
+    bool m_Stop;
+};
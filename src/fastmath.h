@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <glm/glm.hpp>
+
+#if defined(__x86_64__) || defined(__i386__)
+    #include <xmmintrin.h>
+#endif
+
+#include "cpu.h"
+
+// FastInverseSqrt approximates 1 / sqrt(x) for x > 0 using the hardware
+// estimate (12 bits) refined by one Newton-Raphson step (~22 bits)
+ALWAYS_INLINE float FastInverseSqrt(const float x) {
+#if defined(__x86_64__) || defined(__i386__)
+    const float y = _mm_cvtss_f32(_mm_rsqrt_ss(_mm_set_ss(x)));
+#else
+    uint32_t i;
+    memcpy(&i, &x, 4);
+    i = 0x5f375a86 - (i >> 1);
+    float y;
+    memcpy(&y, &i, 4);
+#endif
+    return y * (1.5f - 0.5f * x * y * y);
+}
+
+ALWAYS_INLINE double FastInverseSqrt(const double x) {
+    // start from the float estimate; a second step brings it to ~44 bits
+    double y = FastInverseSqrt(static_cast<float>(x));
+    y = y * (1.5 - 0.5 * x * y * y);
+    return y;
+}
+
+// FastReciprocal approximates 1 / x using the hardware estimate refined by
+// one Newton-Raphson step
+ALWAYS_INLINE float FastReciprocal(const float x) {
+#if defined(__x86_64__) || defined(__i386__)
+    const float y = _mm_cvtss_f32(_mm_rcp_ss(_mm_set_ss(x)));
+    return y * (2.f - x * y);
+#else
+    return 1.f / x;
+#endif
+}
+
+ALWAYS_INLINE double FastReciprocal(const double x) {
+    double y = FastReciprocal(static_cast<float>(x));
+    y = y * (2.0 - x * y);
+    return y;
+}
+
+// Normalize, Sqrt and Reciprocal use the approximations above when Fast is
+// set and the exact operations otherwise
+template <bool Fast, typename T>
+ALWAYS_INLINE glm::vec<3, T> Normalize(const glm::vec<3, T> &v) {
+    if (Fast) {
+        return v * FastInverseSqrt(glm::dot(v, v));
+    }
+    return glm::normalize(v);
+}
+
+// x must be positive
+template <bool Fast, typename T>
+ALWAYS_INLINE T Sqrt(const T x) {
+    if (Fast) {
+        return x * FastInverseSqrt(x);
+    }
+    return std::sqrt(x);
+}
+
+template <bool Fast, typename T>
+ALWAYS_INLINE T Reciprocal(const T x) {
+    if (Fast) {
+        return FastReciprocal(x);
+    }
+    return T(1) / x;
+}
@@ -63,11 +63,13 @@ void main() {
 }
 )";
 
-void RunGUI(Model &model) {
+template <typename T>
+void RunGUI(Model<T> &model) {
     auto startTime = std::chrono::steady_clock::now();
     std::chrono::duration<double> elapsed;
 
     ThreadPool pool;
+    model.Calibrate(pool);
 
     for (int i = 0; i < 100; i++) {
         model.Update(pool, false);
@@ -106,17 +108,19 @@ void RunGUI(Model &model) {
     glGenBuffers(1, &arrayBuffer);
     glGenBuffers(1, &elementBuffer);
 
-    glm::vec3 targetMin, targetMax;
-    model.Bounds(targetMin, targetMax);
+    typename Model<T>::vec3 modelMin, modelMax;
+    model.Bounds(modelMin, modelMax);
+    glm::vec3 targetMin(modelMin);
+    glm::vec3 targetMax(modelMax);
     glm::vec3 currentMin = targetMin;
     glm::vec3 currentMax = targetMax;
     const glm::vec3 minSize(glm::distance(targetMin, targetMax) * 5);
 
     const auto getModelTransform = [&]() {
-        glm::vec3 min, max;
+        typename Model<T>::vec3 min, max;
         model.Bounds(min, max);
-        targetMin = glm::min(targetMin, min);
-        targetMax = glm::max(targetMax, max);
+        targetMin = glm::min(targetMin, glm::vec3(min));
+        targetMax = glm::max(targetMax, glm::vec3(max));
         currentMin += (targetMin - currentMin) * 0.01f;
         currentMax += (targetMax - currentMax) * 0.01f;
         currentMin = glm::min(currentMin, -minSize);
@@ -138,7 +142,7 @@ void RunGUI(Model &model) {
         model.VertexAttributes(vertexAttributes);
 
         indexes.resize(0);
-        model.TriangleIndexes(indexes);
+        model.TriangleIndexes(indexes, pool);
 
         glBindBuffer(GL_ARRAY_BUFFER, arrayBuffer);
         glBufferData(
@@ -206,3 +210,6 @@ void RunGUI(Model &model) {
 
     glfwTerminate();
 }
+
+template void RunGUI(Model<float> &model);
+template void RunGUI(Model<double> &model);
@@ -2,4 +2,5 @@
 
 #include "model.h"
 
-void RunGUI(Model &model);
+template <typename T>
+void RunGUI(Model<T> &model);
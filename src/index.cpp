@@ -43,22 +43,6 @@ void Index::Ensure(const glm::vec3 &min, const glm::vec3 &max) {
     m_Cells = newCells;
 }
 
-glm::ivec3 Index::KeyForPoint(const glm::vec3 &point) const {
-    const int x = std::roundf(point.x / m_CellSize);
-    const int y = std::roundf(point.y / m_CellSize);
-    const int z = std::roundf(point.z / m_CellSize);
-    return glm::ivec3(x, y, z);
-}
-
-int Index::IndexForKey(const glm::ivec3 &key) const {
-    const auto d = key - m_Start;
-    return d.x + (d.y * m_Size.x) + (d.z * m_Size.x * m_Size.y);
-}
-
-const std::vector<int> &Index::Nearby(const glm::vec3 &point) const {
-    return m_Cells[IndexForKey(KeyForPoint(point))];
-}
-
 void Index::Add(const glm::vec3 &point, const int id) {
     const glm::ivec3 key = KeyForPoint(point);
     const auto k0 = key - 1;
@@ -67,6 +51,7 @@ void Index::Add(const glm::vec3 &point, const int id) {
         for (int y = k0.y; y <= k1.y; y++) {
             for (int z = k0.z; z <= k1.z; z++) {
                 auto &ids = m_Cells[IndexForKey(glm::ivec3(x, y, z))];
+                std::lock_guard<std::mutex> guard(StripeLock(x, y, z));
                 #if DEBUG_INDEX
                     const auto it = std::find(ids.begin(), ids.end(), id);
                     if (it != ids.end()) {
@@ -100,7 +85,67 @@ void Index::Remove(const glm::vec3 &point, const int id) {
     }
 }
 
+IndexStats Index::Stats() const {
+    IndexStats stats;
+    stats.Cells = m_Cells.size();
+    for (const auto &ids : m_Cells) {
+        const uint64_t n = ids.size();
+        int bin = 0;
+        while ((uint64_t(1) << bin) <= n) {
+            bin++;
+        }
+        if (bin >= stats.Histogram.size()) {
+            stats.Histogram.resize(bin + 1, 0);
+        }
+        stats.Histogram[bin]++;
+        stats.EmptyCells += n == 0;
+        stats.Ids += n;
+        stats.MaxIds = std::max(stats.MaxIds, n);
+    }
+    return stats;
+}
+
+void Index::MemoryReport(MemoryUsages &report) const {
+    report.push_back(NestedVectorMemory("index_cells", m_Cells));
+    MemoryUsage locks;
+    locks.Name = "index_locks";
+    locks.Elements = m_Locks.size();
+    locks.UsedBytes = locks.CapacityBytes = m_Locks.size() * sizeof(std::mutex);
+    locks.HeapBytes = HeapBlockBytes(locks.CapacityBytes);
+    locks.Allocations = 1;
+    report.push_back(locks);
+}
+
 bool Index::Update(const glm::vec3 &p0, const glm::vec3 &p1, const int id) {
+    switch (ActiveISA()) {
+    case ISA::AVX512: return UpdateAVX512(p0, p1, id);
+    case ISA::AVX2: return UpdateAVX2(p0, p1, id);
+    case ISA::SSE42: return UpdateSSE42(p0, p1, id);
+    default: return UpdateKernel(p0, p1, id);
+    }
+}
+
+bool Index::UpdateSSE42(
+    const glm::vec3 &p0, const glm::vec3 &p1, const int id)
+{
+    return UpdateKernel(p0, p1, id);
+}
+
+bool Index::UpdateAVX2(
+    const glm::vec3 &p0, const glm::vec3 &p1, const int id)
+{
+    return UpdateKernel(p0, p1, id);
+}
+
+bool Index::UpdateAVX512(
+    const glm::vec3 &p0, const glm::vec3 &p1, const int id)
+{
+    return UpdateKernel(p0, p1, id);
+}
+
+ALWAYS_INLINE bool Index::UpdateKernel(
+    const glm::vec3 &p0, const glm::vec3 &p1, const int id)
+{
     const auto key0 = KeyForPoint(p0);
     const auto key1 = KeyForPoint(p1);
 
@@ -135,8 +180,7 @@ bool Index::Update(const glm::vec3 &p0, const glm::vec3 &p1, const int id) {
                     continue;
                 }
                 auto &ids = m_Cells[IndexForKey(glm::ivec3(x, y, z))];
-                std::lock_guard<std::mutex> guard(
-                    m_Locks[(x + y + z) % m_Locks.size()]);
+                std::lock_guard<std::mutex> guard(StripeLock(x, y, z));
                 const auto it = std::find(ids.begin(), ids.end(), id);
                 #if DEBUG_INDEX
                     if (it == ids.end()) {
@@ -157,8 +201,7 @@ bool Index::Update(const glm::vec3 &p0, const glm::vec3 &p1, const int id) {
                     continue;
                 }
                 auto &ids = m_Cells[IndexForKey(glm::ivec3(x, y, z))];
-                std::lock_guard<std::mutex> guard(
-                    m_Locks[(x + y + z) % m_Locks.size()]);
+                std::lock_guard<std::mutex> guard(StripeLock(x, y, z));
                 #if DEBUG_INDEX
                     const auto it = std::find(ids.begin(), ids.end(), id);
                     if (it != ids.end()) {
@@ -2,29 +2,77 @@
 
 #define GLM_ENABLE_EXPERIMENTAL
 
+#include <cmath>
 #include <glm/glm.hpp>
 #include <mutex>
 #include <vector>
 
+#include "cpu.h"
+#include "memory.h"
+
+// IndexStats summarizes how full the index cells are. Histogram[0] counts
+// empty cells and Histogram[i] cells holding 2^(i-1) to 2^i - 1 ids.
+struct IndexStats {
+    uint64_t Cells = 0;
+    uint64_t EmptyCells = 0;
+    uint64_t Ids = 0;
+    uint64_t MaxIds = 0;
+    std::vector<uint64_t> Histogram;
+};
+
 class Index {
 public:
     Index(const float cellSize);
 
     void Ensure(const glm::vec3 &min, const glm::vec3 &max);
 
-    glm::ivec3 KeyForPoint(const glm::vec3 &point) const;
+    // key lookups are inline so they get compiled into each kernel variant
+    glm::ivec3 KeyForPoint(const glm::vec3 &point) const {
+        const int x = std::roundf(point.x / m_CellSize);
+        const int y = std::roundf(point.y / m_CellSize);
+        const int z = std::roundf(point.z / m_CellSize);
+        return glm::ivec3(x, y, z);
+    }
 
-    int IndexForKey(const glm::ivec3 &key) const;
+    int IndexForKey(const glm::ivec3 &key) const {
+        const auto d = key - m_Start;
+        return d.x + (d.y * m_Size.x) + (d.z * m_Size.x * m_Size.y);
+    }
 
-    const std::vector<int> &Nearby(const glm::vec3 &point) const;
+    const std::vector<int> &Nearby(const glm::vec3 &point) const {
+        return m_Cells[IndexForKey(KeyForPoint(point))];
+    }
 
+    // Add locks the same stripes as Update, so it is safe to call from
+    // several threads at once
     void Add(const glm::vec3 &point, const int id);
 
     void Remove(const glm::vec3 &point, const int id);
 
+    // Stats walks every index cell
+    IndexStats Stats() const;
+
+    // MemoryReport appends the index's structures to report. Every id is
+    // stored in the 27 cells around its point.
+    void MemoryReport(MemoryUsages &report) const;
+
+    // Update dispatches to a kernel built for ActiveISA()
     bool Update(const glm::vec3 &p0, const glm::vec3 &p1, const int id);
 
 private:
+    // StripeLock returns the mutex guarding the index cell at x, y, z
+    std::mutex &StripeLock(const int x, const int y, const int z) {
+        return m_Locks[unsigned(x + y + z) % m_Locks.size()];
+    }
+
+    bool UpdateKernel(const glm::vec3 &p0, const glm::vec3 &p1, const int id);
+    TARGET_SSE42 bool UpdateSSE42(
+        const glm::vec3 &p0, const glm::vec3 &p1, const int id);
+    TARGET_AVX2 bool UpdateAVX2(
+        const glm::vec3 &p0, const glm::vec3 &p1, const int id);
+    TARGET_AVX512 bool UpdateAVX512(
+        const glm::vec3 &p0, const glm::vec3 &p1, const int id);
+
     float m_CellSize;
     glm::ivec3 m_Start;
     glm::ivec3 m_Size;
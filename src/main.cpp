@@ -1,72 +1,583 @@
+#include <cstdio>
 #include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
 
+#include "bench.h"
+#include "checkpoint.h"
+#include "compact.h"
+#include "cpu.h"
+#include "domain.h"
+#include "exporter.h"
 #include "gui.h"
+#include "mapped.h"
+#include "metrics.h"
 #include "model.h"
 #include "pool.h"
+#include "profile.h"
+#include "replay.h"
+#include "series.h"
+#include "settings.h"
 #include "sphere.h"
 #include "stl.h"
+#include "sweep.h"
 #include "util.h"
 
-void RunForever(Model &model) {
+// ParseInts parses a comma separated list of integers
+std::vector<int> ParseInts(const std::string &list) {
+    std::vector<int> result;
+    std::istringstream stream(list);
+    std::string value;
+    while (std::getline(stream, value, ',')) {
+        result.push_back(std::stoi(value));
+    }
+    return result;
+}
+
+template <typename T>
+void RunForever(
+    Model<T> &model, const Settings &settings, uint64_t iterations = 0,
+    ReplayWriter *recorder = nullptr)
+{
     const auto startTime = std::chrono::steady_clock::now();
     ThreadPool pool;
-    int iterations = 0;
+    model.Calibrate(pool);
+    Exporter exporter(
+        settings.ExportPattern, settings.ExportIterations,
+        settings.ExportSeconds, settings.ExportBytes);
+    exporter.SetDecimation(settings.Decimate);
+    Metrics metrics(settings.MetricsPath, settings.MetricsIterations);
     while (1) {
         model.Update(pool);
         iterations++;
+        exporter.Update(model, iterations);
+        metrics.Update(model, iterations);
+        if (recorder) {
+            recorder->Update(model, iterations);
+        }
+        PROFILE_SAMPLE();
+        if (settings.CheckpointIterations > 0 &&
+            iterations % settings.CheckpointIterations == 0)
+        {
+            SaveCheckpoint(settings.CheckpointPath, model, iterations);
+        }
         if (iterations % 1000 == 0) {
-            char filename[1024];
-            sprintf(filename, "out%08d.stl", iterations);
-            SaveBinarySTL(filename, model.Triangulate());
+            if (recorder) {
+                recorder->Flush();
+            }
+            PROFILE_SAVE("profile.json");
             const std::chrono::duration<double> elapsed =
                 std::chrono::steady_clock::now() - startTime;
             std::cout
                 << iterations << " "
                 << elapsed.count() << " "
-                << model.Positions().size()
+                << model.NumCells() << " "
+                << model.SplitQueueDepth() << " "
+                << model.SplitLatency() << " "
+                << exporter.StallSeconds()
                 << std::endl;
+            if (settings.Decimate.Enabled()) {
+                const DecimateStats stats = exporter.Decimation();
+                std::cout
+                    << "decimated " << stats.TrianglesBefore << " to "
+                    << stats.TrianglesAfter << " triangles ("
+                    << stats.Ratio() << ") in " << stats.Seconds << "s"
+                    << std::endl;
+            }
         }
     }
 }
 
-int main() {
-    const auto triangles = SphereTriangles(1);
-    // const auto triangles = LoadBinarySTL(argv[1]);
+// ValidateFastMath runs the same seeded simulation with exact and with
+// approximate math and reports the speedup and how far positions diverge,
+// relative to the size of the form. A second exact run gives the noise
+// floor from threads reordering the repulsion sums. A compact storage run
+// is compared too. Food rounding, reordered sums, -death and an upward
+// food source can all move splits, so whenever two runs end with different
+// cell counts only the overall shape is compared.
+template <typename T>
+void ValidateFastMath(
+    const std::vector<Triangle> &triangles, const Settings &settings,
+    const int iterations)
+{
+    ThreadPool pool;
 
-    const float averageEdgeLength = [&triangles]() {
-        float sum = 0;
-        for (const auto &t : triangles) {
-            sum += glm::distance(t.A(), t.B());
-            sum += glm::distance(t.B(), t.C());
-            sum += glm::distance(t.C(), t.A());
+    const auto run = [&](
+        const bool fastMath, const bool compact, double &seconds)
+    {
+        Settings s = settings;
+        s.FastMath = fastMath;
+        s.Compact = compact;
+        SeedRandom(1);
+        Model<T> model = MakeModel<T>(triangles, s, pool);
+        model.Calibrate(pool);
+        const auto startTime = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; i++) {
+            model.Update(pool);
         }
-        return sum / (triangles.size() * 3);
+        const std::chrono::duration<double> elapsed =
+            std::chrono::steady_clock::now() - startTime;
+        seconds = elapsed.count();
+        return std::vector<glm::vec<3, T>>(
+            model.Positions().begin(), model.Positions().end());
+    };
+
+    // shape compares the bounds and the mean distance from the centroid,
+    // relative to the size of the form
+    const auto shape = [](
+        const std::vector<glm::vec<3, T>> &a,
+        const std::vector<glm::vec<3, T>> &b)
+    {
+        const auto measure = [](
+            const std::vector<glm::vec<3, T>> &p,
+            glm::vec<3, T> &min, glm::vec<3, T> &max, double &radius)
+        {
+            min = max = p[0];
+            glm::dvec3 sum(0);
+            for (const auto &v : p) {
+                min = glm::min(min, v);
+                max = glm::max(max, v);
+                sum += glm::dvec3(v);
+            }
+            const glm::dvec3 centroid = sum / double(p.size());
+            radius = 0;
+            for (const auto &v : p) {
+                radius += glm::distance(glm::dvec3(v), centroid);
+            }
+            radius /= p.size();
+        };
+        glm::vec<3, T> minA, maxA, minB, maxB;
+        double radiusA, radiusB;
+        measure(a, minA, maxA, radiusA);
+        measure(b, minB, maxB, radiusB);
+        const double size = glm::distance(minA, maxA);
+        std::cout
+            << "cells " << a.size() << " vs " << b.size() << " "
+            << "bounds " << std::max(
+                glm::distance(minA, minB), glm::distance(maxA, maxB)) / size
+            << " radius " << std::abs(radiusA - radiusB) / size << std::endl;
+    };
+
+    // compare measures per cell error. Runs that split or kill cells
+    // differently can't be matched cell by cell, so they fall back to shape
+    const auto compare = [&shape](
+        const std::vector<glm::vec<3, T>> &a,
+        const std::vector<glm::vec<3, T>> &b)
+    {
+        if (a.size() != b.size()) {
+            shape(a, b);
+            return;
+        }
+        glm::vec<3, T> min = a[0];
+        glm::vec<3, T> max = a[0];
+        double sum = 0;
+        double worst = 0;
+        for (int i = 0; i < a.size(); i++) {
+            min = glm::min(min, a[i]);
+            max = glm::max(max, a[i]);
+            const double d = glm::distance(a[i], b[i]);
+            sum += d * d;
+            worst = std::max(worst, d);
+        }
+        const double size = glm::distance(min, max);
+        std::cout
+            << "rms " << std::sqrt(sum / a.size()) / size << " "
+            << "max " << worst / size << std::endl;
+    };
+
+    double exactSeconds, fastSeconds, compactSeconds, repeatSeconds;
+    const auto exact = run(false, false, exactSeconds);
+    const auto fast = run(true, false, fastSeconds);
+    const auto compact = run(false, true, compactSeconds);
+    const auto repeat = run(false, false, repeatSeconds);
+
+    // worst normal round trip error over a dense set of directions
+    double normalError = 0;
+    for (int i = 0; i < 100000; i++) {
+        const glm::vec<3, T> n = glm::normalize(glm::vec<3, T>(
+            Random(-1, 1), Random(-1, 1), Random(-1, 1)));
+        const glm::dvec3 d(DecodeNormal<T>(EncodeNormal(n)));
+        normalError = std::max(normalError, std::atan2(
+            glm::length(glm::cross(glm::dvec3(n), d)),
+            glm::dot(glm::dvec3(n), d)));
+    }
+
+    std::cout << "cells             = " << exact.size() << std::endl;
+    std::cout << "exact seconds     = " << exactSeconds << std::endl;
+    std::cout << "fast seconds      = " << fastSeconds << std::endl;
+    std::cout << "speedup           = " << exactSeconds / fastSeconds
+        << std::endl;
+    std::cout << "compact seconds   = " << compactSeconds << std::endl;
+    std::cout << "compact speedup   = " << exactSeconds / compactSeconds
+        << std::endl;
+    std::cout << "normal error deg  = " << glm::degrees(normalError)
+        << std::endl;
+    std::cout << "food step         = " << settings.SplitThreshold / 32768
+        << std::endl;
+    std::cout << "fast vs exact     = ";
+    compare(exact, fast);
+    std::cout << "compact vs exact  = ";
+    compare(exact, compact);
+    std::cout << "exact vs exact    = ";
+    compare(exact, repeat);
+}
+
+template <typename T>
+void Resume(const std::string &path, const Settings &settings) {
+    uint64_t iterations;
+    Model<T> model = [&]() {
+        ThreadPool pool;
+        return LoadCheckpoint<T>(path, iterations, pool);
     }();
+    model.SetSplitLimits(
+        settings.MaxSplitsPerUpdate, settings.SplitTimeBudget);
+    model.SetFastMath(settings.FastMath);
+    model.SetCompact(settings.Compact);
+    model.SetDiffusion(
+        settings.DiffusionSteps, settings.DiffusionRate,
+        settings.DiffusionDecay, settings.Source);
+    model.SetDeath(settings.DeathNeighbors, settings.DeathEvery);
+    if (!settings.OutOfCoreDirectory.empty()) {
+        model.SetBrickSize(model.RadiusOfInfluence() * settings.BrickSize);
+    }
+    std::cout << "resuming at iteration " << iterations << " with "
+        << model.NumCells() << " cells" << std::endl;
+    RunForever(model, settings, iterations);
+}
 
-    float SplitThreshold = 1000;
-    float LinkRestLength = averageEdgeLength;
-    float RadiusOfInfluence = Random(LinkRestLength, LinkRestLength * 5);
-    float RepulsionFactor = Random(0, 0.1);
-    float SpringFactor = Random(0, 0.1);
-    float PlanarFactor = Random(0, 0.1);
-    float BulgeFactor = Random(0, 0.1);
-
-    std::cout << "SplitThreshold    = " << SplitThreshold << std::endl;
-    std::cout << "LinkRestLength    = " << LinkRestLength << std::endl;
-    std::cout << "RadiusOfInfluence = " << RadiusOfInfluence << std::endl;
-    std::cout << "RepulsionFactor   = " << RepulsionFactor << std::endl;
-    std::cout << "SpringFactor      = " << SpringFactor << std::endl;
-    std::cout << "PlanarFactor      = " << PlanarFactor << std::endl;
-    std::cout << "BulgeFactor       = " << BulgeFactor << std::endl;
-    std::cout << std::endl;
+template <typename T>
+void Run(
+    const std::vector<Triangle> &triangles, const Settings &settings,
+    const int validateIterations, const bool headless)
+{
+    if (validateIterations > 0) {
+        ValidateFastMath<T>(triangles, settings, validateIterations);
+        return;
+    }
+
+    if (!settings.RecordPath.empty() && (!headless || settings.Ranks > 1)) {
+        Panic("-record needs -headless and a single process");
+    }
 
-    Model model(
-        triangles,
-        SplitThreshold, LinkRestLength, RadiusOfInfluence,
-        RepulsionFactor, SpringFactor, PlanarFactor, BulgeFactor);
+    if (settings.Ranks > 1) {
+        // domain runs don't carry these yet; refuse them rather than run a
+        // different simulation
+        const auto unsupported = [](const bool set, const std::string &flag) {
+            if (set) {
+                Panic(flag + " can't be combined with -ranks");
+            }
+        };
+        unsupported(settings.Compact, "-compact");
+        unsupported(settings.DiffusionSteps > 0, "-diffuse");
+        unsupported(settings.DeathNeighbors > 0, "-death");
+        unsupported(!settings.OutOfCoreDirectory.empty(), "-out-of-core");
+        unsupported(!settings.MetricsPath.empty(), "-metrics");
+        unsupported(settings.ExportSeconds > 0, "-export-seconds");
+        unsupported(settings.ExportBytes > 0, "-export-bytes");
+        RunDomain<T>(triangles, settings);
+        return;
+    }
 
-    RunGUI(model);
-    // RunForever(model);
+    Model<T> model = [&]() {
+        ThreadPool pool;
+        return MakeModel<T>(triangles, settings, pool);
+    }();
+
+    if (!settings.RecordPath.empty()) {
+        ReplayWriter recorder(
+            settings.RecordPath, triangles, settings, sizeof(T));
+        model.SetRecordEvents(true);
+        RunForever(model, settings, 0, &recorder);
+    } else if (headless) {
+        RunForever(model, settings);
+    } else {
+        RunGUI(model);
+    }
+}
+
+// Unpack writes the frames of a series as STL files named by pattern and
+// the frame's iteration: every frame, or only frame if it is not negative
+void Unpack(const std::string &path, const std::string &pattern, int frame) {
+    SeriesReader reader(path);
+    const int first = frame < 0 ? 0 : frame;
+    const int last = frame < 0 ? reader.Frames() - 1 : frame;
+    for (int i = first; i <= last; i++) {
+        char filename[1024];
+        snprintf(filename, sizeof(filename),
+            pattern.c_str(), int(reader.Iteration(i)));
+        const auto triangles = reader.Triangles(i);
+        SaveBinarySTL(filename, triangles);
+        std::cout << filename << " " << triangles.size() << std::endl;
+    }
+}
+
+int main(int argc, char **argv) {
+    // -isa forces a kernel variant, e.g. -isa avx2
+    // -double simulates in double precision instead of float
+    // -fast enables approximate math in the force kernel
+    // -compact stores normals and food quantized
+    // -diffuse N diffuses food along links in N sub-steps per iteration, at
+    //   -diffuse-rate R with -diffuse-decay D, fed by -food-source NAME
+    //   (random, uniform or up)
+    // -death N removes cells with more than N neighbors within the radius
+    //   of influence, checked every -death-every K iterations
+    // -out-of-core DIR keeps per-cell arrays in files under DIR, updated
+    //   in bricks of -brick-size N radii of influence
+    // -ranks N splits the form across N processes, headless
+    // -validate N compares N iterations of exact and approximate math
+    // -headless runs without the GUI, saving frames and checkpoints
+    // -resume PATH continues a headless run from a checkpoint
+    // -checkpoint PATH, -checkpoint-every N set the headless checkpoint
+    //   file and cadence (default: checkpoint.bin every 1000 iterations,
+    //   0 = disabled)
+    // -seed N seeds the run's random draws
+    // -record PATH logs a headless run's topology changes for replay
+    // -replay PATH re-simulates a recorded run to -replay-to N (default:
+    //   the end of the log), writing frames at the export cadence
+    // -unpack PATH writes the frames of a series, or only -unpack-frame N,
+    //   as STL files named by the export pattern
+    // -metrics PATH streams headless run metrics, e.g. metrics.jsonl or
+    //   metrics.prom, every -metrics-every N iterations
+    // -stl PATH seeds the form from a binary STL instead of a sphere
+    // -sweep PATH runs the parameter sets in PATH headless (see sweep.h)
+    // -jobs N sets how many sweep parameter sets run at once
+    // -bench DIR runs the benchmark suite with fixtures in DIR (see bench.h)
+    // -bench-cells LIST, -bench-threads LIST, -bench-weak N, -bench-reps N
+    //   set the fixture sizes, thread counts, weak scaling cells per thread
+    //   and repetitions
+    // -export PATTERN sets the headless frame filenames, e.g. out%08d.ply,
+    //   or a series to append every frame to, e.g. run.series
+    // -export-every N, -export-seconds S, -export-bytes B set the cadence
+    //   of headless frames
+    // -decimate N, -decimate-error E decimate headless STL and PLY frames
+    //   to N triangles or until collapses would move the surface by E
+    Settings settings;
+    int validateIterations = 0;
+    bool headless = false;
+    std::string resumePath;
+    std::string replayPath;
+    uint64_t replayTo = 0;
+    std::string unpackPath;
+    int unpackFrame = -1;
+    bool seeded = false;
+    std::string stlPath;
+    std::string sweepPath;
+    int jobs = std::thread::hardware_concurrency();
+    bool bench = false;
+    BenchOptions benchOptions;
+    for (int i = 1; i < argc; i++) {
+        const std::string flag = argv[i];
+        const std::string value = i + 1 < argc ? argv[i + 1] : "";
+        if (flag == "-isa") {
+            ISA isa;
+            if (!ParseISA(value, isa)) {
+                Panic("unknown isa: " + value);
+            }
+            SetISA(isa);
+            i++;
+        } else if (flag == "-double") {
+            settings.Double = true;
+        } else if (flag == "-fast") {
+            settings.FastMath = true;
+        } else if (flag == "-compact") {
+            settings.Compact = true;
+        } else if (flag == "-diffuse") {
+            settings.DiffusionSteps = std::stoi(value);
+            i++;
+        } else if (flag == "-diffuse-rate") {
+            settings.DiffusionRate = std::stof(value);
+            i++;
+        } else if (flag == "-diffuse-decay") {
+            settings.DiffusionDecay = std::stof(value);
+            i++;
+        } else if (flag == "-food-source") {
+            if (!ParseFoodSource(value, settings.Source)) {
+                Panic("unknown food source: " + value);
+            }
+            i++;
+        } else if (flag == "-death") {
+            settings.DeathNeighbors = std::stoi(value);
+            i++;
+        } else if (flag == "-death-every") {
+            settings.DeathEvery = std::stoi(value);
+            i++;
+        } else if (flag == "-out-of-core") {
+            settings.OutOfCoreDirectory = value;
+            i++;
+        } else if (flag == "-brick-size") {
+            settings.BrickSize = std::stof(value);
+            i++;
+        } else if (flag == "-ranks") {
+            settings.Ranks = std::stoi(value);
+            i++;
+        } else if (flag == "-validate") {
+            validateIterations = std::stoi(value);
+            i++;
+        } else if (flag == "-headless") {
+            headless = true;
+        } else if (flag == "-resume") {
+            resumePath = value;
+            i++;
+        } else if (flag == "-seed") {
+            settings.Seed = std::stoul(value);
+            seeded = true;
+            i++;
+        } else if (flag == "-record") {
+            settings.RecordPath = value;
+            i++;
+        } else if (flag == "-replay") {
+            replayPath = value;
+            i++;
+        } else if (flag == "-replay-to") {
+            replayTo = std::stoull(value);
+            i++;
+        } else if (flag == "-unpack") {
+            unpackPath = value;
+            i++;
+        } else if (flag == "-unpack-frame") {
+            unpackFrame = std::stoi(value);
+            i++;
+        } else if (flag == "-stl") {
+            stlPath = value;
+            i++;
+        } else if (flag == "-sweep") {
+            sweepPath = value;
+            i++;
+        } else if (flag == "-jobs") {
+            jobs = std::stoi(value);
+            i++;
+        } else if (flag == "-bench") {
+            bench = true;
+            benchOptions.Directory = value;
+            i++;
+        } else if (flag == "-bench-cells") {
+            benchOptions.Cells = ParseInts(value);
+            i++;
+        } else if (flag == "-bench-threads") {
+            benchOptions.Threads = ParseInts(value);
+            i++;
+        } else if (flag == "-bench-weak") {
+            benchOptions.WeakCells = std::stoi(value);
+            i++;
+        } else if (flag == "-bench-reps") {
+            benchOptions.Reps = std::stoi(value);
+            i++;
+        } else if (flag == "-checkpoint") {
+            settings.CheckpointPath = value;
+            i++;
+        } else if (flag == "-checkpoint-every") {
+            settings.CheckpointIterations = std::stoi(value);
+            i++;
+        } else if (flag == "-metrics") {
+            settings.MetricsPath = value;
+            i++;
+        } else if (flag == "-metrics-every") {
+            settings.MetricsIterations = std::stoi(value);
+            i++;
+        } else if (flag == "-export") {
+            settings.ExportPattern = value;
+            i++;
+        } else if (flag == "-export-every") {
+            settings.ExportIterations = std::stoi(value);
+            i++;
+        } else if (flag == "-export-seconds") {
+            settings.ExportSeconds = std::stod(value);
+            i++;
+        } else if (flag == "-export-bytes") {
+            settings.ExportBytes = std::stoull(value);
+            i++;
+        } else if (flag == "-decimate") {
+            settings.Decimate.TargetTriangles = std::stoull(value);
+            i++;
+        } else if (flag == "-decimate-error") {
+            settings.Decimate.MaxError = std::stof(value);
+            i++;
+        } else {
+            Panic("unknown flag: " + flag);
+        }
+    }
+    std::cout << "ISA               = " << ISAName(ActiveISA()) << std::endl;
+
+    // per-cell arrays of 1 MB and up go to files from here on
+    if (!settings.OutOfCoreDirectory.empty()) {
+        SetMappedStorage(settings.OutOfCoreDirectory, 1 << 20);
+    }
+
+    if (bench) {
+        RunBench(benchOptions);
+        return 0;
+    }
+
+    if (!unpackPath.empty()) {
+        Unpack(unpackPath, settings.ExportPattern, unpackFrame);
+        return 0;
+    }
+
+    if (!replayPath.empty()) {
+        ReplayLog log(replayPath);
+        if (log.ScalarSize() == sizeof(double)) {
+            Replay<double>(log, settings, replayTo);
+        } else {
+            Replay<float>(log, settings, replayTo);
+        }
+        return 0;
+    }
+
+    if (!resumePath.empty()) {
+        if (!settings.RecordPath.empty()) {
+            Panic("a resumed run can't be recorded");
+        }
+        if (settings.Ranks > 1) {
+            Panic("-resume can't be combined with -ranks");
+        }
+        if (CheckpointScalarSize(resumePath) == sizeof(double)) {
+            Resume<double>(resumePath, settings);
+        } else {
+            Resume<float>(resumePath, settings);
+        }
+        return 0;
+    }
+
+    const auto triangles =
+        stlPath.empty() ? SphereTriangles(1) : LoadBinarySTL(stlPath);
+
+    if (!sweepPath.empty()) {
+        RunSweep(sweepPath, triangles, settings, jobs);
+        return 0;
+    }
+
+    // a recorded run needs a known seed
+    if (!settings.RecordPath.empty() && !seeded) {
+        settings.Seed = std::random_device()();
+        seeded = true;
+    }
+    if (seeded) {
+        SeedRandom(settings.Seed);
+    }
+
+    RandomizeSettings(settings, triangles);
+
+    const Settings &s = settings;
+    std::cout << "SplitThreshold    = " << s.SplitThreshold << std::endl;
+    std::cout << "LinkRestLength    = " << s.LinkRestLength << std::endl;
+    std::cout << "RadiusOfInfluence = " << s.RadiusOfInfluence << std::endl;
+    std::cout << "RepulsionFactor   = " << s.RepulsionFactor << std::endl;
+    std::cout << "SpringFactor      = " << s.SpringFactor << std::endl;
+    std::cout << "PlanarFactor      = " << s.PlanarFactor << std::endl;
+    std::cout << "BulgeFactor       = " << s.BulgeFactor << std::endl;
+    if (seeded) {
+        std::cout << "Seed              = " << s.Seed << std::endl;
+    }
+    std::cout << std::endl;
+
+    if (settings.Double) {
+        Run<double>(triangles, settings, validateIterations, headless);
+    } else {
+        Run<float>(triangles, settings, validateIterations, headless);
+    }
 
     return 0;
 }
@@ -0,0 +1,92 @@
+#include "mapped.h"
+
+#include <cstdlib>
+#include <mutex>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <unordered_map>
+
+#include "util.h"
+
+namespace {
+
+std::mutex storageMutex;
+std::string storageDirectory;
+uint64_t storageMinBytes = 0;
+bool storageEnabled = false;
+
+// mapped allocations and their sizes; the heap ones aren't tracked
+std::unordered_map<void *, uint64_t> mappings;
+uint64_t mappedBytes = 0;
+
+void *MapFile(const uint64_t bytes) {
+    std::string path = storageDirectory + "/cellsXXXXXX";
+    const int fd = mkstemp(&path[0]);
+    if (fd < 0) {
+        Panic("failed to create mapped storage in " + storageDirectory);
+    }
+    unlink(path.c_str());
+    if (ftruncate(fd, bytes) != 0) {
+        close(fd);
+        Panic("failed to size mapped storage in " + storageDirectory);
+    }
+    void *p = mmap(
+        nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        Panic("failed to map storage in " + storageDirectory);
+    }
+    return p;
+}
+
+}
+
+void SetMappedStorage(const std::string &directory, const uint64_t minBytes) {
+    std::lock_guard<std::mutex> lock(storageMutex);
+    storageDirectory = directory;
+    storageMinBytes = minBytes;
+    storageEnabled = true;
+}
+
+bool MappedStorageEnabled() {
+    std::lock_guard<std::mutex> lock(storageMutex);
+    return storageEnabled;
+}
+
+uint64_t MappedBytes() {
+    std::lock_guard<std::mutex> lock(storageMutex);
+    return mappedBytes;
+}
+
+void *MappedAllocate(const uint64_t bytes) {
+    std::lock_guard<std::mutex> lock(storageMutex);
+    if (!storageEnabled || bytes < storageMinBytes || bytes == 0) {
+        return ::operator new(bytes);
+    }
+    void *p = MapFile(bytes);
+    mappings[p] = bytes;
+    mappedBytes += bytes;
+    return p;
+}
+
+void MappedDeallocate(void *p, const uint64_t bytes) {
+    std::lock_guard<std::mutex> lock(storageMutex);
+    const auto it = mappings.find(p);
+    if (it == mappings.end()) {
+        ::operator delete(p);
+        return;
+    }
+    munmap(p, bytes);
+    mappedBytes -= bytes;
+    mappings.erase(it);
+}
+
+void MappedPrefetch(const void *p, const uint64_t bytes) {
+    static const uintptr_t pageSize = sysconf(_SC_PAGESIZE);
+    if (bytes == 0) {
+        return;
+    }
+    const uintptr_t begin = uintptr_t(p) & ~(pageSize - 1);
+    const uintptr_t end = uintptr_t(p) + bytes;
+    madvise((void *)begin, end - begin, MADV_WILLNEED);
+}
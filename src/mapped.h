@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Out-of-core storage for the per-cell arrays. Once SetMappedStorage is
+// called, MappedAllocator allocations of at least minBytes are backed by
+// unlinked files in directory, mapped shared. Cold pages are then written
+// back to their file and dropped by the kernel instead of going to swap, so
+// a form larger than RAM runs at the speed of the disk rather than
+// thrashing. Smaller allocations, and any made before the call, stay on
+// the heap.
+void SetMappedStorage(const std::string &directory, const uint64_t minBytes);
+
+bool MappedStorageEnabled();
+
+// MappedBytes returns the bytes currently allocated in mapped files
+uint64_t MappedBytes();
+
+void *MappedAllocate(const uint64_t bytes);
+
+void MappedDeallocate(void *p, const uint64_t bytes);
+
+// MappedPrefetch asks the kernel to start reading the pages behind
+// [p, p + bytes) in the background and returns immediately
+void MappedPrefetch(const void *p, const uint64_t bytes);
+
+template <typename V>
+class MappedAllocator {
+public:
+    typedef V value_type;
+
+    MappedAllocator() {}
+
+    template <typename U>
+    MappedAllocator(const MappedAllocator<U> &) {}
+
+    V *allocate(const std::size_t n) {
+        return static_cast<V *>(MappedAllocate(n * sizeof(V)));
+    }
+
+    void deallocate(V *p, const std::size_t n) {
+        MappedDeallocate(p, n * sizeof(V));
+    }
+};
+
+template <typename A, typename B>
+bool operator==(const MappedAllocator<A> &, const MappedAllocator<B> &) {
+    return true;
+}
+
+template <typename A, typename B>
+bool operator!=(const MappedAllocator<A> &, const MappedAllocator<B> &) {
+    return false;
+}
+
+template <typename V>
+using MappedVector = std::vector<V, MappedAllocator<V>>;
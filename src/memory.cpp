@@ -0,0 +1,37 @@
+#include "memory.h"
+
+#include <sstream>
+
+MemoryUsage MemoryTotal(const MemoryUsages &report) {
+    MemoryUsage total;
+    total.Name = "total";
+    for (const auto &usage : report) {
+        total.Elements += usage.Elements;
+        total.UsedBytes += usage.UsedBytes;
+        total.CapacityBytes += usage.CapacityBytes;
+        total.HeapBytes += usage.HeapBytes;
+        total.Allocations += usage.Allocations;
+    }
+    return total;
+}
+
+std::string MemoryReportJSON(const MemoryUsages &report) {
+    std::ostringstream json;
+    json << "{";
+    MemoryUsages entries = report;
+    entries.push_back(MemoryTotal(report));
+    for (int i = 0; i < entries.size(); i++) {
+        const MemoryUsage &u = entries[i];
+        json
+            << (i ? "," : "") << "\"" << u.Name << "\":{"
+            << "\"elements\":" << u.Elements
+            << ",\"used_bytes\":" << u.UsedBytes
+            << ",\"capacity_bytes\":" << u.CapacityBytes
+            << ",\"heap_bytes\":" << u.HeapBytes
+            << ",\"allocations\":" << u.Allocations
+            << ",\"fragmentation\":" << u.Fragmentation()
+            << "}";
+    }
+    json << "}";
+    return json.str();
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// MemoryUsage is the footprint of one structure. UsedBytes counts live
+// elements, CapacityBytes what is reserved for them and HeapBytes estimates
+// what the allocator actually hands out, including the vector headers and
+// each block's malloc header and rounding. Fragmentation is the fraction of
+// HeapBytes not holding live elements.
+struct MemoryUsage {
+    std::string Name;
+    uint64_t Elements = 0;
+    uint64_t UsedBytes = 0;
+    uint64_t CapacityBytes = 0;
+    uint64_t HeapBytes = 0;
+    uint64_t Allocations = 0;
+
+    double Fragmentation() const {
+        return HeapBytes ? 1 - static_cast<double>(UsedBytes) / HeapBytes : 0;
+    }
+};
+
+typedef std::vector<MemoryUsage> MemoryUsages;
+
+// HeapBlockBytes estimates the size of the heap block behind a malloc of n
+// bytes: an 8 byte header, rounded up to 16 bytes, at least 32
+inline uint64_t HeapBlockBytes(const uint64_t n) {
+    if (n == 0) {
+        return 0;
+    }
+    return std::max<uint64_t>(32, (n + 8 + 15) & ~uint64_t(15));
+}
+
+template <typename V, typename A>
+MemoryUsage VectorMemory(
+    const std::string &name, const std::vector<V, A> &v)
+{
+    MemoryUsage usage;
+    usage.Name = name;
+    usage.Elements = v.size();
+    usage.UsedBytes = v.size() * sizeof(V);
+    usage.CapacityBytes = v.capacity() * sizeof(V);
+    usage.HeapBytes = HeapBlockBytes(usage.CapacityBytes);
+    usage.Allocations = v.capacity() > 0;
+    return usage;
+}
+
+// NestedVectorMemory counts the outer vector's headers as overhead and
+// the inner vectors' elements as the structure's elements
+template <typename V>
+MemoryUsage NestedVectorMemory(
+    const std::string &name, const std::vector<std::vector<V>> &v)
+{
+    MemoryUsage usage = VectorMemory(name, v);
+    usage.Elements = 0;
+    usage.UsedBytes = 0;
+    for (const auto &inner : v) {
+        usage.Elements += inner.size();
+        usage.UsedBytes += inner.size() * sizeof(V);
+        usage.CapacityBytes += inner.capacity() * sizeof(V);
+        usage.HeapBytes += HeapBlockBytes(inner.capacity() * sizeof(V));
+        usage.Allocations += inner.capacity() > 0;
+    }
+    return usage;
+}
+
+// MemoryTotal sums every entry of a report
+MemoryUsage MemoryTotal(const MemoryUsages &report);
+
+// MemoryReportJSON formats a report and its total as a JSON object keyed
+// by structure name
+std::string MemoryReportJSON(const MemoryUsages &report);
@@ -0,0 +1,232 @@
+#include "metrics.h"
+
+#include <cstdio>
+#include <fstream>
+
+#include "util.h"
+
+Metrics::Metrics(const std::string &path, const int everyIterations) :
+    m_Path(path),
+    m_Prometheus(path.size() >= 5 &&
+        path.compare(path.size() - 5, 5, ".prom") == 0),
+    m_EveryIterations(std::max(1, everyIterations)),
+    m_StartTime(std::chrono::steady_clock::now()),
+    m_Iterations(0),
+    m_Stop(false)
+{
+    if (!m_Path.empty()) {
+        m_Thread = std::thread(&Metrics::Run, this);
+    }
+}
+
+Metrics::~Metrics() {
+    if (m_Path.empty()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> guard(m_Mutex);
+        m_Stop = true;
+    }
+    m_Condition.notify_all();
+    m_Thread.join();
+}
+
+template <typename T>
+void Metrics::Update(const Model<T> &model, const uint64_t iteration) {
+    if (m_Path.empty()) {
+        return;
+    }
+
+    const UpdateStats &last = model.LastUpdate();
+    m_Phases.Ensure += last.Ensure;
+    m_Phases.Force += last.Force;
+    m_Phases.Recenter += last.Recenter;
+    m_Phases.Index += last.Index;
+    m_Phases.Commit += last.Commit;
+    m_Phases.Diffuse += last.Diffuse;
+    m_Phases.Split += last.Split;
+    m_Phases.Death += last.Death;
+    m_Phases.Splits += last.Splits;
+    m_Phases.Deaths += last.Deaths;
+    m_Iterations++;
+    if (iteration % m_EveryIterations != 0) {
+        return;
+    }
+
+    // the index and neighbor stats walk the model, so they are taken here
+    // while it is not changing; formatting and I/O happen on the writer
+    const std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - m_StartTime;
+    Record record;
+    record.Iteration = iteration;
+    record.Seconds = elapsed.count();
+    record.Iterations = m_Iterations;
+    record.Cells = model.NumCells();
+    record.Phases = m_Phases;
+    record.MeanNeighbors = model.MeanNeighbors();
+    record.Index = model.SpatialIndex().Stats();
+    record.ResidentBytes = ResidentBytes();
+    record.Memory = model.MemoryReport();
+    m_Iterations = 0;
+    m_Phases = UpdateStats();
+
+    {
+        std::lock_guard<std::mutex> guard(m_Mutex);
+        m_Queue.push_back(std::move(record));
+    }
+    m_Condition.notify_all();
+}
+
+void Metrics::Run() {
+    while (1) {
+        Record record;
+        {
+            std::unique_lock<std::mutex> lock(m_Mutex);
+            m_Condition.wait(lock, [this]() {
+                return m_Stop || !m_Queue.empty();
+            });
+            if (m_Queue.empty()) {
+                return;
+            }
+            record = std::move(m_Queue.front());
+            m_Queue.pop_front();
+        }
+        if (m_Prometheus) {
+            WritePrometheus(record);
+        } else {
+            WriteJSON(record);
+        }
+    }
+}
+
+void Metrics::WriteJSON(const Record &r) {
+    std::ofstream file(m_Path, std::ios_base::app);
+    if (!file) {
+        Panic("failed to open " + m_Path);
+    }
+    const double n = r.Iterations;
+    const UpdateStats &p = r.Phases;
+    const double step =
+        p.Ensure + p.Force + p.Recenter + p.Index + p.Commit + p.Diffuse +
+        p.Split + p.Death;
+    file
+        << "{\"iteration\":" << r.Iteration
+        << ",\"seconds\":" << r.Seconds
+        << ",\"iterations\":" << r.Iterations
+        << ",\"cells\":" << r.Cells
+        << ",\"splits\":" << p.Splits
+        << ",\"deaths\":" << p.Deaths
+        << ",\"step_seconds\":" << step / n
+        << ",\"phase_seconds\":{"
+        << "\"ensure\":" << p.Ensure / n
+        << ",\"force\":" << p.Force / n
+        << ",\"recenter\":" << p.Recenter / n
+        << ",\"index\":" << p.Index / n
+        << ",\"commit\":" << p.Commit / n
+        << ",\"diffuse\":" << p.Diffuse / n
+        << ",\"split\":" << p.Split / n
+        << ",\"death\":" << p.Death / n
+        << "},\"neighbors_per_query\":" << r.MeanNeighbors
+        << ",\"index\":{"
+        << "\"cells\":" << r.Index.Cells
+        << ",\"empty_cells\":" << r.Index.EmptyCells
+        << ",\"ids\":" << r.Index.Ids
+        << ",\"max_ids\":" << r.Index.MaxIds
+        << ",\"histogram\":[";
+    for (int i = 0; i < r.Index.Histogram.size(); i++) {
+        file << (i ? "," : "") << r.Index.Histogram[i];
+    }
+    file
+        << "]},\"rss_bytes\":" << r.ResidentBytes
+        << ",\"bytes_per_cell\":"
+        << static_cast<double>(r.ResidentBytes) / r.Cells
+        << ",\"memory\":" << MemoryReportJSON(r.Memory)
+        << "}" << std::endl;
+}
+
+void Metrics::WritePrometheus(const Record &r) {
+    // write to a temporary file and rename it so readers never see a
+    // partial file
+    const std::string tmpPath = m_Path + ".tmp";
+    {
+        std::ofstream file(tmpPath);
+        if (!file) {
+            Panic("failed to create " + tmpPath);
+        }
+        const double n = r.Iterations;
+        const UpdateStats &p = r.Phases;
+        const auto gauge = [&file](
+            const std::string &name, const std::string &help)
+        {
+            file << "# HELP cellform_" << name << " " << help << "\n";
+            file << "# TYPE cellform_" << name << " gauge\n";
+        };
+
+        gauge("iteration", "Iterations run.");
+        file << "cellform_iteration " << r.Iteration << "\n";
+        gauge("cells", "Number of cells.");
+        file << "cellform_cells " << r.Cells << "\n";
+        gauge("splits", "Cells split per iteration.");
+        file << "cellform_splits " << p.Splits / n << "\n";
+        gauge("deaths", "Cells removed per iteration.");
+        file << "cellform_deaths " << p.Deaths / n << "\n";
+        gauge("phase_seconds", "Mean seconds per iteration by phase.");
+        const std::pair<const char *, double> phases[] = {
+            {"ensure", p.Ensure}, {"force", p.Force},
+            {"recenter", p.Recenter}, {"index", p.Index},
+            {"commit", p.Commit}, {"diffuse", p.Diffuse},
+            {"split", p.Split}, {"death", p.Death},
+        };
+        for (const auto &phase : phases) {
+            file << "cellform_phase_seconds{phase=\"" << phase.first << "\"} "
+                << phase.second / n << "\n";
+        }
+        gauge("neighbors_per_query", "Mean index entries scanned per cell.");
+        file << "cellform_neighbors_per_query " << r.MeanNeighbors << "\n";
+        gauge("resident_bytes", "Resident set size.");
+        file << "cellform_resident_bytes " << r.ResidentBytes << "\n";
+        gauge("bytes_per_cell", "Resident set size per cell.");
+        file << "cellform_bytes_per_cell "
+            << static_cast<double>(r.ResidentBytes) / r.Cells << "\n";
+
+        gauge("memory_bytes", "Bytes per model structure, see memory.h.");
+        for (const auto &u : r.Memory) {
+            const std::pair<const char *, uint64_t> kinds[] = {
+                {"used", u.UsedBytes}, {"capacity", u.CapacityBytes},
+                {"heap", u.HeapBytes},
+            };
+            for (const auto &kind : kinds) {
+                file << "cellform_memory_bytes{structure=\"" << u.Name
+                    << "\",kind=\"" << kind.first << "\"} " << kind.second
+                    << "\n";
+            }
+        }
+        gauge("memory_allocations", "Heap blocks per model structure.");
+        for (const auto &u : r.Memory) {
+            file << "cellform_memory_allocations{structure=\"" << u.Name
+                << "\"} " << u.Allocations << "\n";
+        }
+
+        // histogram bucket i holds up to 2^i - 1 ids
+        file << "# HELP cellform_index_occupancy Ids per index cell.\n";
+        file << "# TYPE cellform_index_occupancy histogram\n";
+        uint64_t cumulative = 0;
+        for (int i = 0; i < r.Index.Histogram.size(); i++) {
+            cumulative += r.Index.Histogram[i];
+            file << "cellform_index_occupancy_bucket{le=\""
+                << (uint64_t(1) << i) - 1 << "\"} " << cumulative << "\n";
+        }
+        file << "cellform_index_occupancy_bucket{le=\"+Inf\"} "
+            << r.Index.Cells << "\n";
+        file << "cellform_index_occupancy_sum " << r.Index.Ids << "\n";
+        file << "cellform_index_occupancy_count " << r.Index.Cells << "\n";
+    }
+    if (std::rename(tmpPath.c_str(), m_Path.c_str()) != 0) {
+        Panic("failed to rename " + tmpPath);
+    }
+}
+
+template void Metrics::Update(
+    const Model<float> &model, const uint64_t iteration);
+template void Metrics::Update(
+    const Model<double> &model, const uint64_t iteration);
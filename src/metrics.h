@@ -0,0 +1,70 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "index.h"
+#include "memory.h"
+#include "model.h"
+
+// Metrics streams run metrics from a background thread. Every Update adds
+// the model's phase times to the current window; every N iterations the
+// window is summarized together with the index occupancy, the mean number
+// of neighbors scanned per cell, the RSS and the model's MemoryReport, and
+// handed to the writer thread.
+//
+// If the path ends in .prom it is rewritten with the latest window as a
+// Prometheus textfile (for node_exporter's textfile collector); otherwise
+// one JSON object per window is appended to it. An empty path disables
+// metrics.
+class Metrics {
+public:
+    Metrics(const std::string &path, const int everyIterations);
+
+    ~Metrics();
+
+    template <typename T>
+    void Update(const Model<T> &model, const uint64_t iteration);
+
+private:
+    // Record is one summarized window
+    struct Record {
+        uint64_t Iteration;
+        double Seconds;
+        int Iterations;
+        uint64_t Cells;
+        UpdateStats Phases;
+        double MeanNeighbors;
+        IndexStats Index;
+        uint64_t ResidentBytes;
+        MemoryUsages Memory;
+    };
+
+    void Run();
+
+    void WriteJSON(const Record &record);
+
+    void WritePrometheus(const Record &record);
+
+    std::string m_Path;
+    bool m_Prometheus;
+    int m_EveryIterations;
+    std::chrono::steady_clock::time_point m_StartTime;
+
+    // current window
+    int m_Iterations;
+    UpdateStats m_Phases;
+
+    // records waiting for the writer thread
+    std::deque<Record> m_Queue;
+
+    std::thread m_Thread;
+    std::mutex m_Mutex;
+    std::condition_variable m_Condition;
+    bool m_Stop;
+};
@@ -5,20 +5,139 @@
 #include <glm/gtx/hash.hpp>
 #include <glm/gtx/norm.hpp>
 #include <glm/gtx/normal.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
 #include <iostream>
 #include <unordered_map>
 
+#include "compact.h"
+#include "fastmath.h"
+#include "profile.h"
 #include "util.h"
 
-Model::Model(
+namespace {
+
+// WeldKey is one triangle corner keyed by the bits of its position, so that
+// sorting brings together the corners that weld into the same cell. Ties
+// sort by corner, so each run starts with its first appearance.
+struct WeldKey {
+    uint32_t X, Y, Z;
+    uint32_t Corner;
+
+    bool SamePosition(const WeldKey &other) const {
+        return X == other.X && Y == other.Y && Z == other.Z;
+    }
+
+    bool operator<(const WeldKey &other) const {
+        if (X != other.X) {
+            return X < other.X;
+        }
+        if (Y != other.Y) {
+            return Y < other.Y;
+        }
+        if (Z != other.Z) {
+            return Z < other.Z;
+        }
+        return Corner < other.Corner;
+    }
+};
+
+uint32_t WeldBits(const float value) {
+    // -0 and +0 compare equal, so they must weld too
+    const float v = value == 0 ? 0 : value;
+    uint32_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+    return bits;
+}
+
+// ParallelSort sorts one run per thread, then merges pairs of runs until
+// one is left
+template <typename V>
+void ParallelSort(std::vector<V> &values, ThreadPool &pool) {
+    const int wn = std::max(1, pool.NumThreads());
+    std::vector<uint64_t> bounds(wn + 1);
+    for (int i = 0; i <= wn; i++) {
+        bounds[i] = values.size() * i / wn;
+    }
+    const auto at = [&values, &bounds](const int i) {
+        return values.begin() + bounds[i];
+    };
+    pool.Run(wn, [&at](const int wi, const int) {
+        std::sort(at(wi), at(wi + 1));
+    });
+    for (int step = 1; step < wn; step *= 2) {
+        const int merges = (wn + step * 2 - 1) / (step * 2);
+        pool.Run(merges, [&at, wn, step](const int mi, const int) {
+            const int lo = mi * step * 2;
+            const int mid = std::min(lo + step, wn);
+            const int hi = std::min(lo + step * 2, wn);
+            std::inplace_merge(at(lo), at(mid), at(hi));
+        });
+    }
+}
+
+// SpreadBits spaces the low 21 bits of x three apart
+uint64_t SpreadBits(uint64_t x) {
+    x &= 0x1fffff;
+    x = (x | x << 32) & 0x1f00000000ffff;
+    x = (x | x << 16) & 0x1f0000ff0000ff;
+    x = (x | x << 8) & 0x100f00f00f00f00f;
+    x = (x | x << 4) & 0x10c30c30c30c30c3;
+    x = (x | x << 2) & 0x1249249249249249;
+    return x;
+}
+
+// MortonKey interleaves the bits of a brick's coordinates, so that sorting
+// by it visits bricks along a Z-order curve
+uint64_t MortonKey(const glm::ivec3 &brick) {
+    return
+        SpreadBits(brick.x) |
+        SpreadBits(brick.y) << 1 |
+        SpreadBits(brick.z) << 2;
+}
+
+// Permute reorders values so that entry i comes from keys[i].second
+template <typename V>
+void Permute(
+    V &values, const std::vector<std::pair<uint64_t, int>> &keys,
+    ThreadPool &pool)
+{
+    if (values.empty()) {
+        return;
+    }
+    V result(keys.size());
+    ParallelFor(pool, keys.size(), [&](const uint64_t i) {
+        result[i] = values[keys[i].second];
+    });
+    values.swap(result);
+}
+
+}
+
+bool ParseFoodSource(const std::string &name, FoodSource &source) {
+    if (name == "random") {
+        source = FoodSource::Random;
+    } else if (name == "uniform") {
+        source = FoodSource::Uniform;
+    } else if (name == "up") {
+        source = FoodSource::Up;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+template <typename T>
+Model<T>::Model(
     const std::vector<Triangle> &triangles,
-    const float splitThreshold,
-    const float linkRestLength,
-    const float radiusOfInfluence,
-    const float repulsionFactor,
-    const float springFactor,
-    const float planarFactor,
-    const float bulgeFactor) :
+    const T splitThreshold,
+    const T linkRestLength,
+    const T radiusOfInfluence,
+    const T repulsionFactor,
+    const T springFactor,
+    const T planarFactor,
+    const T bulgeFactor) :
     m_SplitThreshold(splitThreshold),
     m_LinkRestLength(linkRestLength),
     m_RadiusOfInfluence(radiusOfInfluence),
@@ -38,7 +157,7 @@ Model::Model(
             if (indexes.find(v) == indexes.end()) {
                 indexes[v] = m_Positions.size();
                 // create new cell
-                m_Positions.push_back(v);
+                m_Positions.emplace_back(v);
                 m_Normals.emplace_back(0);
                 m_Food.push_back(0);
                 m_Links.emplace_back();
@@ -69,12 +188,225 @@ Model::Model(
     // build index and compute normals
     Ensure();
     for (int i = 0; i < m_Positions.size(); i++) {
-        m_Index.Add(m_Positions[i], i);
+        m_Index.Add(glm::vec3(m_Positions[i]), i);
+        m_Normals[i] = CellNormal(i);
+    }
+}
+
+template <typename T>
+Model<T>::Model(
+    const std::vector<Triangle> &triangles,
+    ThreadPool &pool,
+    const T splitThreshold,
+    const T linkRestLength,
+    const T radiusOfInfluence,
+    const T repulsionFactor,
+    const T springFactor,
+    const T planarFactor,
+    const T bulgeFactor) :
+    m_SplitThreshold(splitThreshold),
+    m_LinkRestLength(linkRestLength),
+    m_RadiusOfInfluence(radiusOfInfluence),
+    m_RepulsionFactor(repulsionFactor),
+    m_SpringFactor(springFactor),
+    m_PlanarFactor(planarFactor),
+    m_BulgeFactor(bulgeFactor),
+    m_Index(radiusOfInfluence * 1.2)
+{
+    // corner c is vertex c % 3 of triangle c / 3
+    const uint64_t numCorners = uint64_t(triangles.size()) * 3;
+    const auto corner = [&triangles](const uint64_t c) -> const glm::vec3 & {
+        const Triangle &t = triangles[c / 3];
+        return c % 3 == 0 ? t.A() : c % 3 == 1 ? t.B() : t.C();
+    };
+
+    // sort corners by position
+    std::vector<WeldKey> keys(numCorners);
+    ParallelFor(pool, numCorners, [&keys, &corner](const uint64_t c) {
+        const glm::vec3 &p = corner(c);
+        keys[c] = {WeldBits(p.x), WeldBits(p.y), WeldBits(p.z), uint32_t(c)};
+    });
+    ParallelSort(keys, pool);
+
+    // each run of equal positions becomes one cell; cells are numbered in
+    // order of first appearance, like the serial constructor
+    std::vector<uint32_t> cellIds(numCorners + 1, 0);
+    ParallelFor(pool, numCorners, [&keys, &cellIds](const uint64_t i) {
+        if (i == 0 || !keys[i].SamePosition(keys[i - 1])) {
+            cellIds[keys[i].Corner + 1] = 1;
+        }
+    });
+    for (uint64_t c = 0; c < numCorners; c++) {
+        cellIds[c + 1] += cellIds[c];
+    }
+    const int numCells = cellIds[numCorners];
+    std::vector<uint64_t> runStarts(numCells);
+    ParallelFor(pool, numCorners, [&](const uint64_t i) {
+        if (i == 0 || !keys[i].SamePosition(keys[i - 1])) {
+            runStarts[cellIds[keys[i].Corner]] = i;
+        }
+    });
+
+    // map every corner to its cell
+    std::vector<int> cornerCells(numCorners);
+    ParallelFor(pool, numCells, [&](const uint64_t i) {
+        for (uint64_t j = runStarts[i]; j < numCorners; j++) {
+            if (j > runStarts[i] && !keys[j].SamePosition(keys[j - 1])) {
+                break;
+            }
+            cornerCells[keys[j].Corner] = i;
+        }
+    });
+
+    // create cells and sort each cell's triangles into CCW order to make
+    // its links. within a run corners are in triangle order, which matches
+    // the serial constructor
+    m_Positions.resize(numCells);
+    m_Normals.resize(numCells, vec3(0));
+    m_Food.resize(numCells, 0);
+    m_Links.resize(numCells);
+    ParallelFor(pool, numCells, [&](const uint64_t i) {
+        const auto after = [&cornerCells](const uint32_t c) {
+            return cornerCells[c - c % 3 + (c + 1) % 3];
+        };
+        const auto before = [&cornerCells](const uint32_t c) {
+            return cornerCells[c - c % 3 + (c + 2) % 3];
+        };
+        std::vector<uint32_t> corners;
+        for (uint64_t j = runStarts[i]; j < numCorners; j++) {
+            if (j > runStarts[i] && !keys[j].SamePosition(keys[j - 1])) {
+                break;
+            }
+            corners.push_back(keys[j].Corner);
+        }
+        for (int i0 = 1; i0 < corners.size(); i0++) {
+            const int prev = before(corners[i0-1]);
+            for (int i1 = i0; i1 < corners.size(); i1++) {
+                if (after(corners[i1]) == prev) {
+                    std::swap(corners[i0], corners[i1]);
+                    break;
+                }
+            }
+        }
+        m_Positions[i] = vec3(corner(corners[0]));
+        m_Links[i].reserve(corners.size());
+        for (const uint32_t c : corners) {
+            m_Links[i].push_back(after(c));
+        }
+    });
+
+    // build index and compute normals
+    Ensure();
+    ParallelFor(pool, numCells, [this](const uint64_t i) {
+        m_Index.Add(glm::vec3(m_Positions[i]), i);
         m_Normals[i] = CellNormal(i);
+    });
+}
+
+template <typename T>
+Model<T>::Model(
+    const T splitThreshold,
+    const T linkRestLength,
+    const T radiusOfInfluence,
+    const T repulsionFactor,
+    const T springFactor,
+    const T planarFactor,
+    const T bulgeFactor,
+    MappedVector<vec3> positions,
+    MappedVector<vec3> normals,
+    MappedVector<T> food,
+    std::vector<std::vector<int>> links,
+    ThreadPool &pool) :
+    m_SplitThreshold(splitThreshold),
+    m_LinkRestLength(linkRestLength),
+    m_RadiusOfInfluence(radiusOfInfluence),
+    m_RepulsionFactor(repulsionFactor),
+    m_SpringFactor(springFactor),
+    m_PlanarFactor(planarFactor),
+    m_BulgeFactor(bulgeFactor),
+    m_Positions(std::move(positions)),
+    m_Normals(std::move(normals)),
+    m_Food(std::move(food)),
+    m_Links(std::move(links)),
+    m_Index(radiusOfInfluence * 1.2)
+{
+    const int n = m_Positions.size();
+    if (n == 0 || m_Normals.size() != n ||
+        m_Food.size() != n || m_Links.size() != n)
+    {
+        Panic("inconsistent cell state in Model");
+    }
+
+    // build index; cells without links are free slots
+    Ensure();
+    for (int i = 0; i < n; i++) {
+        if (m_Links[i].empty()) {
+            m_FreeCells.push_back(i);
+        }
     }
+    ParallelFor(pool, n, [this](const uint64_t i) {
+        if (!m_Links[i].empty()) {
+            m_Index.Add(glm::vec3(m_Positions[i]), i);
+        }
+    });
 }
 
-void Model::Bounds(glm::vec3 &min, glm::vec3 &max) const {
+template <typename T>
+void Model<T>::Reload(
+    MappedVector<vec3> positions,
+    MappedVector<vec3> normals,
+    MappedVector<T> food,
+    std::vector<std::vector<int>> links,
+    ThreadPool &pool)
+{
+    const int n = positions.size();
+    if (n == 0 || normals.size() != n ||
+        food.size() != n || links.size() != n)
+    {
+        Panic("inconsistent cell state in Model");
+    }
+    if (m_Compact) {
+        Panic("Reload on a compact model");
+    }
+
+    // the index only maps slots to positions, so whichever cell now holds
+    // a slot just moves the slot's entry, which is free unless it changes
+    // index cell. Remove doesn't lock, so slots that went away are dropped
+    // first.
+    MappedVector<vec3> oldPositions = std::move(m_Positions);
+    const std::vector<std::vector<int>> oldLinks = std::move(m_Links);
+    const int m = oldPositions.size();
+    m_Positions = std::move(positions);
+    m_Normals = std::move(normals);
+    m_Food = std::move(food);
+    m_Links = std::move(links);
+    Ensure();
+    for (int i = 0; i < m; i++) {
+        if (!oldLinks[i].empty() && (i >= n || m_Links[i].empty())) {
+            m_Index.Remove(glm::vec3(oldPositions[i]), i);
+        }
+    }
+    ParallelFor(pool, n, [&](const uint64_t i) {
+        if (m_Links[i].empty()) {
+            return;
+        }
+        if (i < m && !oldLinks[i].empty()) {
+            m_Index.Update(
+                glm::vec3(oldPositions[i]), glm::vec3(m_Positions[i]), i);
+        } else {
+            m_Index.Add(glm::vec3(m_Positions[i]), i);
+        }
+    });
+    m_FreeCells.clear();
+    for (int i = 0; i < n; i++) {
+        if (m_Links[i].empty()) {
+            m_FreeCells.push_back(i);
+        }
+    }
+}
+
+template <typename T>
+void Model<T>::Bounds(vec3 &min, vec3 &max) const {
     min = m_Positions[0];
     max = m_Positions[0];
     for (const auto &p : m_Positions) {
@@ -83,73 +415,148 @@ void Model::Bounds(glm::vec3 &min, glm::vec3 &max) const {
     }
 }
 
-void Model::Ensure() {
-    glm::vec3 min, max;
+template <typename T>
+void Model<T>::Ensure() {
+    vec3 min, max;
     Bounds(min, max);
-    const float padding = std::max(m_LinkRestLength, m_RadiusOfInfluence) * 10;
+    const T padding = std::max(m_LinkRestLength, m_RadiusOfInfluence) * 10;
     min -= padding;
     max += padding;
-    m_Index.Ensure(min, max);
+    m_Index.Ensure(glm::vec3(min), glm::vec3(max));
+}
+
+template <typename T>
+void Model<T>::UpdateBatch(const int wi, const int wn) {
+    UpdateCells(wi, m_Positions.size(), wn);
 }
 
-void Model::UpdateBatch(const int wi, const int wn) {
-    const float roi2 = m_RadiusOfInfluence * m_RadiusOfInfluence;
-    const float link2 = m_LinkRestLength * m_LinkRestLength;
+template <typename T>
+void Model<T>::UpdateCells(const int i0, const int i1, const int step) {
+    switch (ActiveISA()) {
+    case ISA::AVX512: UpdateCellsAVX512(i0, i1, step); break;
+    case ISA::AVX2: UpdateCellsAVX2(i0, i1, step); break;
+    case ISA::SSE42: UpdateCellsSSE42(i0, i1, step); break;
+    default:
+        if (m_FastMath) {
+            UpdateCellsKernel<true>(i0, i1, step);
+        } else {
+            UpdateCellsKernel<false>(i0, i1, step);
+        }
+        break;
+    }
+}
 
-    for (int i = wi; i < m_Positions.size(); i += wn) {
-        // get cell position, normal, and links
-        const glm::vec3 P = m_Positions[i];
-        const glm::vec3 N = CellNormal(i);
+template <typename T>
+void Model<T>::UpdateCellsSSE42(const int i0, const int i1, const int step) {
+    if (m_FastMath) {
+        UpdateCellsKernel<true>(i0, i1, step);
+    } else {
+        UpdateCellsKernel<false>(i0, i1, step);
+    }
+}
+
+template <typename T>
+void Model<T>::UpdateCellsAVX2(const int i0, const int i1, const int step) {
+    if (m_FastMath) {
+        UpdateCellsKernel<true>(i0, i1, step);
+    } else {
+        UpdateCellsKernel<false>(i0, i1, step);
+    }
+}
+
+template <typename T>
+void Model<T>::UpdateCellsAVX512(const int i0, const int i1, const int step) {
+    if (m_FastMath) {
+        UpdateCellsKernel<true>(i0, i1, step);
+    } else {
+        UpdateCellsKernel<false>(i0, i1, step);
+    }
+}
+
+template <typename T>
+template <bool Fast>
+ALWAYS_INLINE void Model<T>::UpdateCellsKernel(
+    const int i0, const int i1, const int step)
+{
+    const T roi2 = m_RadiusOfInfluence * m_RadiusOfInfluence;
+    const T link2 = m_LinkRestLength * m_LinkRestLength;
+    const T invRoi2 = Reciprocal<Fast>(roi2);
+    uint64_t scanned = 0;
+    uint64_t accepted = 0;
+
+    for (int i = i0; i < i1; i += step) {
+        // free slots stay put until they are reused
         const auto &links = m_Links[i];
+        if (links.empty()) {
+            m_NewPositions[i] = m_Positions[i];
+            if (m_Compact) {
+                m_NewPackedNormals[i] = m_PackedNormals[i];
+            } else {
+                m_NewNormals[i] = m_Normals[i];
+            }
+            continue;
+        }
+
+        // get cell position and normal
+        const vec3 P = m_Positions[i];
+        const vec3 N = CellNormalKernel<Fast>(i);
 
         // accumulate
-        glm::vec3 repulsionVector(0);
-        glm::vec3 springTarget(0);
-        glm::vec3 planarTarget(0);
-        float bulgeDistance = 0;
+        vec3 repulsionVector(0);
+        vec3 springTarget(0);
+        vec3 planarTarget(0);
+        T bulgeDistance = 0;
         for (const int j : links) {
-            const glm::vec3 &L = m_Positions[j];
-            const glm::vec3 D = L - P;
-            const glm::vec3 Dn = glm::normalize(D);
+            const vec3 &L = m_Positions[j];
+            const vec3 D = L - P;
+            const vec3 Dn = Normalize<Fast>(D);
             springTarget += L - Dn * m_LinkRestLength;
             planarTarget += L;
-            const float length2 = glm::length2(D);
+            const T length2 = glm::length2(D);
             if (length2 < link2) {
-                const float dot = glm::dot(D, N);
-                bulgeDistance += std::sqrt(
+                const T dot = glm::dot(D, N);
+                bulgeDistance += Sqrt<Fast>(
                     link2 - glm::dot(D, D) + dot * dot) + dot;
             }
             if (length2 < roi2) {
                 // linked cells will be repulsed in the repulsion step below
                 // so, here we add in the opposite to counteract it for
                 // performance reasons
-                const float m = (roi2 - length2) / roi2;
+                const T m = Fast ?
+                    (roi2 - length2) * invRoi2 : (roi2 - length2) / roi2;
                 repulsionVector += Dn * m;
             }
         }
 
         // average
-        const float m = 1.f / static_cast<float>(links.size());
+        const T m = Reciprocal<Fast>(static_cast<T>(links.size()));
         springTarget *= m;
         planarTarget *= m;
         bulgeDistance *= m;
 
         // repulsion
-        for (const int j : m_Index.Nearby(P)) {
+        const auto &nearby = m_Index.Nearby(glm::vec3(P));
+        scanned += nearby.size();
+        for (const int j : nearby) {
             if (j == i) {
                 continue;
             }
-            const glm::vec3 &L = m_Positions[j];
-            const glm::vec3 D = P - L;
-            const float d2 = glm::length2(D);
+            const vec3 &L = m_Positions[j];
+            const vec3 D = P - L;
+            const T d2 = glm::length2(D);
             if (d2 < roi2) {
-                const float m = (roi2 - d2) / roi2;
-                repulsionVector += glm::normalize(D) * m;
+                const T m = Fast ? (roi2 - d2) * invRoi2 : (roi2 - d2) / roi2;
+                repulsionVector += Normalize<Fast>(D) * m;
+                accepted++;
             }
         }
 
         // results
-        m_NewNormals[i] = N;
+        if (m_Compact) {
+            m_NewPackedNormals[i] = EncodeNormal(N);
+        } else {
+            m_NewNormals[i] = N;
+        }
         m_NewPositions[i] = P +
             m_SpringFactor * (springTarget - P) +
             m_PlanarFactor * (planarTarget - P) +
@@ -167,84 +574,758 @@ void Model::UpdateBatch(const int wi, const int wn) {
         // m_Food[i] += std::pow(N.z, 2);
         // m_Food[i] = std::max(0.f, m_Food[i]);
     }
+
+    PROFILE_COUNT(NeighborsScanned, scanned);
+    PROFILE_COUNT(NeighborsAccepted, accepted);
+}
+
+template <typename T>
+void Model<T>::Calibrate(ThreadPool &pool) {
+    using Clock = std::chrono::steady_clock;
+    const int wn = pool.NumThreads();
+
+    // cost of handing a batch to each thread and waiting for it
+    const int rounds = 100;
+    auto startTime = Clock::now();
+    for (int i = 0; i < rounds; i++) {
+        pool.Run(wn, [](const int, const int) {});
+    }
+    const std::chrono::duration<double> overhead = Clock::now() - startTime;
+
+    // cost of updating one cell, single threaded
+    ResizeBuffers();
+    int cells = 0;
+    startTime = Clock::now();
+    while (cells < 100000) {
+        UpdateBatch(0, 1);
+        cells += m_Positions.size();
+    }
+    const std::chrono::duration<double> compute = Clock::now() - startTime;
+
+    const double perRound = overhead.count() / rounds;
+    const double perCell = compute.count() / cells;
+    m_CellsPerWorker = std::max(1, static_cast<int>(perRound / perCell));
+}
+
+template <typename T>
+int Model<T>::Workers(const ThreadPool &pool) const {
+    int maxWorkers = pool.NumThreads();
+    if (m_MaxWorkers > 0) {
+        maxWorkers = std::min(maxWorkers, m_MaxWorkers);
+    }
+    if (m_CellsPerWorker <= 0) {
+        return maxWorkers;
+    }
+    const int wn = m_Positions.size() / m_CellsPerWorker;
+    return std::max(1, std::min(wn, maxWorkers));
+}
+
+template <typename T>
+void Model<T>::SetMaxWorkers(const int maxWorkers) {
+    m_MaxWorkers = maxWorkers;
 }
 
-void Model::Update(ThreadPool &pool, const bool split) {
+template <typename T>
+void Model<T>::SetBrickSize(const T brickSize) {
+    if (brickSize > 0 && m_RecordEvents) {
+        Panic("brick scheduling can't be recorded");
+    }
+    m_BrickSize = brickSize;
+    m_BrickedCells = 0;
+    m_BrickStarts.clear();
+    m_BrickHalos.clear();
+}
+
+template <typename T>
+void Model<T>::Renumber(
+    const std::vector<std::pair<uint64_t, int>> &keys, ThreadPool &pool)
+{
+    const int n = keys.size();
+    std::vector<int> rank(m_Positions.size(), -1);
+    ParallelFor(pool, n, [&](const uint64_t i) {
+        rank[keys[i].second] = i;
+    });
+    Permute(m_Positions, keys, pool);
+    if (m_Compact) {
+        Permute(m_PackedNormals, keys, pool);
+        Permute(m_PackedFood, keys, pool);
+        m_NormalsStale = m_FoodStale = true;
+    } else {
+        Permute(m_Normals, keys, pool);
+        Permute(m_Food, keys, pool);
+    }
+    std::vector<std::vector<int>> links(n);
+    ParallelFor(pool, n, [&](const uint64_t i) {
+        links[i].swap(m_Links[keys[i].second]);
+        for (int &j : links[i]) {
+            j = rank[j];
+        }
+    });
+    m_Links.swap(links);
+    m_FreeCells.clear();
+
+    // rebuild the index with the new numbers
+    m_Index = Index(m_RadiusOfInfluence * 1.2);
     Ensure();
+    ParallelFor(pool, n, [this](const uint64_t i) {
+        m_Index.Add(glm::vec3(m_Positions[i]), i);
+    });
+}
 
-    m_NewPositions.resize(m_Positions.size());
-    m_NewNormals.resize(m_Normals.size());
+template <typename T>
+void Model<T>::Defragment(ThreadPool &pool) {
+    PROFILE_SCOPE("Defragment");
+    if (m_FreeCells.empty()) {
+        return;
+    }
+    if (m_RecordEvents) {
+        m_Events.push_back({CellEvent::Defragment, 0, 0});
+    }
 
-    const int wn = pool.NumThreads();
-    std::vector<std::future<void>> results(wn);
+    // live cells keep their order, free slots sort last and are dropped
+    std::vector<std::pair<uint64_t, int>> keys(m_Positions.size());
+    ParallelFor(pool, keys.size(), [&](const uint64_t i) {
+        keys[i] = std::make_pair(uint64_t(m_Links[i].empty()), int(i));
+    });
+    ParallelSort(keys, pool);
+    keys.resize(NumCells());
+    Renumber(keys, pool);
+
+    // the buffers are sized again on the next Update
+    MappedVector<vec3>().swap(m_NewPositions);
+    MappedVector<vec3>().swap(m_NewNormals);
+    MappedVector<uint32_t>().swap(m_NewPackedNormals);
+    MappedVector<T>().swap(m_NewFood);
+    std::vector<int>().swap(m_FreeCells);
+    std::vector<int>().swap(m_LinkStarts);
+    std::vector<int>().swap(m_LinkCells);
+
+    // the bricks no longer match the numbering
+    if (m_BrickSize > 0) {
+        SetBrickSize(m_BrickSize);
+    }
+}
+
+template <typename T>
+void Model<T>::Reorder(ThreadPool &pool) {
+    PROFILE_SCOPE("Reorder");
+    vec3 min, max;
+    Bounds(min, max);
+    const auto brickOf = [this, &min](const vec3 &p) {
+        return glm::ivec3(glm::floor((p - min) / m_BrickSize));
+    };
+
+    // sort cells by the Morton key of their brick; ties keep their current
+    // order, which keeps the renumbering stable between passes. Free slots
+    // sort last and are dropped.
+    std::vector<std::pair<uint64_t, int>> keys(m_Positions.size());
+    ParallelFor(pool, keys.size(), [&](const uint64_t i) {
+        const uint64_t key = m_Links[i].empty() ?
+            UINT64_MAX : MortonKey(brickOf(m_Positions[i]));
+        keys[i] = std::make_pair(key, int(i));
+    });
+    ParallelSort(keys, pool);
+    keys.resize(NumCells());
+    Renumber(keys, pool);
+    const int n = keys.size();
+
+    // find where each brick starts, then its halo: the bricks around it
+    // that hold any cells
+    m_BrickStarts.clear();
+    std::vector<glm::ivec3> bricks;
+    std::unordered_map<uint64_t, int> brickNumbers;
+    for (int i = 0; i < n; i++) {
+        if (i == 0 || keys[i].first != keys[i - 1].first) {
+            brickNumbers[keys[i].first] = m_BrickStarts.size();
+            m_BrickStarts.push_back(i);
+            bricks.push_back(brickOf(m_Positions[i]));
+        }
+    }
+    m_BrickStarts.push_back(n);
+    m_BrickHalos.assign(bricks.size(), std::vector<int>());
+    ParallelFor(pool, bricks.size(), [&](const uint64_t b) {
+        for (int dz = -1; dz <= 1; dz++) {
+            for (int dy = -1; dy <= 1; dy++) {
+                for (int dx = -1; dx <= 1; dx++) {
+                    const glm::ivec3 brick = bricks[b] + glm::ivec3(dx, dy, dz);
+                    if ((dx == 0 && dy == 0 && dz == 0) ||
+                        glm::any(glm::lessThan(brick, glm::ivec3(0))))
+                    {
+                        continue;
+                    }
+                    const auto it = brickNumbers.find(MortonKey(brick));
+                    if (it != brickNumbers.end()) {
+                        m_BrickHalos[b].push_back(it->second);
+                    }
+                }
+            }
+        }
+    });
+    m_BrickedCells = n;
+}
+
+template <typename T>
+void Model<T>::UpdateBricks(
+    const int wi, const int wn, std::atomic<int> &nextBrick)
+{
+    // claims come roughly round robin, so this worker's next claims are
+    // about wn and 2 wn bricks ahead; prefetching that far lets the reads
+    // overlap the work in between
+    const int numBricks = NumBricks();
+    const int lookahead = wn * 2;
+    for (int b = wi; b < std::min(lookahead, numBricks); b += wn) {
+        PrefetchBrick(b);
+    }
+    while (true) {
+        const int b = nextBrick++;
+        if (b >= numBricks) {
+            break;
+        }
+        if (b + lookahead < numBricks) {
+            PrefetchBrick(b + lookahead);
+        }
+        UpdateCells(m_BrickStarts[b], m_BrickStarts[b + 1], 1);
+    }
+
+    // cells added by splits since the last renumbering
+    UpdateCells(m_BrickedCells + wi, m_Positions.size(), wn);
+}
+
+template <typename T>
+void Model<T>::PrefetchBrick(const int b) const {
+    const auto cells = [this](const int b, const MappedVector<vec3> &v) {
+        const int i0 = m_BrickStarts[b];
+        const int i1 = m_BrickStarts[b + 1];
+        MappedPrefetch(v.data() + i0, (i1 - i0) * sizeof(vec3));
+    };
+    cells(b, m_Positions);
+    for (const int h : m_BrickHalos[b]) {
+        cells(h, m_Positions);
+    }
+
+    // the outputs are written in full, but a shared mapping still reads
+    // each page before the first write to it
+    cells(b, m_NewPositions);
+    if (m_Compact) {
+        const int i0 = m_BrickStarts[b];
+        const int i1 = m_BrickStarts[b + 1];
+        MappedPrefetch(
+            m_NewPackedNormals.data() + i0, (i1 - i0) * sizeof(uint32_t));
+    } else {
+        cells(b, m_NewNormals);
+    }
+}
+
+template <typename T>
+void Model<T>::Update(ThreadPool &pool, const bool split) {
+    PROFILE_SCOPE("Update");
+
+    // lap returns the seconds since the previous lap, for m_LastUpdate
+    using Clock = std::chrono::steady_clock;
+    auto lapTime = Clock::now();
+    const auto lap = [&lapTime]() {
+        const auto now = Clock::now();
+        const std::chrono::duration<double> elapsed = now - lapTime;
+        lapTime = now;
+        return elapsed.count();
+    };
+    const int numCells = m_Positions.size();
+    const int freeCells = m_FreeCells.size();
+    m_Events.clear();
+
+    {
+        PROFILE_SCOPE("Ensure");
+        if (m_BrickSize > 0 && numCells > m_BrickedCells * 1.1) {
+            Reorder(pool);
+        }
+        Ensure();
+    }
+    m_LastUpdate.Ensure = lap();
+
+    ResizeBuffers();
 
-    auto done = Timed("run workers");
-    for (int wi = 0; wi < wn; wi++) {
-        results[wi] = pool.Add([this, wi, wn]() {
+    const int wn = Workers(pool);
+
+    if (m_BrickSize > 0) {
+        std::atomic<int> nextBrick(0);
+        pool.Run(wn, [this, &nextBrick](const int wi, const int wn) {
+            PROFILE_SCOPE("UpdateBatch");
+            UpdateBricks(wi, wn, nextBrick);
+        });
+    } else {
+        pool.Run(wn, [this](const int wi, const int wn) {
+            PROFILE_SCOPE("UpdateBatch");
             UpdateBatch(wi, wn);
         });
     }
-    for (int wi = 0; wi < wn; wi++) {
-        results[wi].get();
-    }
-    done();
+    m_LastUpdate.Force = lap();
 
     // compute mean position change
-    glm::vec3 sum(0);
-    for (int i = 0; i < m_Positions.size(); i++) {
-        sum += m_NewPositions[i] - m_Positions[i];
+    {
+        PROFILE_SCOPE("Recenter");
+        const bool holes = !m_FreeCells.empty();
+        vec3 sum(0);
+        for (int i = 0; i < m_Positions.size(); i++) {
+            sum += m_NewPositions[i] - m_Positions[i];
+        }
+        const vec3 offset = -sum / static_cast<T>(NumCells());
+        for (int i = 0; i < m_Positions.size(); i++) {
+            if (holes && m_Links[i].empty()) {
+                continue;
+            }
+            m_NewPositions[i] += offset;
+        }
     }
-    const glm::vec3 offset = -sum / (float)m_Positions.size();
+    m_LastUpdate.Recenter = lap();
+
+    pool.Run(wn, [this](const int wi, const int wn) {
+        PROFILE_SCOPE("IndexUpdate");
+        int moves = 0;
+        for (int i = wi; i < m_Positions.size(); i += wn) {
+            moves += m_Index.Update(
+                glm::vec3(m_Positions[i]), glm::vec3(m_NewPositions[i]), i);
+        }
+        PROFILE_COUNT(IndexMoves, moves);
+    });
+    m_LastUpdate.Index = lap();
+
+    // commit; every entry of the buffers was written above, so they can
+    // be swapped in
+    {
+        PROFILE_SCOPE("Commit");
+        m_Positions.swap(m_NewPositions);
+        if (m_Compact) {
+            m_PackedNormals.swap(m_NewPackedNormals);
+            m_NormalsStale = true;
+        } else {
+            m_Normals.swap(m_NewNormals);
+        }
+    }
+    m_LastUpdate.Commit = lap();
+
+    // food only flows when cells may split, like the random feed
+    if (split && m_DiffusionSteps > 0) {
+        PROFILE_SCOPE("Diffuse");
+        Diffuse(pool);
+    }
+    m_LastUpdate.Diffuse = lap();
+
+    // split
+    if (split) {
+        PROFILE_SCOPE("Split");
+        if (m_MaxSplits > 0 || m_MaxSplitSeconds > 0) {
+            SplitScheduled();
+        } else {
+            // children appended during the pass are fed and may split in
+            // the same pass, so the bound is read live
+            const auto startTime = std::chrono::steady_clock::now();
+            for (int i = 0; i < m_Positions.size(); i++) {
+                if (!m_Links[i].empty() && Nourish(i) > m_SplitThreshold) {
+                    Split(i);
+                }
+            }
+            const std::chrono::duration<double> elapsed =
+                std::chrono::steady_clock::now() - startTime;
+            m_SplitQueueDepth = 0;
+            m_SplitLatency = elapsed.count();
+        }
+    }
+    m_LastUpdate.Split = lap();
+    m_LastUpdate.Splits =
+        m_Positions.size() - numCells + freeCells - m_FreeCells.size();
+
+    // death
+    m_LastUpdate.Deaths = 0;
+    if (m_DeathNeighbors > 0 && ++m_UpdatesSinceDeath >= m_DeathEvery) {
+        PROFILE_SCOPE("Death");
+        m_UpdatesSinceDeath = 0;
+        Cull(pool);
+        if (m_FreeCells.size() * 8 > m_Positions.size()) {
+            Defragment(pool);
+        }
+    }
+    m_LastUpdate.Death = lap();
+}
+
+template <typename T>
+MemoryUsages Model<T>::MemoryReport() const {
+    MemoryUsages report;
+    report.push_back(VectorMemory("positions", m_Positions));
+    report.push_back(VectorMemory("normals", m_Normals));
+    report.push_back(VectorMemory("food", m_Food));
+    report.push_back(NestedVectorMemory("links", m_Links));
+    report.push_back(VectorMemory("new_positions", m_NewPositions));
+    report.push_back(VectorMemory("new_normals", m_NewNormals));
+    report.push_back(VectorMemory("packed_normals", m_PackedNormals));
+    report.push_back(VectorMemory("packed_food", m_PackedFood));
+    report.push_back(VectorMemory("new_packed_normals", m_NewPackedNormals));
+    report.push_back(VectorMemory("new_food", m_NewFood));
+    report.push_back(VectorMemory("link_starts", m_LinkStarts));
+    report.push_back(VectorMemory("link_cells", m_LinkCells));
+    report.push_back(VectorMemory("split_queue", m_SplitQueue));
+    report.push_back(VectorMemory("free_cells", m_FreeCells));
+    report.push_back(VectorMemory("brick_starts", m_BrickStarts));
+    report.push_back(NestedVectorMemory("brick_halos", m_BrickHalos));
+    m_Index.MemoryReport(report);
+    return report;
+}
+
+template <typename T>
+double Model<T>::MeanNeighbors() const {
+    uint64_t sum = 0;
     for (int i = 0; i < m_Positions.size(); i++) {
-        m_NewPositions[i] += offset;
+        if (!m_Links[i].empty()) {
+            sum += m_Index.Nearby(glm::vec3(m_Positions[i])).size();
+        }
+    }
+    return static_cast<double>(sum) / NumCells();
+}
+
+template <typename T>
+void Model<T>::SetFastMath(const bool fastMath) {
+    m_FastMath = fastMath;
+}
+
+template <typename T>
+void Model<T>::SetCompact(const bool compact) {
+    if (compact == m_Compact) {
+        return;
     }
+    const int n = m_Positions.size();
+    if (compact) {
+        m_PackedNormals.resize(n);
+        m_PackedFood.resize(n);
+        EncodeNormals(m_Normals.data(), m_PackedNormals.data(), n);
+        EncodeFoods(m_Food.data(), m_PackedFood.data(), n, m_SplitThreshold);
+        MappedVector<vec3>().swap(m_Normals);
+        MappedVector<vec3>().swap(m_NewNormals);
+        MappedVector<T>().swap(m_Food);
+        m_NormalsStale = m_FoodStale = true;
+        m_Compact = true;
+    } else {
+        Unpack();
+        MappedVector<uint32_t>().swap(m_PackedNormals);
+        MappedVector<uint32_t>().swap(m_NewPackedNormals);
+        MappedVector<uint16_t>().swap(m_PackedFood);
+        m_Compact = false;
+    }
+}
 
-    done = Timed("update index");
-    for (int wi = 0; wi < wn; wi++) {
-        results[wi] = pool.Add([this, wi, wn]() {
-            for (int i = wi; i < m_Positions.size(); i += wn) {
-                m_Index.Update(m_Positions[i], m_NewPositions[i], i);
+template <typename T>
+void Model<T>::Unpack() const {
+    const int n = m_Positions.size();
+    if (m_NormalsStale) {
+        m_Normals.resize(n);
+        DecodeNormals(m_PackedNormals.data(), m_Normals.data(), n);
+        m_NormalsStale = false;
+    }
+    if (m_FoodStale) {
+        m_Food.resize(n);
+        DecodeFoods(m_PackedFood.data(), m_Food.data(), n, m_SplitThreshold);
+        m_FoodStale = false;
+    }
+}
+
+template <typename T>
+void Model<T>::ReleaseDecoded() const {
+    if (!m_Compact) {
+        return;
+    }
+    MappedVector<vec3>().swap(m_Normals);
+    MappedVector<T>().swap(m_Food);
+    m_NormalsStale = m_FoodStale = true;
+}
+
+template <typename T>
+void Model<T>::TakeArrays(
+    MappedVector<vec3> *positions,
+    MappedVector<vec3> *normals,
+    MappedVector<T> *food)
+{
+    if (positions) {
+        *positions = std::move(m_Positions);
+        m_Positions = *positions;
+    }
+    if (normals) {
+        *normals = std::move(m_Normals);
+        m_Normals = *normals;
+    }
+    if (food) {
+        *food = std::move(m_Food);
+        m_Food = *food;
+    }
+}
+
+template <typename T>
+void Model<T>::ResizeBuffers() {
+    m_NewPositions.resize(m_Positions.size());
+    if (m_Compact) {
+        m_NewPackedNormals.resize(m_Positions.size());
+    } else {
+        m_NewNormals.resize(m_Positions.size());
+    }
+}
+
+template <typename T>
+T Model<T>::Feed(const int i, const T amount) {
+    if (m_Compact) {
+        const T food = DecodeFood(m_PackedFood[i], m_SplitThreshold) + amount;
+        m_PackedFood[i] = EncodeFood(food, 1 / m_SplitThreshold);
+        m_FoodStale = true;
+        return DecodeFood(m_PackedFood[i], m_SplitThreshold);
+    }
+    return m_Food[i] += amount;
+}
+
+template <typename T>
+T Model<T>::FoodLevel(const int i) const {
+    if (m_Compact) {
+        return DecodeFood(m_PackedFood[i], m_SplitThreshold);
+    }
+    return m_Food[i];
+}
+
+template <typename T>
+void Model<T>::SetFood(const int i, const T food) {
+    if (m_Compact) {
+        m_PackedFood[i] = EncodeFood(food, 1 / m_SplitThreshold);
+        m_FoodStale = true;
+    } else {
+        m_Food[i] = food;
+    }
+}
+
+template <typename T>
+void Model<T>::SetNormal(const int i, const vec3 &normal) {
+    if (m_Compact) {
+        m_PackedNormals[i] = EncodeNormal(normal);
+        m_NormalsStale = true;
+    } else {
+        m_Normals[i] = normal;
+    }
+}
+
+template <typename T>
+T Model<T>::Nourish(const int i) {
+    if (m_DiffusionSteps > 0) {
+        return FoodLevel(i);
+    }
+    return Feed(i, Random(0, 1));
+}
+
+template <typename T>
+void Model<T>::SetDiffusion(
+    const int subSteps, const T rate, const T decay, const FoodSource source)
+{
+    if (subSteps < 0) {
+        Panic("diffusion sub-steps must not be negative");
+    }
+    if (rate < 0 || rate > 1) {
+        Panic("diffusion rate must be in [0, 1]");
+    }
+    if (decay < 0 || decay >= 1) {
+        Panic("diffusion decay must be in [0, 1)");
+    }
+    m_DiffusionSteps = subSteps;
+    m_DiffusionRate = rate;
+    m_DiffusionDecay = decay;
+    m_FoodSource = source;
+    if (subSteps == 0) {
+        std::vector<int>().swap(m_LinkStarts);
+        std::vector<int>().swap(m_LinkCells);
+        MappedVector<T>().swap(m_NewFood);
+    }
+}
+
+template <typename T>
+void Model<T>::Diffuse(ThreadPool &pool) {
+    const int n = m_Positions.size();
+
+    // in compact mode this works on the decoded food, which is packed
+    // again and dropped at the end
+    if (m_FoodStale) {
+        m_Food.resize(n);
+        DecodeFoods(m_PackedFood.data(), m_Food.data(), n, m_SplitThreshold);
+        m_FoodStale = false;
+    }
+
+    // free slots aren't fed; random food is drawn on this thread so that
+    // runs stay reproducible
+    if (m_FoodSource == FoodSource::Random) {
+        for (int i = 0; i < n; i++) {
+            if (!m_Links[i].empty()) {
+                m_Food[i] += Random(0, 1);
+            }
+        }
+    } else {
+        const bool up = m_FoodSource == FoodSource::Up;
+        ParallelFor(pool, n, [this, up](const uint64_t i) {
+            if (m_Links[i].empty()) {
+                return;
             }
+            if (!up) {
+                m_Food[i] += T(0.5);
+                return;
+            }
+            const T z = m_Compact ?
+                DecodeNormal<T>(m_PackedNormals[i]).z : m_Normals[i].z;
+            m_Food[i] += std::max(T(0), z);
         });
     }
-    for (int wi = 0; wi < wn; wi++) {
-        results[wi].get();
+
+    // flatten the rings so the sub-steps stream through two arrays instead
+    // of chasing a pointer per cell
+    m_LinkStarts.resize(n + 1);
+    m_LinkStarts[0] = 0;
+    for (int i = 0; i < n; i++) {
+        m_LinkStarts[i + 1] = m_LinkStarts[i] + m_Links[i].size();
     }
-    done();
+    m_LinkCells.resize(m_LinkStarts[n]);
+    ParallelFor(pool, n, [this](const uint64_t i) {
+        std::copy(m_Links[i].begin(), m_Links[i].end(),
+            m_LinkCells.begin() + m_LinkStarts[i]);
+    });
 
-    // commit
-    done = Timed("commit");
-    m_Positions = m_NewPositions;
-    m_Normals = m_NewNormals;
-    done();
+    // Jacobi sub-steps, double buffered; each one keeps its share of the
+    // food left after decay
+    const T keep = std::pow(1 - m_DiffusionDecay, T(1) / m_DiffusionSteps);
+    m_NewFood.resize(n);
+    const int wn = Workers(pool);
+    for (int step = 0; step < m_DiffusionSteps; step++) {
+        pool.Run(wn, [this, n, keep](const int wi, const int wn) {
+            const int i0 = uint64_t(n) * wi / wn;
+            const int i1 = uint64_t(n) * (wi + 1) / wn;
+            DiffuseCells(i0, i1, keep);
+        });
+        m_Food.swap(m_NewFood);
+    }
 
-    // split
-    if (split) {
-        done = Timed("split");
-        for (int i = 0; i < m_Food.size(); i++) {
-            m_Food[i] += Random(0, 1);
-            if (m_Food[i] > m_SplitThreshold) {
-                Split(i);
+    // a compact model only keeps the packed food between Updates
+    if (m_Compact) {
+        EncodeFoods(m_Food.data(), m_PackedFood.data(), n, m_SplitThreshold);
+        MappedVector<T>().swap(m_Food);
+        MappedVector<T>().swap(m_NewFood);
+        m_FoodStale = true;
+    }
+}
+
+template <typename T>
+void Model<T>::DiffuseCells(const int i0, const int i1, const T keep) {
+    const T rate = m_DiffusionRate;
+    const int *starts = m_LinkStarts.data();
+    const int *cells = m_LinkCells.data();
+    const T *food = m_Food.data();
+    T *next = m_NewFood.data();
+    for (int i = i0; i < i1; i++) {
+        const int j0 = starts[i];
+        const int j1 = starts[i + 1];
+        T sum = 0;
+        for (int j = j0; j < j1; j++) {
+            sum += food[cells[j]];
+        }
+        const T mean = j1 > j0 ? sum / (j1 - j0) : food[i];
+        next[i] = keep * (food[i] + rate * (mean - food[i]));
+    }
+}
+
+template <typename T>
+void Model<T>::SetSplitLimits(const int maxSplits, const double maxSeconds) {
+    m_MaxSplits = maxSplits;
+    m_MaxSplitSeconds = maxSeconds;
+}
+
+template <typename T>
+void Model<T>::SplitScheduled() {
+    const auto startTime = std::chrono::steady_clock::now();
+
+    // feed cells and queue the ones that are ready to split
+    m_SplitQueue.resize(0);
+    for (int i = 0; i < m_Positions.size(); i++) {
+        if (!m_Links[i].empty() && Nourish(i) > m_SplitThreshold) {
+            m_SplitQueue.push_back(i);
+        }
+    }
+
+    // highest food first; cells left over stay above the threshold and
+    // will be queued again on the next update
+    std::sort(m_SplitQueue.begin(), m_SplitQueue.end(),
+        [this](const int a, const int b) {
+            const T foodA = FoodLevel(a);
+            const T foodB = FoodLevel(b);
+            if (foodA != foodB) {
+                return foodA > foodB;
             }
+            return a < b;
+        });
+
+    std::chrono::duration<double> elapsed(0);
+    int count = 0;
+    for (const int i : m_SplitQueue) {
+        if (m_MaxSplits > 0 && count >= m_MaxSplits) {
+            break;
+        }
+        if (m_MaxSplitSeconds > 0 && elapsed.count() >= m_MaxSplitSeconds) {
+            break;
         }
-        done();
+        Split(i);
+        count++;
+        elapsed = std::chrono::steady_clock::now() - startTime;
     }
+    elapsed = std::chrono::steady_clock::now() - startTime;
+
+    m_SplitQueueDepth = m_SplitQueue.size() - count;
+    m_SplitLatency = elapsed.count();
 }
 
-glm::vec3 Model::CellNormal(const int index) const {
+template <typename T>
+typename Model<T>::vec3 Model<T>::CellNormal(const int index) const {
+    switch (ActiveISA()) {
+    case ISA::AVX512: return CellNormalAVX512(index);
+    case ISA::AVX2: return CellNormalAVX2(index);
+    case ISA::SSE42: return CellNormalSSE42(index);
+    default: return CellNormalKernel<false>(index);
+    }
+}
+
+template <typename T>
+typename Model<T>::vec3 Model<T>::CellNormalSSE42(const int index) const {
+    return CellNormalKernel<false>(index);
+}
+
+template <typename T>
+typename Model<T>::vec3 Model<T>::CellNormalAVX2(const int index) const {
+    return CellNormalKernel<false>(index);
+}
+
+template <typename T>
+typename Model<T>::vec3 Model<T>::CellNormalAVX512(const int index) const {
+    return CellNormalKernel<false>(index);
+}
+
+template <typename T>
+template <bool Fast>
+ALWAYS_INLINE typename Model<T>::vec3 Model<T>::CellNormalKernel(
+    const int index) const
+{
     const auto &links = m_Links[index];
-    const glm::vec3 p0 = m_Positions[index];
-    glm::vec3 p1 = m_Positions[links.back()];
-    glm::vec3 N(0);
+    const vec3 p0 = m_Positions[index];
+    vec3 p1 = m_Positions[links.back()];
+    vec3 N(0);
     for (const int i : links) {
-        const glm::vec3 p2 = m_Positions[i];
-        N += glm::triangleNormal(p0, p1, p2);
+        const vec3 p2 = m_Positions[i];
+        if (Fast) {
+            N += Normalize<Fast>(glm::cross(p0 - p1, p0 - p2));
+        } else {
+            N += glm::triangleNormal(p0, p1, p2);
+        }
         p1 = p2;
     }
-    return glm::normalize(N);
+    return Normalize<Fast>(N);
 }
 
-void Model::Split(const int parentIndex) {
+template <typename T>
+void Model<T>::Split(const int parentIndex, const int cleavage) {
+    PROFILE_COUNT(Splits, 1);
 
     const auto changeLink = [this](
         const int i, const int from, const int to)
@@ -279,24 +1360,47 @@ void Model::Split(const int parentIndex) {
         links.insert(it + 1, link);
     };
 
-    // create the child in the same spot as the parent for now
-    const int childIndex = m_Links.size();
-    m_Positions.push_back(m_Positions[parentIndex]);
-    m_Normals.emplace_back(m_Normals[parentIndex]);
-    m_Food.push_back(0);
-    m_Links.emplace_back();
+    // create the child in the same spot as the parent for now, in a slot
+    // freed by a dead cell if there is one
+    int childIndex;
+    if (m_FreeCells.empty()) {
+        childIndex = m_Links.size();
+        m_Positions.push_back(m_Positions[parentIndex]);
+        if (m_Compact) {
+            m_PackedNormals.push_back(m_PackedNormals[parentIndex]);
+            m_PackedFood.push_back(0);
+        } else {
+            m_Normals.emplace_back(m_Normals[parentIndex]);
+            m_Food.push_back(0);
+        }
+        m_Links.emplace_back();
+    } else {
+        childIndex = m_FreeCells.back();
+        m_FreeCells.pop_back();
+        m_Positions[childIndex] = m_Positions[parentIndex];
+        if (m_Compact) {
+            m_PackedNormals[childIndex] = m_PackedNormals[parentIndex];
+            m_PackedFood[childIndex] = 0;
+        } else {
+            m_Normals[childIndex] = m_Normals[parentIndex];
+            m_Food[childIndex] = 0;
+        }
+    }
+    if (m_Compact) {
+        m_NormalsStale = m_FoodStale = true;
+    }
 
     // choose "plane of cleavage"
     const auto links = m_Links[parentIndex];
     const int n = links.size();
-    const int i0 = [&]() {
-        float bestDistance = 1e9;
+    const int i0 = cleavage >= 0 ? cleavage : [&]() {
+        T bestDistance = 1e9;
         int bestIndex = 0;
         for (int i = 0; i < n; i++) {
             const int j = (i + n / 2) % n;
             const auto p0 = m_Positions[links[i]];
             const auto p1 = m_Positions[links[j]];
-            const float d = glm::distance(p0, p1);
+            const T d = glm::distance(p0, p1);
             if (d < bestDistance) {
                 bestDistance = d;
                 bestIndex = i;
@@ -305,6 +1409,9 @@ void Model::Split(const int parentIndex) {
         return bestIndex;
     }();
     const int i1 = i0 + n / 2;
+    if (m_RecordEvents) {
+        m_Events.push_back({CellEvent::Split, parentIndex, i0});
+    }
 
     // update parent links
     auto &parentLinks = m_Links[parentIndex];
@@ -329,44 +1436,257 @@ void Model::Split(const int parentIndex) {
     }
 
     // compute new parent position
-    glm::vec3 newParentPosition(m_Positions[parentIndex]);
+    vec3 newParentPosition(m_Positions[parentIndex]);
     for (const int j : parentLinks) {
         newParentPosition += m_Positions[j];
     }
     newParentPosition /= parentLinks.size() + 1;
 
     // compute new child position
-    glm::vec3 newChildPosition(m_Positions[childIndex]);
+    vec3 newChildPosition(m_Positions[childIndex]);
     for (const int j : childLinks) {
         newChildPosition += m_Positions[j];
     }
     newChildPosition /= childLinks.size() + 1;
 
     // update positions, normals, and index
-    m_Index.Update(m_Positions[parentIndex], newParentPosition, parentIndex);
-    m_Index.Add(newChildPosition, childIndex);
+    m_Index.Update(
+        glm::vec3(m_Positions[parentIndex]), glm::vec3(newParentPosition),
+        parentIndex);
+    m_Index.Add(glm::vec3(newChildPosition), childIndex);
     m_Positions[parentIndex] = newParentPosition;
     m_Positions[childIndex] = newChildPosition;
-    m_Normals[parentIndex] = CellNormal(parentIndex);
-    m_Normals[childIndex] = CellNormal(childIndex);
+    SetNormal(parentIndex, CellNormal(parentIndex));
+    SetNormal(childIndex, CellNormal(childIndex));
 
     // reset parent's food level
-    m_Food[parentIndex] = 0;
+    SetFood(parentIndex, 0);
+}
+
+template <typename T>
+void Model<T>::SetDeath(const int maxNeighbors, const int everyUpdates) {
+    if (maxNeighbors > 0 && everyUpdates <= 0) {
+        Panic("cell death needs a positive interval");
+    }
+    m_DeathNeighbors = maxNeighbors;
+    m_DeathEvery = everyUpdates;
+    m_UpdatesSinceDeath = 0;
 }
 
-std::vector<Triangle> Model::Triangulate() const {
+template <typename T>
+void Model<T>::SetRecordEvents(const bool record) {
+    if (record && m_BrickSize > 0) {
+        Panic("brick scheduling can't be recorded");
+    }
+    m_RecordEvents = record;
+    m_Events.clear();
+}
+
+template <typename T>
+void Model<T>::ApplyEvents(
+    const std::vector<CellEvent> &events, ThreadPool &pool)
+{
+    const auto live = [this](const int i) {
+        return i >= 0 && i < m_Links.size() && !m_Links[i].empty();
+    };
+    for (const CellEvent &e : events) {
+        switch (e.Type) {
+        case CellEvent::Split:
+            if (!live(e.Cell) || e.Cleavage < 0 ||
+                e.Cleavage >= m_Links[e.Cell].size())
+            {
+                Panic("recorded split doesn't fit the model");
+            }
+            Split(e.Cell, e.Cleavage);
+            break;
+        case CellEvent::Death:
+            if (!live(e.Cell) || !Kill(e.Cell)) {
+                Panic("recorded death doesn't fit the model");
+            }
+            break;
+        case CellEvent::Defragment:
+            Defragment(pool);
+            break;
+        }
+    }
+}
+
+template <typename T>
+void Model<T>::Cull(ThreadPool &pool) {
+    const int n = m_Positions.size();
+    const T roi2 = m_RadiusOfInfluence * m_RadiusOfInfluence;
+    const int wn = Workers(pool);
+    std::vector<std::vector<int>> crowded(wn);
+    pool.Run(wn, [&](const int wi, const int wn) {
+        for (int i = wi; i < n; i += wn) {
+            if (m_Links[i].empty()) {
+                continue;
+            }
+            const vec3 P = m_Positions[i];
+            int count = 0;
+            for (const int j : m_Index.Nearby(glm::vec3(P))) {
+                if (j != i && glm::length2(m_Positions[j] - P) < roi2) {
+                    count++;
+                }
+            }
+            if (count > m_DeathNeighbors) {
+                crowded[wi].push_back(i);
+            }
+        }
+    });
+
+    // kill in cell order so that runs stay reproducible
+    std::vector<int> dying;
+    for (const auto &cells : crowded) {
+        dying.insert(dying.end(), cells.begin(), cells.end());
+    }
+    std::sort(dying.begin(), dying.end());
+    std::vector<bool> changed(n, false);
+    int deaths = 0;
+    for (const int i : dying) {
+        if (changed[i]) {
+            continue;
+        }
+        const std::vector<int> ring = m_Links[i];
+        if (!Kill(i)) {
+            continue;
+        }
+        for (const int j : ring) {
+            changed[j] = true;
+        }
+        deaths++;
+    }
+    m_LastUpdate.Deaths = deaths;
+}
+
+template <typename T>
+bool Model<T>::Kill(const int i) {
+    const std::vector<int> ring = m_Links[i];
+    const int n = ring.size();
+    if (NumCells() <= 4) {
+        return false;
+    }
+
+    // collapsing i into ring[a] joins ring[a]'s ring with i's, and the two
+    // cells on either side of the collapsed link lose a link each. That
+    // keeps the surface a manifold if those two are the only cells linked
+    // to both and everyone keeps at least three links.
+    int best = -1;
+    int bestLinks = 0;
+    for (int a = 0; a < n; a++) {
+        const int u = ring[a];
+        const int prev = ring[(a + n - 1) % n];
+        const int next = ring[(a + 1) % n];
+        const int links = m_Links[u].size() + n - 4;
+        if (m_Links[prev].size() <= 3 || m_Links[next].size() <= 3 ||
+            links < 3)
+        {
+            continue;
+        }
+        int common = 0;
+        for (const int j : m_Links[u]) {
+            if (std::find(ring.begin(), ring.end(), j) != ring.end()) {
+                common++;
+            }
+        }
+        if (common != 2) {
+            continue;
+        }
+        if (best < 0 || links < bestLinks) {
+            best = a;
+            bestLinks = links;
+        }
+    }
+    if (best < 0) {
+        return false;
+    }
+
+    // in u's ring, i sits between before and after; replace it with the
+    // cells of i's ring from before to after, walking away from u, which
+    // keeps the ring's orientation
+    const int u = ring[best];
+    auto &uLinks = m_Links[u];
+    const auto it = std::find(uLinks.begin(), uLinks.end(), i);
+    const int p = it - uLinks.begin();
+    const int before = uLinks[(p + uLinks.size() - 1) % uLinks.size()];
+    const int after = uLinks[(p + 1) % uLinks.size()];
+    const int b = std::find(ring.begin(), ring.end(), before) - ring.begin();
+    const int step = ring[(b + 1) % n] == u ? n - 1 : 1;
+    std::vector<int> path;
+    for (int k = (b + step) % n; ring[k] != after; k = (k + step) % n) {
+        path.push_back(ring[k]);
+    }
+    uLinks.erase(it);
+    uLinks.insert(uLinks.begin() + p, path.begin(), path.end());
+
+    // relink the rest of the ring
+    for (const int j : path) {
+        auto &links = m_Links[j];
+        *std::find(links.begin(), links.end(), i) = u;
+    }
+    for (const int j : {before, after}) {
+        auto &links = m_Links[j];
+        links.erase(std::find(links.begin(), links.end(), i));
+    }
+
+    // move u halfway to i and free i's slot
+    const vec3 position = (m_Positions[u] + m_Positions[i]) / T(2);
+    m_Index.Update(
+        glm::vec3(m_Positions[u]), glm::vec3(position), u);
+    m_Index.Remove(glm::vec3(m_Positions[i]), i);
+    m_Positions[u] = position;
+    SetNormal(u, CellNormal(u));
+    SetFood(i, 0);
+    m_Links[i].clear();
+    m_FreeCells.push_back(i);
+    if (m_RecordEvents) {
+        m_Events.push_back({CellEvent::Death, i, 0});
+    }
+    return true;
+}
+
+template <typename T>
+std::vector<Triangle> Model<T>::Triangulate() const {
     std::vector<glm::uvec3> indexes;
     TriangleIndexes(indexes);
     std::vector<Triangle> triangles;
     triangles.reserve(indexes.size());
     for (const auto &i : indexes) {
         triangles.emplace_back(
-            m_Positions[i.x], m_Positions[i.y], m_Positions[i.z]);
+            glm::vec3(m_Positions[i.x]),
+            glm::vec3(m_Positions[i.y]),
+            glm::vec3(m_Positions[i.z]));
     }
     return triangles;
 }
 
-void Model::TriangleIndexes(std::vector<glm::uvec3> &result) const {
+template <typename T>
+void Model<T>::TriangleIndexes(
+    std::vector<glm::uvec3> &result, ThreadPool &pool) const
+{
+    const auto offsets = TriangleOffsets(pool);
+    const uint64_t start = result.size();
+    result.resize(start + offsets.back());
+    ForEachTriangle(pool, offsets,
+        [&result, start](
+            const uint64_t t, const int a, const int b, const int c)
+        {
+            result[start + t] = glm::uvec3(a, b, c);
+        });
+}
+
+template <typename T>
+std::vector<uint64_t> Model<T>::TriangleOffsets(ThreadPool &pool) const {
+    return RingTriangleOffsets(
+        pool, 0, m_Positions.size(),
+        [this](const int i, int &size) {
+            size = m_Links[i].size();
+            return m_Links[i].data();
+        });
+}
+
+template <typename T>
+void Model<T>::TriangleIndexes(std::vector<glm::uvec3> &result) const {
     for (int i = 0; i < m_Positions.size(); i++) {
         const auto &links = m_Links[i];
         for (int j = 0; j < links.size(); j++) {
@@ -380,12 +1700,15 @@ void Model::TriangleIndexes(std::vector<glm::uvec3> &result) const {
     }
 }
 
-void Model::VertexAttributes(std::vector<float> &result) const {
+template <typename T>
+void Model<T>::VertexAttributes(std::vector<float> &result) const {
+    const auto &normals = Normals();
+    const auto &food = Food();
     for (int i = 0; i < m_Positions.size(); i++) {
         const auto &p = m_Positions[i];
-        const auto &n = m_Normals[i];
-        const float value = m_Food[i] / m_SplitThreshold;
-        // const float value = i / (float)(m_Positions.size() - 1);
+        const auto &n = normals[i];
+        const T value = food[i] / m_SplitThreshold;
+        // const T value = i / (T)(m_Positions.size() - 1);
         result.push_back(p.x);
         result.push_back(p.y);
         result.push_back(p.z);
@@ -395,3 +1718,6 @@ void Model::VertexAttributes(std::vector<float> &result) const {
         result.push_back(value);
     }
 }
+
+template class Model<float>;
+template class Model<double>;
@@ -1,89 +1,470 @@
 #pragma once
 
+#include <atomic>
+#include <cstdint>
 #include <glm/glm.hpp>
+#include <string>
 #include <vector>
 
+#include "cpu.h"
 #include "index.h"
+#include "mapped.h"
+#include "memory.h"
 #include "pool.h"
+#include "rings.h"
 #include "triangle.h"
 
+// UpdateStats holds the wall time in seconds of each phase of a
+// Model::Update and the number of cells that split
+struct UpdateStats {
+    double Ensure = 0;
+    double Force = 0;
+    double Recenter = 0;
+    double Index = 0;
+    double Commit = 0;
+    double Diffuse = 0;
+    double Split = 0;
+    double Death = 0;
+    int Splits = 0;
+    int Deaths = 0;
+};
+
+// CellEvent is one change Model::Update made to the topology, in the order
+// it made them: a split of Cell, keeping links Cleavage to Cleavage + n / 2
+// of its n links (see Model::Split), a death of Cell, or a Defragment
+struct CellEvent {
+    enum Kind {
+        Split,
+        Death,
+        Defragment,
+    };
+
+    Kind Type;
+    int Cell;
+    int Cleavage;
+};
+
+// FoodSource is the food each cell takes in per iteration when food
+// diffuses (see Model::SetDiffusion): Random(0, 1) as without diffusion, a
+// constant 0.5, or max(0, normal.z), i.e. light falling from above
+enum class FoodSource {
+    Random,
+    Uniform,
+    Up,
+};
+
+// ParseFoodSource parses "random", "uniform" or "up"
+bool ParseFoodSource(const std::string &name, FoodSource &source);
+
+// Model is templated on its scalar type. float and double are instantiated
+// in model.cpp; double keeps very large forms from drifting far from the
+// origin at the cost of twice the memory traffic.
+template <typename T>
 class Model {
 public:
+    typedef glm::vec<3, T> vec3;
+
     Model(
         const std::vector<Triangle> &triangles,
-        const float splitThreshold,
-        const float linkRestLength,
-        const float radiusOfInfluence,
-        const float repulsionFactor,
-        const float springFactor,
-        const float planarFactor,
-        const float bulgeFactor);
-
-    // getter methods
-    const std::vector<glm::vec3> &Positions() const { return m_Positions; }
-    const std::vector<glm::vec3> &Normals() const { return m_Normals; }
-    const std::vector<float> &Food() const { return m_Food; }
+        const T splitThreshold,
+        const T linkRestLength,
+        const T radiusOfInfluence,
+        const T repulsionFactor,
+        const T springFactor,
+        const T planarFactor,
+        const T bulgeFactor);
+
+    // builds the same cells as the constructor above on the thread pool:
+    // corners are welded by sorting them on their exact position instead
+    // of hashing, so multi-million triangle seed meshes load quickly
+    Model(
+        const std::vector<Triangle> &triangles,
+        ThreadPool &pool,
+        const T splitThreshold,
+        const T linkRestLength,
+        const T radiusOfInfluence,
+        const T repulsionFactor,
+        const T springFactor,
+        const T planarFactor,
+        const T bulgeFactor);
+
+    // restores a model from saved cell state, see checkpoint.h, building
+    // the spatial index on the pool
+    Model(
+        const T splitThreshold,
+        const T linkRestLength,
+        const T radiusOfInfluence,
+        const T repulsionFactor,
+        const T springFactor,
+        const T planarFactor,
+        const T bulgeFactor,
+        MappedVector<vec3> positions,
+        MappedVector<vec3> normals,
+        MappedVector<T> food,
+        std::vector<std::vector<int>> links,
+        ThreadPool &pool);
+
+    // getter methods; in compact mode Normals and Food decode the packed
+    // arrays on first use after they change. The per-cell arrays live in
+    // mapped files when out-of-core storage is enabled (see mapped.h).
+    const MappedVector<vec3> &Positions() const { return m_Positions; }
+    const MappedVector<vec3> &Normals() const {
+        if (m_NormalsStale) {
+            Unpack();
+        }
+        return m_Normals;
+    }
+    const MappedVector<T> &Food() const {
+        if (m_FoodStale) {
+            Unpack();
+        }
+        return m_Food;
+    }
     const std::vector<std::vector<int>> &Links() const { return m_Links; }
-    float SplitThreshold() const { return m_SplitThreshold; }
-    float LinkRestLength() const { return m_LinkRestLength; }
-    float RadiusOfInfluence() const { return m_RadiusOfInfluence; }
-    float RepulsionFactor() const { return m_RepulsionFactor; }
-    float SpringFactor() const { return m_SpringFactor; }
-    float PlanarFactor() const { return m_PlanarFactor; }
-    float BulgeFactor() const { return m_BulgeFactor; }
+
+    // ReleaseDecoded frees the compact mode decode caches, which Normals
+    // and Food rebuild on their next call, so that a compact run only keeps
+    // the packed arrays between exports
+    void ReleaseDecoded() const;
+
+    // TakeArrays moves the position, normal and food arrays into the
+    // non-null arguments and leaves the model copies of them, so that
+    // readers of the old arrays, e.g. Python views, keep them unchanged
+    // through later updates
+    void TakeArrays(
+        MappedVector<vec3> *positions,
+        MappedVector<vec3> *normals,
+        MappedVector<T> *food);
+
+    // the per-cell arrays keep slots freed by cell death until they are
+    // reused or compacted; a free slot has no links. NumCells counts the
+    // live cells.
+    int NumCells() const { return m_Positions.size() - m_FreeCells.size(); }
+    int FreeCells() const { return m_FreeCells.size(); }
+    T SplitThreshold() const { return m_SplitThreshold; }
+    T LinkRestLength() const { return m_LinkRestLength; }
+    T RadiusOfInfluence() const { return m_RadiusOfInfluence; }
+    T RepulsionFactor() const { return m_RepulsionFactor; }
+    T SpringFactor() const { return m_SpringFactor; }
+    T PlanarFactor() const { return m_PlanarFactor; }
+    T BulgeFactor() const { return m_BulgeFactor; }
 
     // Bounds computes the min / max bounds of all cells
-    void Bounds(glm::vec3 &min, glm::vec3 &max) const;
+    void Bounds(vec3 &min, vec3 &max) const;
 
     // Update runs one iteration of simulation using the provided thread pool
     void Update(ThreadPool &pool, const bool split = true);
 
+    // Calibrate measures the thread pool round-trip cost against the per-cell
+    // update cost to find how many cells each worker needs before it pays
+    // for itself. Until it is called, Update always uses every thread.
+    void Calibrate(ThreadPool &pool);
+
+    // Workers returns how many batches Update will use for the current size
+    int Workers(const ThreadPool &pool) const;
+
+    // SetMaxWorkers caps the batches per Update, so that models sharing one
+    // pool interleave instead of each flooding its queue. Zero means no cap.
+    void SetMaxWorkers(const int maxWorkers);
+
+    // SetFastMath switches the force kernel to approximate reciprocal and
+    // reciprocal square root (hardware estimate + one Newton step)
+    void SetFastMath(const bool fastMath);
+    bool FastMath() const { return m_FastMath; }
+
+    // SetCompact switches normals to 32-bit octahedral encoding and food to
+    // 16-bit fixed point relative to the split threshold (see compact.h).
+    // The packed arrays become authoritative and the full precision ones
+    // are freed. Normals only feed the output, so compact mode changes the
+    // simulation only through food rounding, which can shift a split by an
+    // iteration.
+    void SetCompact(const bool compact);
+    bool Compact() const { return m_Compact; }
+
+    // SetDiffusion makes food diffuse along the links. Each Update feeds
+    // every cell from source, then runs subSteps Jacobi steps that move each
+    // cell's food the fraction rate of the way to the mean of its ring and
+    // take off the fraction decay per Update between them. Food is conserved
+    // apart from decay and what splits use up. Zero sub-steps restores the
+    // plain per-cell random feed.
+    void SetDiffusion(
+        const int subSteps, const T rate, const T decay,
+        const FoodSource source);
+    int DiffusionSteps() const { return m_DiffusionSteps; }
+
+    // SetDeath turns on cell death: every everyUpdates Updates, cells with
+    // more than maxNeighbors other cells within the radius of influence,
+    // as in folded or trapped regions, are collapsed into a neighbor. A
+    // cell whose ring changed waits for the next pass, so that a region
+    // thins out instead of vanishing at once. Zero maxNeighbors turns it
+    // off.
+    void SetDeath(const int maxNeighbors, const int everyUpdates);
+
+    // Defragment renumbers the live cells in order, dropping the free
+    // slots, and shrinks the per-cell arrays, buffers and index. Update
+    // calls it once an eighth of the slots are free.
+    void Defragment(ThreadPool &pool);
+
+    // SetRecordEvents makes Update keep the topology changes it makes in
+    // Events, for replay logs (see replay.h). Brick scheduling renumbers
+    // cells by position, so it can't be recorded.
+    void SetRecordEvents(const bool record);
+    const std::vector<CellEvent> &Events() const { return m_Events; }
+
+    // ApplyEvents makes recorded topology changes, after an Update without
+    // splits, and panics if one doesn't fit the model
+    void ApplyEvents(const std::vector<CellEvent> &events, ThreadPool &pool);
+
+    // SetSplitLimits caps how many cells may split per Update and how long
+    // splitting may take, in seconds. Eligible cells that don't fit are
+    // deferred, highest food first. Zero means no limit.
+    void SetSplitLimits(const int maxSplits, const double maxSeconds);
+
+    // SetBrickSize turns on brick scheduling for out-of-core runs. Cells
+    // are renumbered in Morton order of the cubic bricks of this size that
+    // hold them, so each brick is a contiguous range of every per-cell
+    // array, and Update hands whole bricks to the workers in that order,
+    // prefetching the bricks a few claims ahead together with their halo,
+    // the bricks around them that their forces reach into. Cells are
+    // renumbered again once splits have grown the form by a tenth. Zero
+    // turns it off.
+    void SetBrickSize(const T brickSize);
+    T BrickSize() const { return m_BrickSize; }
+    int NumBricks() const {
+        return m_BrickStarts.empty() ? 0 : m_BrickStarts.size() - 1;
+    }
+
+    const UpdateStats &LastUpdate() const { return m_LastUpdate; }
+
+    // spatial hash index, for its occupancy stats
+    const Index &SpatialIndex() const { return m_Index; }
+
+    // MemoryReport walks every structure of the model and its index and
+    // reports what each one uses and reserves (see memory.h)
+    MemoryUsages MemoryReport() const;
+
+    // MeanNeighbors returns the average number of index entries each cell
+    // scans for repulsion; it walks every cell
+    double MeanNeighbors() const;
+
+    // split scheduling stats from the last Update
+    int SplitQueueDepth() const { return m_SplitQueueDepth; }
+    double SplitLatency() const { return m_SplitLatency; }
+
     std::vector<Triangle> Triangulate() const;
 
     void TriangleIndexes(std::vector<glm::uvec3> &result) const;
 
+    void TriangleIndexes(
+        std::vector<glm::uvec3> &result, ThreadPool &pool) const;
+
+    // TriangleOffsets splits the cells into one contiguous batch per thread,
+    // counts the triangles each batch owns and returns their prefix sum; the
+    // last entry is the total number of triangles
+    std::vector<uint64_t> TriangleOffsets(ThreadPool &pool) const;
+
+    // ForEachTriangle calls f(t, a, b, c) in parallel for every triangle,
+    // where t is its position in TriangleIndexes order, so callers can fill
+    // exactly sized outputs in place
+    template <typename F>
+    void ForEachTriangle(
+        ThreadPool &pool, const std::vector<uint64_t> &offsets, F f) const
+    {
+        ForEachRingTriangle(
+            pool, offsets, 0, m_Positions.size(),
+            [this](const int i, int &size) {
+                size = m_Links[i].size();
+                return m_Links[i].data();
+            }, f);
+    }
+
     void VertexAttributes(std::vector<float> &result) const;
 
 private:
+    // the benchmark suite times the private update stages directly
+    friend struct ModelBench;
+
+    // domain decomposed runs update and split local models piecewise
+    template <typename> friend class Domain;
+
     void Ensure();
 
+    // ResizeBuffers sizes the buffers UpdateBatch writes to
+    void ResizeBuffers();
+
+    // Reload replaces the cells of a domain's local model with the next
+    // phase's, keeping the spatial index and moving only the entries of
+    // slots whose position landed in another index cell
+    void Reload(
+        MappedVector<vec3> positions,
+        MappedVector<vec3> normals,
+        MappedVector<T> food,
+        std::vector<std::vector<int>> links,
+        ThreadPool &pool);
+
+    // Unpack refreshes the decoded normal and food caches in compact mode
+    void Unpack() const;
+
+    // per-cell accessors that work in both storage modes; Feed adds food to
+    // a cell and returns its new level
+    T Feed(const int i, const T amount);
+    T FoodLevel(const int i) const;
+    void SetFood(const int i, const T food);
+    void SetNormal(const int i, const vec3 &normal);
+
+    // Nourish feeds cell i its food for this Update and returns its level;
+    // when food diffuses, Diffuse has fed every cell already
+    T Nourish(const int i);
+
+    // Diffuse feeds every live cell from the food source and runs the
+    // diffusion sub-steps on the thread pool
+    void Diffuse(ThreadPool &pool);
+
+    // DiffuseCells runs one sub-step for cells [i0, i1) from m_Food into
+    // m_NewFood
+    void DiffuseCells(const int i0, const int i1, const T keep);
+
+    // UpdateBatch updates every wn-th cell starting at wi
     void UpdateBatch(const int wi, const int wn);
 
-    glm::vec3 CellNormal(const int index) const;
+    // UpdateBricks claims bricks in order from nextBrick until none are
+    // left, then updates its share of the cells added since the last
+    // renumbering
+    void UpdateBricks(
+        const int wi, const int wn, std::atomic<int> &nextBrick);
+
+    // Reorder renumbers the cells into brick order and rebuilds the index
+    void Reorder(ThreadPool &pool);
+
+    // Renumber moves cell keys[i].second to slot i, drops the cells not in
+    // keys, which must be the free slots, renumbers the links and rebuilds
+    // the index
+    void Renumber(
+        const std::vector<std::pair<uint64_t, int>> &keys, ThreadPool &pool);
 
-    void Split(const int i);
+    // Cull finds the crowded cells in parallel and kills them in order
+    void Cull(ThreadPool &pool);
+
+    // Kill collapses cell i into the neighbor that leaves the fewest links,
+    // moving that neighbor halfway to it, and frees its slot. It returns
+    // false if no neighbor can take its place without breaking the
+    // manifold.
+    bool Kill(const int i);
+
+    // PrefetchBrick asks for the pages brick b and its halo will touch
+    void PrefetchBrick(const int b) const;
+
+    // UpdateCells and CellNormal dispatch to a kernel built for ActiveISA();
+    // UpdateCells updates every step-th cell in [i0, i1)
+    void UpdateCells(const int i0, const int i1, const int step);
+    template <bool Fast>
+    void UpdateCellsKernel(const int i0, const int i1, const int step);
+    TARGET_SSE42 void UpdateCellsSSE42(
+        const int i0, const int i1, const int step);
+    TARGET_AVX2 void UpdateCellsAVX2(
+        const int i0, const int i1, const int step);
+    TARGET_AVX512 void UpdateCellsAVX512(
+        const int i0, const int i1, const int step);
+
+    vec3 CellNormal(const int index) const;
+    template <bool Fast>
+    vec3 CellNormalKernel(const int index) const;
+    TARGET_SSE42 vec3 CellNormalSSE42(const int index) const;
+    TARGET_AVX2 vec3 CellNormalAVX2(const int index) const;
+    TARGET_AVX512 vec3 CellNormalAVX512(const int index) const;
+
+    // Split splits cell i along the plane of cleavage that divides its ring
+    // most evenly, or the one starting at link cleavage if it isn't -1
+    void Split(const int i, const int cleavage = -1);
+
+    void SplitScheduled();
 
     // amount of food required for a cell to split
-    float m_SplitThreshold;
+    T m_SplitThreshold;
 
     // preferred distance between linked cells
-    float m_LinkRestLength;
+    T m_LinkRestLength;
 
     // distance at which non-linked cells will repel each other
-    float m_RadiusOfInfluence;
+    T m_RadiusOfInfluence;
 
     // weights
-    float m_RepulsionFactor;
-    float m_SpringFactor;
-    float m_PlanarFactor;
-    float m_BulgeFactor;
+    T m_RepulsionFactor;
+    T m_SpringFactor;
+    T m_PlanarFactor;
+    T m_BulgeFactor;
 
     // position of each cell
-    std::vector<glm::vec3> m_Positions;
+    MappedVector<vec3> m_Positions;
 
-    // normal of each cell
-    std::vector<glm::vec3> m_Normals;
+    // normal of each cell; a decode cache in compact mode
+    mutable MappedVector<vec3> m_Normals;
 
-    // food level of each cell
-    std::vector<float> m_Food;
+    // food level of each cell; a decode cache in compact mode
+    mutable MappedVector<T> m_Food;
 
     // list of indexes of linked cells
     std::vector<std::vector<int>> m_Links;
 
+    // compact mode storage, see SetCompact
+    bool m_Compact = false;
+    MappedVector<uint32_t> m_PackedNormals;
+    MappedVector<uint16_t> m_PackedFood;
+    mutable bool m_NormalsStale = false;
+    mutable bool m_FoodStale = false;
+
+    // minimum cells per worker batch, 0 = always use every thread
+    int m_CellsPerWorker = 0;
+
+    // maximum batches per Update, 0 = every thread
+    int m_MaxWorkers = 0;
+
+    // use approximate math in the force kernel
+    bool m_FastMath = false;
+
+    // split scheduling limits and stats
+    int m_MaxSplits = 0;
+    double m_MaxSplitSeconds = 0;
+    int m_SplitQueueDepth = 0;
+    double m_SplitLatency = 0;
+    std::vector<int> m_SplitQueue;
+
+    // food diffusion, see SetDiffusion. The link rings are flattened into
+    // m_LinkCells, ring i being [m_LinkStarts[i], m_LinkStarts[i + 1]).
+    int m_DiffusionSteps = 0;
+    T m_DiffusionRate = 0;
+    T m_DiffusionDecay = 0;
+    FoodSource m_FoodSource = FoodSource::Random;
+    std::vector<int> m_LinkStarts;
+    std::vector<int> m_LinkCells;
+
+    // cell death, see SetDeath; free slots are reused by Split
+    int m_DeathNeighbors = 0;
+    int m_DeathEvery = 0;
+    int m_UpdatesSinceDeath = 0;
+    std::vector<int> m_FreeCells;
+
+    // topology changes of the last Update, see SetRecordEvents
+    bool m_RecordEvents = false;
+    std::vector<CellEvent> m_Events;
+
+    // brick scheduling, see SetBrickSize. Brick b holds cells
+    // [m_BrickStarts[b], m_BrickStarts[b + 1]); cells from m_BrickedCells
+    // on were added after the last renumbering.
+    T m_BrickSize = 0;
+    int m_BrickedCells = 0;
+    std::vector<int> m_BrickStarts;
+    std::vector<std::vector<int>> m_BrickHalos;
+
+    // phase times of the last Update
+    UpdateStats m_LastUpdate;
+
     // spatial hash index
     Index m_Index;
 
     // buffers
-    std::vector<glm::vec3> m_NewPositions;
-    std::vector<glm::vec3> m_NewNormals;
+    MappedVector<vec3> m_NewPositions;
+    MappedVector<vec3> m_NewNormals;
+    MappedVector<uint32_t> m_NewPackedNormals;
+    MappedVector<T> m_NewFood;
 };
@@ -0,0 +1,170 @@
+#include "ply.h"
+
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <cstring>
+#include <sstream>
+
+#include "rings.h"
+#include "util.h"
+
+using namespace boost::interprocess;
+
+namespace {
+
+const uint64_t VertexSize = 28;
+const uint64_t FaceSize = 13;
+
+std::string Header(const uint64_t numVertices, const uint64_t numFaces) {
+    std::ostringstream stream;
+    stream
+        << "ply\n"
+        << "format binary_little_endian 1.0\n"
+        << "element vertex " << numVertices << "\n"
+        << "property float x\n"
+        << "property float y\n"
+        << "property float z\n"
+        << "property float nx\n"
+        << "property float ny\n"
+        << "property float nz\n"
+        << "property float food\n"
+        << "element face " << numFaces << "\n"
+        << "property list uchar uint vertex_indices\n"
+        << "end_header\n";
+    return stream.str();
+}
+
+template <typename T>
+void WriteVertices(
+    uint8_t *dst, const uint64_t n,
+    const glm::vec<3, T> *positions,
+    const glm::vec<3, T> *normals,
+    const T *food,
+    ThreadPool &pool)
+{
+    pool.Run(pool.NumThreads(), [&](const int wi, const int wn) {
+        const uint64_t i0 = n * wi / wn;
+        const uint64_t i1 = n * (wi + 1) / wn;
+        for (uint64_t i = i0; i < i1; i++) {
+            const float record[7] = {
+                float(positions[i].x), float(positions[i].y),
+                float(positions[i].z), float(normals[i].x),
+                float(normals[i].y), float(normals[i].z),
+                float(food[i])};
+            memcpy(dst + i * VertexSize, record, VertexSize);
+        }
+    });
+}
+
+void WriteFace(uint8_t *dst, const glm::uvec3 &face) {
+    dst[0] = 3;
+    memcpy(dst + 1, &face, 12);
+}
+
+}
+
+template <typename T>
+uint64_t SaveBinaryPLY(
+    const std::string &path,
+    const std::vector<glm::vec<3, T>> &positions,
+    const std::vector<glm::vec<3, T>> &normals,
+    const std::vector<T> &food,
+    const std::vector<glm::uvec3> &indexes,
+    ThreadPool &pool)
+{
+    const std::string header = Header(positions.size(), indexes.size());
+    const uint64_t vertexStart = header.size();
+    const uint64_t faceStart = vertexStart + positions.size() * VertexSize;
+    const uint64_t numBytes = faceStart + indexes.size() * FaceSize;
+    CreateFile(path, numBytes);
+
+    file_mapping fm(path.c_str(), read_write);
+    mapped_region mr(fm, read_write);
+    uint8_t *dst = (uint8_t *)mr.get_address();
+
+    memcpy(dst, header.data(), header.size());
+    WriteVertices(
+        dst + vertexStart, positions.size(), positions.data(),
+        normals.data(), food.data(), pool);
+
+    // each batch fills a contiguous range of faces
+    pool.Run(pool.NumThreads(), [&](const int wi, const int wn) {
+        const uint64_t i0 = indexes.size() * wi / wn;
+        const uint64_t i1 = indexes.size() * (wi + 1) / wn;
+        for (uint64_t i = i0; i < i1; i++) {
+            WriteFace(dst + faceStart + i * FaceSize, indexes[i]);
+        }
+    });
+    return numBytes;
+}
+
+template <typename T>
+uint64_t SaveBinaryPLY(
+    const std::string &path,
+    const std::vector<glm::vec<3, T>> &positions,
+    const std::vector<glm::vec<3, T>> &normals,
+    const std::vector<T> &food,
+    const std::vector<int> &linkOffsets,
+    const std::vector<int> &linkIds,
+    ThreadPool &pool)
+{
+    const int n = positions.size();
+    const auto ring = [&linkOffsets, &linkIds](const int i, int &size) {
+        size = linkOffsets[i + 1] - linkOffsets[i];
+        return linkIds.data() + linkOffsets[i];
+    };
+    const auto offsets = RingTriangleOffsets(pool, 0, n, ring);
+    const std::string header = Header(n, offsets.back());
+    const uint64_t vertexStart = header.size();
+    const uint64_t faceStart = vertexStart + n * VertexSize;
+    const uint64_t numBytes = faceStart + offsets.back() * FaceSize;
+    CreateFile(path, numBytes);
+
+    file_mapping fm(path.c_str(), read_write);
+    mapped_region mr(fm, read_write);
+    uint8_t *dst = (uint8_t *)mr.get_address();
+
+    memcpy(dst, header.data(), header.size());
+    WriteVertices(
+        dst + vertexStart, n, positions.data(), normals.data(), food.data(),
+        pool);
+    ForEachRingTriangle(pool, offsets, 0, n, ring,
+        [dst, faceStart](
+            const uint64_t t, const int a, const int b, const int c)
+        {
+            WriteFace(dst + faceStart + t * FaceSize, glm::uvec3(a, b, c));
+        });
+    return numBytes;
+}
+
+template uint64_t SaveBinaryPLY(
+    const std::string &path,
+    const std::vector<glm::vec<3, float>> &positions,
+    const std::vector<glm::vec<3, float>> &normals,
+    const std::vector<float> &food,
+    const std::vector<glm::uvec3> &indexes,
+    ThreadPool &pool);
+template uint64_t SaveBinaryPLY(
+    const std::string &path,
+    const std::vector<glm::vec<3, double>> &positions,
+    const std::vector<glm::vec<3, double>> &normals,
+    const std::vector<double> &food,
+    const std::vector<glm::uvec3> &indexes,
+    ThreadPool &pool);
+
+template uint64_t SaveBinaryPLY(
+    const std::string &path,
+    const std::vector<glm::vec<3, float>> &positions,
+    const std::vector<glm::vec<3, float>> &normals,
+    const std::vector<float> &food,
+    const std::vector<int> &linkOffsets,
+    const std::vector<int> &linkIds,
+    ThreadPool &pool);
+template uint64_t SaveBinaryPLY(
+    const std::string &path,
+    const std::vector<glm::vec<3, double>> &positions,
+    const std::vector<glm::vec<3, double>> &normals,
+    const std::vector<double> &food,
+    const std::vector<int> &linkOffsets,
+    const std::vector<int> &linkIds,
+    ThreadPool &pool);
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <string>
+#include <vector>
+
+#include "pool.h"
+
+// SaveBinaryPLY writes an indexed little-endian binary PLY with float
+// position, normal and food per vertex and uint triangle indexes. That is
+// 28 bytes per vertex plus 13 per face, about a third of the equivalent STL
+// triangle soup. The file is sized up front, memory-mapped and filled in
+// parallel chunks on the pool. Both return the size of the file.
+template <typename T>
+uint64_t SaveBinaryPLY(
+    const std::string &path,
+    const std::vector<glm::vec<3, T>> &positions,
+    const std::vector<glm::vec<3, T>> &normals,
+    const std::vector<T> &food,
+    const std::vector<glm::uvec3> &indexes,
+    ThreadPool &pool);
+
+// SaveBinaryPLY with flattened link rings (ring i is linkIds[linkOffsets[i]]
+// to linkIds[linkOffsets[i + 1]]) writes the faces straight from the rings
+// (see rings.h), without building an index vector first
+template <typename T>
+uint64_t SaveBinaryPLY(
+    const std::string &path,
+    const std::vector<glm::vec<3, T>> &positions,
+    const std::vector<glm::vec<3, T>> &normals,
+    const std::vector<T> &food,
+    const std::vector<int> &linkOffsets,
+    const std::vector<int> &linkIds,
+    ThreadPool &pool);
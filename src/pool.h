@@ -1,6 +1,8 @@
 #pragma once
 
+#include <algorithm>
 #include <condition_variable>
+#include <cstdint>
 #include <functional>
 #include <future>
 #include <mutex>
@@ -73,6 +75,23 @@ public:
         return result;
     }
 
+    // Run calls f(wi, wn) for each wi in [0, wn) and waits for all of them.
+    // Batch 0 runs on the calling thread, so wn == 1 never touches the pool.
+    template<class F>
+    void Run(const int wn, F f) {
+        std::vector<std::future<void>> results;
+        results.reserve(wn);
+        for (int wi = 1; wi < wn; wi++) {
+            results.push_back(Add([&f, wi, wn]() {
+                f(wi, wn);
+            }));
+        }
+        f(0, std::max(wn, 1));
+        for (auto &result : results) {
+            result.get();
+        }
+    }
+
 private:
     std::vector<std::thread> m_Threads;
     std::queue<std::function<void()>> m_Queue;
@@ -80,3 +99,15 @@ private:
     std::condition_variable m_Condition;
     bool m_Stop;
 };
+
+// ParallelFor calls f(i) for i in [0, n) in one contiguous batch per thread
+template <typename F>
+void ParallelFor(ThreadPool &pool, const uint64_t n, F f) {
+    pool.Run(pool.NumThreads(), [n, &f](const int wi, const int wn) {
+        const uint64_t i0 = n * wi / wn;
+        const uint64_t i1 = n * (wi + 1) / wn;
+        for (uint64_t i = i0; i < i1; i++) {
+            f(i);
+        }
+    });
+}
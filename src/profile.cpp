@@ -0,0 +1,190 @@
+#include "profile.h"
+
+#ifdef PROFILE
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "util.h"
+
+namespace {
+
+// events kept per thread
+const uint64_t RingSize = 1 << 16;
+
+const int NumCounters = static_cast<int>(ProfileCounter::NumCounters);
+
+const char *CounterNames[NumCounters] = {
+    "neighbors_scanned",
+    "neighbors_accepted",
+    "index_moves",
+    "splits",
+};
+
+// Event is a timed scope, or a counter sample if Name is null
+struct Event {
+    const char *Name;
+    uint64_t Start;
+    uint64_t End;
+    uint64_t Counts[NumCounters];
+};
+
+// Ring is one thread's event buffer and counter slots. Only the owning
+// thread writes to it; Head is published with release so a reader sees
+// every event before it.
+struct Ring {
+    int Thread;
+    std::vector<Event> Events;
+    std::atomic<uint64_t> Head;
+    std::atomic<uint64_t> Counts[NumCounters];
+
+    Ring(const int thread) : Thread(thread), Events(RingSize), Head(0) {
+        for (auto &count : Counts) {
+            count.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    void Push(const Event &event) {
+        const uint64_t head = Head.load(std::memory_order_relaxed);
+        Events[head % RingSize] = event;
+        Head.store(head + 1, std::memory_order_release);
+    }
+};
+
+const auto StartTime = std::chrono::steady_clock::now();
+
+// rings of every thread that has recorded anything, kept alive after their
+// threads exit so their events still get saved
+std::mutex RingsMutex;
+std::vector<std::shared_ptr<Ring>> Rings;
+
+// counter totals at the last sample
+std::mutex SampleMutex;
+uint64_t SampledCounts[NumCounters];
+
+Ring &ThreadRing() {
+    thread_local std::shared_ptr<Ring> ring;
+    if (!ring) {
+        std::lock_guard<std::mutex> guard(RingsMutex);
+        ring = std::make_shared<Ring>(Rings.size());
+        Rings.push_back(ring);
+    }
+    return *ring;
+}
+
+}
+
+uint64_t ProfileNow() {
+    const std::chrono::duration<uint64_t, std::nano> elapsed =
+        std::chrono::steady_clock::now() - StartTime;
+    return elapsed.count();
+}
+
+void ProfileRecord(const char *name, const uint64_t start, const uint64_t end) {
+    Event event;
+    event.Name = name;
+    event.Start = start;
+    event.End = end;
+    ThreadRing().Push(event);
+}
+
+void ProfileCount(const ProfileCounter counter, const uint64_t n) {
+    // only this thread writes its slot, so no atomic add is needed
+    auto &count = ThreadRing().Counts[static_cast<int>(counter)];
+    count.store(
+        count.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+void ProfileSample() {
+    uint64_t totals[NumCounters] = {0};
+    {
+        std::lock_guard<std::mutex> guard(RingsMutex);
+        for (const auto &ring : Rings) {
+            for (int i = 0; i < NumCounters; i++) {
+                totals[i] += ring->Counts[i].load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    Event event;
+    event.Name = nullptr;
+    event.Start = event.End = ProfileNow();
+    {
+        std::lock_guard<std::mutex> guard(SampleMutex);
+        for (int i = 0; i < NumCounters; i++) {
+            event.Counts[i] = totals[i] - SampledCounts[i];
+            SampledCounts[i] = totals[i];
+        }
+    }
+    ThreadRing().Push(event);
+}
+
+void SaveProfile(const std::string &path) {
+    std::vector<std::shared_ptr<Ring>> rings;
+    {
+        std::lock_guard<std::mutex> guard(RingsMutex);
+        rings = Rings;
+    }
+
+    std::ofstream file(path);
+    if (!file) {
+        Panic("failed to create " + path);
+    }
+
+    // timestamps are in microseconds
+    file << std::fixed << std::setprecision(3);
+    file << "{\"traceEvents\":[\n";
+    bool first = true;
+    const auto separator = [&file, &first]() {
+        if (!first) {
+            file << ",\n";
+        }
+        first = false;
+    };
+    for (const auto &ring : rings) {
+        separator();
+        file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+            << "\"tid\":" << ring->Thread << ",\"args\":{\"name\":\""
+            << (ring->Thread == 0 ? "main" : "thread " +
+                std::to_string(ring->Thread)) << "\"}}";
+
+        // copy out the live part of the ring, then drop whatever the owner
+        // may have overwritten while it was being copied
+        const uint64_t head = ring->Head.load(std::memory_order_acquire);
+        const uint64_t begin = head > RingSize ? head - RingSize : 0;
+        std::vector<Event> events;
+        for (uint64_t i = begin; i < head; i++) {
+            events.push_back(ring->Events[i % RingSize]);
+        }
+        const uint64_t after = ring->Head.load(std::memory_order_acquire);
+        const uint64_t valid = after > RingSize ? after - RingSize : 0;
+
+        for (uint64_t i = std::max(begin, valid); i < head; i++) {
+            const Event &e = events[i - begin];
+            separator();
+            if (e.Name) {
+                file << "{\"name\":\"" << e.Name << "\",\"ph\":\"X\","
+                    << "\"pid\":1,\"tid\":" << ring->Thread << ","
+                    << "\"ts\":" << e.Start / 1000.0 << ","
+                    << "\"dur\":" << (e.End - e.Start) / 1000.0 << "}";
+            } else {
+                file << "{\"name\":\"counters\",\"ph\":\"C\",\"pid\":1,"
+                    << "\"ts\":" << e.Start / 1000.0 << ",\"args\":{";
+                for (int j = 0; j < NumCounters; j++) {
+                    file << (j ? "," : "") << "\"" << CounterNames[j] << "\":"
+                        << e.Counts[j];
+                }
+                file << "}}";
+            }
+        }
+    }
+    file << "\n]}\n";
+}
+
+#endif
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// The profiler records nested phase timings and event counters with very
+// little overhead. It is compiled out unless built with -D PROFILE
+// (make profile), in which case the macros below expand to nothing.
+//
+// PROFILE_SCOPE("name") times the rest of the enclosing block on the
+// calling thread. name must be a string literal. Each thread appends to its
+// own fixed size ring buffer, so recording takes no locks; when a ring is
+// full the oldest events are overwritten.
+//
+// PROFILE_COUNT(counter, n) adds n to a counter in the calling thread's
+// slot. PROFILE_SAMPLE() records how much each counter grew, summed over
+// all threads, since the last sample; call it once per iteration.
+//
+// PROFILE_SAVE("profile.json") writes the recorded events in Chrome trace
+// format, for chrome://tracing or ui.perfetto.dev. It may run while other
+// threads record; events they overwrite during the save are dropped.
+
+enum class ProfileCounter {
+    NeighborsScanned,
+    NeighborsAccepted,
+    IndexMoves,
+    Splits,
+    NumCounters,
+};
+
+#ifdef PROFILE
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_SCOPE(name) \
+    ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(name)
+#define PROFILE_COUNT(counter, n) ProfileCount(ProfileCounter::counter, n)
+#define PROFILE_SAMPLE() ProfileSample()
+#define PROFILE_SAVE(path) SaveProfile(path)
+
+// ProfileNow returns nanoseconds since the profiler started
+uint64_t ProfileNow();
+
+void ProfileRecord(const char *name, const uint64_t start, const uint64_t end);
+
+void ProfileCount(const ProfileCounter counter, const uint64_t n);
+
+void ProfileSample();
+
+void SaveProfile(const std::string &path);
+
+class ProfileScope {
+public:
+    ProfileScope(const char *name) : m_Name(name), m_Start(ProfileNow()) {}
+
+    ~ProfileScope() {
+        ProfileRecord(m_Name, m_Start, ProfileNow());
+    }
+
+private:
+    const char *m_Name;
+    uint64_t m_Start;
+};
+
+#else
+
+#define PROFILE_SCOPE(name)
+#define PROFILE_COUNT(counter, n) ((void)(n))
+#define PROFILE_SAMPLE()
+#define PROFILE_SAVE(path)
+
+#endif
@@ -0,0 +1,252 @@
+#include "replay.h"
+
+#include <cstring>
+#include <iostream>
+
+#include "exporter.h"
+#include "pool.h"
+#include "util.h"
+#include "varint.h"
+
+namespace {
+
+const char Magic[8] = {'C', 'E', 'L', 'L', 'L', 'O', 'G', '1'};
+const uint32_t Version = 1;
+
+struct Header {
+    char Magic[8];
+    uint32_t Version;
+    uint32_t ScalarSize;
+    uint32_t Seed;
+    uint32_t FastMath;
+    uint64_t NumTriangles;
+    double SplitThreshold;
+    double LinkRestLength;
+    double RadiusOfInfluence;
+    double RepulsionFactor;
+    double SpringFactor;
+    double PlanarFactor;
+    double BulgeFactor;
+};
+
+}
+
+ReplayWriter::ReplayWriter(
+    const std::string &path, const std::vector<Triangle> &triangles,
+    const Settings &settings, const int scalarSize) :
+    m_Path(path),
+    m_File(path, std::ios::binary | std::ios::trunc),
+    m_Iteration(0),
+    m_LastBlock(0),
+    m_BytesWritten(0)
+{
+    if (!m_File) {
+        Panic("failed to create " + path);
+    }
+
+    Header header;
+    memcpy(header.Magic, Magic, 8);
+    header.Version = Version;
+    header.ScalarSize = scalarSize;
+    header.Seed = settings.Seed;
+    header.FastMath = settings.FastMath;
+    header.NumTriangles = triangles.size();
+    header.SplitThreshold = settings.SplitThreshold;
+    header.LinkRestLength = settings.LinkRestLength;
+    header.RadiusOfInfluence = settings.RadiusOfInfluence;
+    header.RepulsionFactor = settings.RepulsionFactor;
+    header.SpringFactor = settings.SpringFactor;
+    header.PlanarFactor = settings.PlanarFactor;
+    header.BulgeFactor = settings.BulgeFactor;
+    m_File.write((const char *)&header, sizeof(header));
+
+    std::vector<float> vertices;
+    vertices.reserve(triangles.size() * 9);
+    for (const auto &t : triangles) {
+        for (const glm::vec3 &v : {t.A(), t.B(), t.C()}) {
+            vertices.insert(vertices.end(), {v.x, v.y, v.z});
+        }
+    }
+    m_File.write(
+        (const char *)vertices.data(), vertices.size() * sizeof(float));
+    m_BytesWritten = sizeof(header) + vertices.size() * sizeof(float);
+    m_File.flush();
+}
+
+ReplayWriter::~ReplayWriter() {
+    Flush();
+}
+
+template <typename T>
+void ReplayWriter::Update(const Model<T> &model, const uint64_t iteration) {
+    m_Iteration = iteration;
+    const auto &events = model.Events();
+    if (events.empty()) {
+        return;
+    }
+    WriteVarint(m_Buffer, iteration - m_LastBlock);
+    WriteVarint(m_Buffer, events.size());
+    for (const CellEvent &e : events) {
+        WriteVarint(m_Buffer, uint64_t(e.Cell) << 2 | e.Type);
+        if (e.Type == CellEvent::Split) {
+            WriteVarint(m_Buffer, e.Cleavage);
+        }
+    }
+    m_LastBlock = iteration;
+
+    // keep the buffer small; a write of this size costs little
+    if (m_Buffer.size() >= 1 << 20) {
+        Flush();
+    }
+}
+
+void ReplayWriter::Flush() {
+    if (m_LastBlock < m_Iteration) {
+        WriteVarint(m_Buffer, m_Iteration - m_LastBlock);
+        WriteVarint(m_Buffer, 0);
+        m_LastBlock = m_Iteration;
+    }
+    m_File.write((const char *)m_Buffer.data(), m_Buffer.size());
+    m_File.flush();
+    if (!m_File) {
+        Panic("failed to write " + m_Path);
+    }
+    m_BytesWritten += m_Buffer.size();
+    m_Buffer.clear();
+}
+
+ReplayLog::ReplayLog(const std::string &path) :
+    m_Path(path),
+    m_LastIteration(0),
+    m_Offset(0),
+    m_Iteration(0)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        Panic("failed to open " + path);
+    }
+    Header header;
+    if (!file.read((char *)&header, sizeof(header))) {
+        Panic("truncated replay log: " + path);
+    }
+    if (memcmp(header.Magic, Magic, 8) != 0) {
+        Panic("not a replay log: " + path);
+    }
+    if (header.Version != Version) {
+        Panic("unsupported replay log version: " + path);
+    }
+    m_ScalarSize = header.ScalarSize;
+    m_Seed = header.Seed;
+    m_Params.Seed = header.Seed;
+    m_Params.FastMath = header.FastMath != 0;
+    m_Params.SplitThreshold = header.SplitThreshold;
+    m_Params.LinkRestLength = header.LinkRestLength;
+    m_Params.RadiusOfInfluence = header.RadiusOfInfluence;
+    m_Params.RepulsionFactor = header.RepulsionFactor;
+    m_Params.SpringFactor = header.SpringFactor;
+    m_Params.PlanarFactor = header.PlanarFactor;
+    m_Params.BulgeFactor = header.BulgeFactor;
+
+    std::vector<float> vertices(header.NumTriangles * 9);
+    if (!file.read(
+        (char *)vertices.data(), vertices.size() * sizeof(float)))
+    {
+        Panic("truncated replay log: " + path);
+    }
+    m_Triangles.reserve(header.NumTriangles);
+    for (size_t i = 0; i < vertices.size(); i += 9) {
+        const float *v = vertices.data() + i;
+        m_Triangles.emplace_back(
+            glm::vec3(v[0], v[1], v[2]),
+            glm::vec3(v[3], v[4], v[5]),
+            glm::vec3(v[6], v[7], v[8]));
+    }
+
+    m_Blocks.assign(
+        std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+
+    // walk the blocks once to find where the log ends
+    uint64_t iteration;
+    std::vector<CellEvent> events;
+    while (Next(iteration, events)) {
+        m_LastIteration = iteration;
+    }
+    Rewind();
+}
+
+bool ReplayLog::Next(uint64_t &iteration, std::vector<CellEvent> &events) {
+    events.clear();
+    if (m_Offset >= m_Blocks.size()) {
+        return false;
+    }
+    uint64_t delta = 0, count = 0;
+    if (!ReadVarint(m_Blocks, m_Offset, delta) ||
+        !ReadVarint(m_Blocks, m_Offset, count))
+    {
+        Panic("truncated replay log: " + m_Path);
+    }
+    for (uint64_t i = 0; i < count; i++) {
+        uint64_t value, cleavage = 0;
+        if (!ReadVarint(m_Blocks, m_Offset, value)) {
+            Panic("truncated replay log: " + m_Path);
+        }
+        const auto kind = CellEvent::Kind(value & 3);
+        if (kind == CellEvent::Split &&
+            !ReadVarint(m_Blocks, m_Offset, cleavage))
+        {
+            Panic("truncated replay log: " + m_Path);
+        }
+        if (kind > CellEvent::Defragment) {
+            Panic("corrupt replay log: " + m_Path);
+        }
+        events.push_back({kind, int(value >> 2), int(cleavage)});
+    }
+    m_Iteration += delta;
+    iteration = m_Iteration;
+    return true;
+}
+
+void ReplayLog::Rewind() {
+    m_Offset = 0;
+    m_Iteration = 0;
+}
+
+template <typename T>
+void Replay(ReplayLog &log, const Settings &settings, uint64_t iteration) {
+    if (iteration == 0 || iteration > log.LastIteration()) {
+        iteration = log.LastIteration();
+    }
+    std::cout << "replaying " << iteration << " of " << log.LastIteration()
+        << " iterations" << std::endl;
+
+    ThreadPool pool;
+    Model<T> model = MakeModel<T>(log.Triangles(), log.Params(), pool);
+    model.Calibrate(pool);
+    Exporter exporter(settings.ExportPattern, settings.ExportIterations, 0, 0);
+    exporter.SetDecimation(settings.Decimate);
+
+    log.Rewind();
+    uint64_t next;
+    std::vector<CellEvent> events;
+    bool more = log.Next(next, events);
+    for (uint64_t i = 1; i <= iteration; i++) {
+        model.Update(pool, false);
+        if (more && next == i) {
+            model.ApplyEvents(events, pool);
+            more = log.Next(next, events);
+        }
+        exporter.Update(model, i, i == iteration);
+    }
+    exporter.Wait();
+    std::cout << "replayed to " << model.NumCells() << " cells" << std::endl;
+}
+
+template void ReplayWriter::Update(
+    const Model<float> &model, const uint64_t iteration);
+template void ReplayWriter::Update(
+    const Model<double> &model, const uint64_t iteration);
+
+template void Replay<float>(
+    ReplayLog &log, const Settings &settings, uint64_t iteration);
+template void Replay<double>(
+    ReplayLog &log, const Settings &settings, uint64_t iteration);
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "model.h"
+#include "settings.h"
+#include "triangle.h"
+
+// A replay log archives a run as its parameters, random seed and seed mesh
+// plus the topology changes each iteration made, so that any frame can be
+// regenerated by simulating up to it (see Replay) instead of being kept.
+// Forces are recomputed and only the splits and deaths are read back, so
+// the topology replays exactly and positions match the original run to
+// rounding; the index visits neighbors in an order that depends on thread
+// timing.
+//
+// The file is a fixed header and the seed triangles, followed by one block
+// per iteration that changed the topology:
+//
+//   varint  iterations since the previous block
+//   varint  number of events
+//   events  varint cell << 2 | kind, then varint cleavage for splits
+//
+// A block without events marks how far the run got. A split in a form of
+// a million cells takes five bytes.
+
+// ReplayWriter appends a run's blocks to a log, buffering them in memory
+// between flushes
+class ReplayWriter {
+public:
+    ReplayWriter(
+        const std::string &path, const std::vector<Triangle> &triangles,
+        const Settings &settings, const int scalarSize);
+
+    // the destructor flushes
+    ~ReplayWriter();
+
+    // Update records the events of the model's last Update, which must have
+    // been recording them (see Model::SetRecordEvents)
+    template <typename T>
+    void Update(const Model<T> &model, const uint64_t iteration);
+
+    // Flush writes the buffered blocks and marks the log as reaching the
+    // last iteration passed to Update
+    void Flush();
+
+    uint64_t BytesWritten() const { return m_BytesWritten; }
+
+private:
+    std::string m_Path;
+    std::ofstream m_File;
+    std::vector<uint8_t> m_Buffer;
+    uint64_t m_Iteration;
+    uint64_t m_LastBlock;
+    uint64_t m_BytesWritten;
+};
+
+// ReplayLog reads a log back into memory
+class ReplayLog {
+public:
+    ReplayLog(const std::string &path);
+
+    int ScalarSize() const { return m_ScalarSize; }
+    unsigned int Seed() const { return m_Seed; }
+
+    // the model parameters and fast math flag of the run
+    const Settings &Params() const { return m_Params; }
+
+    const std::vector<Triangle> &Triangles() const { return m_Triangles; }
+
+    // the last iteration the log reaches
+    uint64_t LastIteration() const { return m_LastIteration; }
+
+    // Next reads the next block, returning false at the end of the log
+    bool Next(uint64_t &iteration, std::vector<CellEvent> &events);
+
+    // Rewind goes back to the first block
+    void Rewind();
+
+private:
+    std::string m_Path;
+    int m_ScalarSize;
+    unsigned int m_Seed;
+    Settings m_Params;
+    std::vector<Triangle> m_Triangles;
+    std::vector<uint8_t> m_Blocks;
+    uint64_t m_LastIteration;
+    size_t m_Offset;
+    uint64_t m_Iteration;
+};
+
+// Replay simulates a logged run up to iteration, or to the end of the log
+// if it is 0. Frames are written with the settings' export pattern and
+// iteration cadence, and the last one regardless.
+template <typename T>
+void Replay(ReplayLog &log, const Settings &settings, uint64_t iteration);
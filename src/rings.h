@@ -0,0 +1,73 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "pool.h"
+
+// Link rings are triangulated by letting each cell own the triangle it
+// forms with every pair of consecutive links when it has the lowest id of
+// the three, so every triangle is visited exactly once. These walk the
+// rings of cells [i0, i1) in parallel for any ring storage: ring(i, size)
+// returns a pointer to the links of cell i and sets size to their count.
+
+// RingTriangleOffsets splits the cells into one contiguous batch per thread,
+// counts the triangles each batch owns and returns their prefix sum; the
+// last entry is the total number of triangles
+template <typename R>
+std::vector<uint64_t> RingTriangleOffsets(
+    ThreadPool &pool, const int i0, const int i1, R ring)
+{
+    const int n = i1 - i0;
+    const int wn = std::max(1, std::min(n, pool.NumThreads()));
+    std::vector<uint64_t> offsets(wn + 1, 0);
+    pool.Run(wn, [i0, n, &ring, &offsets](const int wi, const int wn) {
+        const int j0 = i0 + uint64_t(n) * wi / wn;
+        const int j1 = i0 + uint64_t(n) * (wi + 1) / wn;
+        uint64_t count = 0;
+        for (int i = j0; i < j1; i++) {
+            int size;
+            const int *links = ring(i, size);
+            for (int j = 0; j < size; j++) {
+                const int link0 = links[j];
+                const int link1 = links[(j + 1) % size];
+                if (i < link0 && i < link1) {
+                    count++;
+                }
+            }
+        }
+        offsets[wi + 1] = count;
+    });
+    for (int wi = 0; wi < wn; wi++) {
+        offsets[wi + 1] += offsets[wi];
+    }
+    return offsets;
+}
+
+// ForEachRingTriangle calls f(t, a, b, c) in parallel for every triangle of
+// cells [i0, i1), where t counts from 0 in cell order, using the batches of
+// RingTriangleOffsets over the same cells
+template <typename R, typename F>
+void ForEachRingTriangle(
+    ThreadPool &pool, const std::vector<uint64_t> &offsets,
+    const int i0, const int i1, R ring, F f)
+{
+    const int n = i1 - i0;
+    pool.Run(offsets.size() - 1, [&](const int wi, const int wn) {
+        uint64_t t = offsets[wi];
+        const int j0 = i0 + uint64_t(n) * wi / wn;
+        const int j1 = i0 + uint64_t(n) * (wi + 1) / wn;
+        for (int i = j0; i < j1; i++) {
+            int size;
+            const int *links = ring(i, size);
+            for (int j = 0; j < size; j++) {
+                const int link0 = links[j];
+                const int link1 = links[(j + 1) % size];
+                if (i < link0 && i < link1) {
+                    f(t++, i, link0, link1);
+                }
+            }
+        }
+    });
+}
@@ -0,0 +1,362 @@
+#include "series.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "util.h"
+#include "varint.h"
+
+namespace {
+
+const char Magic[8] = {'C', 'E', 'L', 'L', 'S', 'E', 'R', '1'};
+const uint32_t Version = 1;
+
+struct Header {
+    char Magic[8];
+    uint32_t Version;
+    float Step;
+};
+
+enum FrameKind {
+    Keyframe,
+    DeltaFrame,
+    AbsoluteFrame,
+};
+
+bool ReadHeader(FILE *file, Header &header) {
+    return fread(&header, sizeof(header), 1, file) == 1 &&
+        memcmp(header.Magic, Magic, 8) == 0 && header.Version == Version;
+}
+
+uint64_t FileSize(FILE *file) {
+    fseek(file, 0, SEEK_END);
+    return ftell(file);
+}
+
+// WritePositions codes q[i0, n) against the cell before each, or against
+// the origin for cell 0
+void WritePositions(
+    std::vector<uint8_t> &buffer, const std::vector<glm::ivec3> &q,
+    const int i0)
+{
+    glm::ivec3 previous = i0 > 0 ? q[i0 - 1] : glm::ivec3(0);
+    for (int i = i0; i < q.size(); i++) {
+        const glm::ivec3 d = q[i] - previous;
+        WriteSignedVarint(buffer, d.x);
+        WriteSignedVarint(buffer, d.y);
+        WriteSignedVarint(buffer, d.z);
+        previous = q[i];
+    }
+}
+
+void WriteRing(
+    std::vector<uint8_t> &buffer, const int i, const int *links, const int n)
+{
+    WriteVarint(buffer, n);
+    for (int j = 0; j < n; j++) {
+        WriteSignedVarint(buffer, int64_t(links[j]) - i);
+    }
+}
+
+}
+
+SeriesWriter::SeriesWriter(
+    const std::string &path, const SeriesOptions &options) :
+    m_Path(path),
+    m_Options(options),
+    m_Frames(0),
+    m_SinceKeyframe(0)
+{
+    // an existing series keeps its step and its index
+    Header header;
+    FILE *existing = fopen(path.c_str(), "rb");
+    if (existing) {
+        const bool empty = FileSize(existing) == 0;
+        fseek(existing, 0, SEEK_SET);
+        if (!empty && !ReadHeader(existing, header)) {
+            Panic("not a series: " + path);
+        }
+        fclose(existing);
+        if (!empty) {
+            m_Options.Step = header.Step;
+        }
+    }
+
+    m_File = fopen(path.c_str(), "ab");
+    m_Index = fopen((path + ".idx").c_str(), "ab");
+    if (!m_File || !m_Index) {
+        Panic("failed to open " + path);
+    }
+    m_Offset = FileSize(m_File);
+    if (m_Offset == 0) {
+        memcpy(header.Magic, Magic, 8);
+        header.Version = Version;
+        header.Step = m_Options.Step;
+        fwrite(&header, sizeof(header), 1, m_File);
+        m_Offset = sizeof(header);
+    }
+    m_Frames = FileSize(m_Index) / sizeof(SeriesIndexEntry);
+}
+
+SeriesWriter::~SeriesWriter() {
+    fclose(m_File);
+    fclose(m_Index);
+}
+
+uint64_t SeriesWriter::Append(
+    const uint64_t iteration,
+    const std::vector<glm::vec3> &positions,
+    const std::vector<int> &linkOffsets,
+    const std::vector<int> &linkIds)
+{
+    const int n = positions.size();
+    const float scale = 1 / m_Options.Step;
+    m_NewQuantized.resize(n);
+    for (int i = 0; i < n; i++) {
+        m_NewQuantized[i] = glm::ivec3(glm::round(positions[i] * scale));
+    }
+
+    // keyframe
+    m_Key.clear();
+    WriteVarint(m_Key, Keyframe);
+    WriteVarint(m_Key, n);
+    WritePositions(m_Key, m_NewQuantized, 0);
+    for (int i = 0; i < n; i++) {
+        WriteRing(m_Key, i, linkIds.data() + linkOffsets[i],
+            linkOffsets[i + 1] - linkOffsets[i]);
+    }
+
+    // delta against the previous frame, if there is one and it is time
+    m_Delta.clear();
+    const int previous = m_Quantized.size();
+    if (previous > 0 && m_SinceKeyframe + 1 < m_Options.KeyframeEvery) {
+        const bool delta = m_Options.DeltaPositions;
+        WriteVarint(m_Delta, delta ? DeltaFrame : AbsoluteFrame);
+        WriteVarint(m_Delta, n);
+        if (delta) {
+            const int common = std::min(n, previous);
+            for (int i = 0; i < common; i++) {
+                const glm::ivec3 d = m_NewQuantized[i] - m_Quantized[i];
+                WriteSignedVarint(m_Delta, d.x);
+                WriteSignedVarint(m_Delta, d.y);
+                WriteSignedVarint(m_Delta, d.z);
+            }
+            WritePositions(m_Delta, m_NewQuantized, common);
+        } else {
+            WritePositions(m_Delta, m_NewQuantized, 0);
+        }
+
+        std::vector<int> changed;
+        for (int i = 0; i < n; i++) {
+            const int k = linkOffsets[i + 1] - linkOffsets[i];
+            if (i >= previous ||
+                k != m_LinkOffsets[i + 1] - m_LinkOffsets[i] ||
+                !std::equal(
+                    linkIds.begin() + linkOffsets[i],
+                    linkIds.begin() + linkOffsets[i + 1],
+                    m_LinkIds.begin() + m_LinkOffsets[i]))
+            {
+                changed.push_back(i);
+            }
+        }
+        WriteVarint(m_Delta, changed.size());
+        int last = 0;
+        for (const int i : changed) {
+            WriteVarint(m_Delta, i - last);
+            WriteRing(m_Delta, i, linkIds.data() + linkOffsets[i],
+                linkOffsets[i + 1] - linkOffsets[i]);
+            last = i;
+        }
+    }
+
+    const bool keyframe = m_Delta.empty() || m_Delta.size() >= m_Key.size();
+    const std::vector<uint8_t> &frame = keyframe ? m_Key : m_Delta;
+    if (fwrite(frame.data(), 1, frame.size(), m_File) != frame.size()) {
+        Panic("failed to write " + m_Path);
+    }
+    fflush(m_File);
+
+    // the index entry goes last, so a reader never sees a partial frame
+    SeriesIndexEntry entry;
+    entry.Iteration = iteration;
+    entry.Offset = m_Offset;
+    entry.Size = frame.size();
+    entry.Cells = n;
+    entry.Keyframe = keyframe;
+    fwrite(&entry, sizeof(entry), 1, m_Index);
+    fflush(m_Index);
+    m_Offset += frame.size();
+    m_Frames++;
+    m_SinceKeyframe = keyframe ? 0 : m_SinceKeyframe + 1;
+
+    m_Quantized.swap(m_NewQuantized);
+    m_LinkOffsets = linkOffsets;
+    m_LinkIds = linkIds;
+    return frame.size() + sizeof(entry);
+}
+
+SeriesReader::SeriesReader(const std::string &path) :
+    m_Path(path),
+    m_Frame(-1)
+{
+    m_File = fopen(path.c_str(), "rb");
+    if (!m_File) {
+        Panic("failed to open " + path);
+    }
+    Header header;
+    if (!ReadHeader(m_File, header)) {
+        Panic("not a series: " + path);
+    }
+    m_Step = header.Step;
+
+    FILE *index = fopen((path + ".idx").c_str(), "rb");
+    if (!index) {
+        Panic("failed to open " + path + ".idx");
+    }
+    m_Entries.resize(FileSize(index) / sizeof(SeriesIndexEntry));
+    fseek(index, 0, SEEK_SET);
+    const size_t read = fread(
+        m_Entries.data(), sizeof(SeriesIndexEntry), m_Entries.size(), index);
+    fclose(index);
+    if (read != m_Entries.size()) {
+        Panic("failed to read " + path + ".idx");
+    }
+}
+
+SeriesReader::~SeriesReader() {
+    fclose(m_File);
+}
+
+uint64_t SeriesReader::Iteration(const int frame) const {
+    return m_Entries[frame].Iteration;
+}
+
+void SeriesReader::Read(
+    const int frame,
+    std::vector<glm::vec3> &positions,
+    std::vector<std::vector<int>> &links)
+{
+    if (frame < 0 || frame >= m_Entries.size()) {
+        Panic("no such frame in " + m_Path);
+    }
+
+    // decode forward from the last keyframe unless the state is already
+    // on the way there
+    int start = frame;
+    while (!m_Entries[start].Keyframe) {
+        start--;
+    }
+    if (m_Frame < start || m_Frame > frame) {
+        Decode(start);
+    }
+    while (m_Frame < frame) {
+        Decode(m_Frame + 1);
+    }
+
+    positions.resize(m_Quantized.size());
+    for (int i = 0; i < positions.size(); i++) {
+        positions[i] = glm::vec3(m_Quantized[i]) * m_Step;
+    }
+    links = m_Links;
+}
+
+std::vector<Triangle> SeriesReader::Triangles(const int frame) {
+    std::vector<glm::vec3> positions;
+    std::vector<std::vector<int>> links;
+    Read(frame, positions, links);
+
+    // same rule as Model::TriangleIndexes
+    std::vector<Triangle> triangles;
+    for (int i = 0; i < links.size(); i++) {
+        const auto &ring = links[i];
+        for (int j = 0; j < ring.size(); j++) {
+            const int link0 = ring[j];
+            const int link1 = ring[(j + 1) % ring.size()];
+            if (i < link0 && i < link1) {
+                triangles.emplace_back(
+                    positions[i], positions[link0], positions[link1]);
+            }
+        }
+    }
+    return triangles;
+}
+
+void SeriesReader::Decode(const int frame) {
+    const SeriesIndexEntry &entry = m_Entries[frame];
+    m_Buffer.resize(entry.Size);
+    fseek(m_File, entry.Offset, SEEK_SET);
+    if (fread(m_Buffer.data(), 1, entry.Size, m_File) != entry.Size) {
+        Panic("truncated series: " + m_Path);
+    }
+
+    size_t offset = 0;
+    const auto next = [this, &offset]() {
+        uint64_t value = 0;
+        if (!ReadVarint(m_Buffer, offset, value)) {
+            Panic("truncated series frame: " + m_Path);
+        }
+        return value;
+    };
+    const auto nextSigned = [this, &offset]() {
+        int64_t value = 0;
+        if (!ReadSignedVarint(m_Buffer, offset, value)) {
+            Panic("truncated series frame: " + m_Path);
+        }
+        return value;
+    };
+    const auto nextVector = [&nextSigned]() {
+        const int x = nextSigned();
+        const int y = nextSigned();
+        const int z = nextSigned();
+        return glm::ivec3(x, y, z);
+    };
+    const auto readRing = [&](const int i) {
+        auto &ring = m_Links[i];
+        ring.resize(next());
+        for (int &j : ring) {
+            j = i + nextSigned();
+        }
+    };
+
+    const uint64_t kind = next();
+    const int n = next();
+    if (kind != Keyframe && m_Frame != frame - 1) {
+        Panic("series delta frame decoded out of order");
+    }
+    const int common = std::min<int>(n, m_Quantized.size());
+    m_Quantized.resize(n);
+    m_Links.resize(n);
+
+    // positions
+    int i0 = 0;
+    if (kind == DeltaFrame) {
+        for (int i = 0; i < common; i++) {
+            m_Quantized[i] += nextVector();
+        }
+        i0 = common;
+    }
+    glm::ivec3 previous = i0 > 0 ? m_Quantized[i0 - 1] : glm::ivec3(0);
+    for (int i = i0; i < n; i++) {
+        m_Quantized[i] = previous + nextVector();
+        previous = m_Quantized[i];
+    }
+
+    // links
+    if (kind == Keyframe) {
+        for (int i = 0; i < n; i++) {
+            readRing(i);
+        }
+    } else {
+        const int changed = next();
+        int i = 0;
+        for (int k = 0; k < changed; k++) {
+            i += next();
+            if (i >= n) {
+                Panic("corrupt series frame: " + m_Path);
+            }
+            readRing(i);
+        }
+    }
+    m_Frame = frame;
+}
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <glm/glm.hpp>
+#include <string>
+#include <vector>
+
+#include "triangle.h"
+
+// A series is an append-only file of frames of one run, much smaller than
+// a file per frame because consecutive frames share nearly all of their
+// topology. Positions are quantized to a grid of SeriesOptions::Step. A
+// keyframe stores every position and link ring; any other frame stores
+// each position as its change since the previous frame and only the link
+// rings that changed. The file starts with a 16 byte header holding the
+// step. Each frame is a run of varints, signed ones zigzag coded: its kind
+// and cell count, then
+//
+//   keyframe  per cell: x, y, z, each relative to the previous cell
+//             per cell: ring size, then each link relative to the cell
+//   delta     per cell: x, y, z relative to the same cell in the previous
+//             frame, or to the previous cell for cells that are new
+//             number of changed rings, then per changed ring: cell
+//             relative to the previous changed cell, ring size and links
+//
+// A sidecar index, path + ".idx", holds one fixed size record per frame
+// with its iteration, offset, size, cell count and kind, so a reader can
+// seek to any frame: it decodes forward from the keyframe at or before it.
+
+// SeriesIndexEntry is one record of the sidecar index
+struct SeriesIndexEntry {
+    uint64_t Iteration;
+    uint64_t Offset;
+    uint64_t Size;
+    uint32_t Cells;
+    uint32_t Keyframe;
+};
+
+struct SeriesOptions {
+    // quantization step of the positions
+    float Step = 1.0f / 8192;
+
+    // the most frames between keyframes; a frame is also written as a
+    // keyframe when that is smaller, e.g. after the cells were renumbered
+    int KeyframeEvery = 32;
+
+    // code positions against the previous frame; otherwise every frame
+    // stores absolute positions and only the rings are delta coded
+    bool DeltaPositions = true;
+};
+
+// SeriesWriter appends frames to a series, creating it if it doesn't exist.
+// The first frame it appends is a keyframe. An existing series keeps its
+// quantization step.
+class SeriesWriter {
+public:
+    SeriesWriter(
+        const std::string &path,
+        const SeriesOptions &options = SeriesOptions());
+
+    ~SeriesWriter();
+
+    // Append adds a frame from positions and link rings flattened as offsets
+    // + ids, and returns the bytes it took
+    uint64_t Append(
+        const uint64_t iteration,
+        const std::vector<glm::vec3> &positions,
+        const std::vector<int> &linkOffsets,
+        const std::vector<int> &linkIds);
+
+    int Frames() const { return m_Frames; }
+
+private:
+    std::string m_Path;
+    SeriesOptions m_Options;
+    FILE *m_File;
+    FILE *m_Index;
+    uint64_t m_Offset;
+    int m_Frames;
+    int m_SinceKeyframe;
+
+    // the previous frame, to code the next one against
+    std::vector<glm::ivec3> m_Quantized;
+    std::vector<int> m_LinkOffsets;
+    std::vector<int> m_LinkIds;
+
+    // reusable buffers
+    std::vector<glm::ivec3> m_NewQuantized;
+    std::vector<uint8_t> m_Key;
+    std::vector<uint8_t> m_Delta;
+};
+
+// SeriesReader decodes the frames of a series. Reading frames in order
+// decodes each one once; a jump decodes forward from the nearest keyframe.
+class SeriesReader {
+public:
+    SeriesReader(const std::string &path);
+
+    ~SeriesReader();
+
+    int Frames() const { return m_Entries.size(); }
+
+    uint64_t Iteration(const int frame) const;
+
+    // Read decodes a frame into positions and link rings
+    void Read(
+        const int frame,
+        std::vector<glm::vec3> &positions,
+        std::vector<std::vector<int>> &links);
+
+    // Triangles decodes a frame and returns its triangles
+    std::vector<Triangle> Triangles(const int frame);
+
+private:
+    // Decode applies frame on top of the current state
+    void Decode(const int frame);
+
+    std::string m_Path;
+    FILE *m_File;
+    float m_Step;
+    std::vector<SeriesIndexEntry> m_Entries;
+
+    // state after decoding frame m_Frame, -1 = none
+    int m_Frame;
+    std::vector<glm::ivec3> m_Quantized;
+    std::vector<std::vector<int>> m_Links;
+    std::vector<uint8_t> m_Buffer;
+};
@@ -0,0 +1,105 @@
+#include "settings.h"
+
+#include "util.h"
+
+void RandomizeSettings(
+    Settings &settings, const std::vector<Triangle> &triangles)
+{
+    const float averageEdgeLength = [&triangles]() {
+        float sum = 0;
+        for (const auto &t : triangles) {
+            sum += glm::distance(t.A(), t.B());
+            sum += glm::distance(t.B(), t.C());
+            sum += glm::distance(t.C(), t.A());
+        }
+        return sum / (triangles.size() * 3);
+    }();
+
+    settings.SplitThreshold = 1000;
+    settings.LinkRestLength = averageEdgeLength;
+    settings.RadiusOfInfluence = Random(
+        settings.LinkRestLength, settings.LinkRestLength * 5);
+    settings.RepulsionFactor = Random(0, 0.1);
+    settings.SpringFactor = Random(0, 0.1);
+    settings.PlanarFactor = Random(0, 0.1);
+    settings.BulgeFactor = Random(0, 0.1);
+}
+
+bool SetSetting(
+    Settings &settings, const std::string &key, const std::string &value)
+{
+    Settings &s = settings;
+    if (key == "SplitThreshold") {
+        s.SplitThreshold = std::stof(value);
+    } else if (key == "LinkRestLength") {
+        s.LinkRestLength = std::stof(value);
+    } else if (key == "RadiusOfInfluence") {
+        s.RadiusOfInfluence = std::stof(value);
+    } else if (key == "RepulsionFactor") {
+        s.RepulsionFactor = std::stof(value);
+    } else if (key == "SpringFactor") {
+        s.SpringFactor = std::stof(value);
+    } else if (key == "PlanarFactor") {
+        s.PlanarFactor = std::stof(value);
+    } else if (key == "BulgeFactor") {
+        s.BulgeFactor = std::stof(value);
+    } else if (key == "Double") {
+        s.Double = std::stoi(value) != 0;
+    } else if (key == "FastMath") {
+        s.FastMath = std::stoi(value) != 0;
+    } else if (key == "Compact") {
+        s.Compact = std::stoi(value) != 0;
+    } else if (key == "DiffusionSteps") {
+        s.DiffusionSteps = std::stoi(value);
+    } else if (key == "DiffusionRate") {
+        s.DiffusionRate = std::stof(value);
+    } else if (key == "DiffusionDecay") {
+        s.DiffusionDecay = std::stof(value);
+    } else if (key == "FoodSource") {
+        if (!ParseFoodSource(value, s.Source)) {
+            return false;
+        }
+    } else if (key == "DeathNeighbors") {
+        s.DeathNeighbors = std::stoi(value);
+    } else if (key == "DeathEvery") {
+        s.DeathEvery = std::stoi(value);
+    } else if (key == "MaxSplitsPerUpdate") {
+        s.MaxSplitsPerUpdate = std::stoi(value);
+    } else if (key == "SplitTimeBudget") {
+        s.SplitTimeBudget = std::stod(value);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+template <typename T>
+Model<T> MakeModel(
+    const std::vector<Triangle> &triangles, const Settings &settings,
+    ThreadPool &pool)
+{
+    Model<T> model(
+        triangles, pool,
+        settings.SplitThreshold, settings.LinkRestLength,
+        settings.RadiusOfInfluence, settings.RepulsionFactor,
+        settings.SpringFactor, settings.PlanarFactor, settings.BulgeFactor);
+    model.SetSplitLimits(
+        settings.MaxSplitsPerUpdate, settings.SplitTimeBudget);
+    model.SetFastMath(settings.FastMath);
+    model.SetCompact(settings.Compact);
+    model.SetDiffusion(
+        settings.DiffusionSteps, settings.DiffusionRate,
+        settings.DiffusionDecay, settings.Source);
+    model.SetDeath(settings.DeathNeighbors, settings.DeathEvery);
+    if (!settings.OutOfCoreDirectory.empty()) {
+        model.SetBrickSize(settings.RadiusOfInfluence * settings.BrickSize);
+    }
+    return model;
+}
+
+template Model<float> MakeModel(
+    const std::vector<Triangle> &triangles, const Settings &settings,
+    ThreadPool &pool);
+template Model<double> MakeModel(
+    const std::vector<Triangle> &triangles, const Settings &settings,
+    ThreadPool &pool);
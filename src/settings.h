@@ -0,0 +1,99 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "decimate.h"
+#include "model.h"
+#include "pool.h"
+#include "triangle.h"
+
+// Settings holds the model parameters and run options chosen in main
+struct Settings {
+    float SplitThreshold;
+    float LinkRestLength;
+    float RadiusOfInfluence;
+    float RepulsionFactor;
+    float SpringFactor;
+    float PlanarFactor;
+    float BulgeFactor;
+
+    // limits on split work per iteration, 0 = unlimited
+    int MaxSplitsPerUpdate = 0;
+    double SplitTimeBudget = 0;
+
+    // simulate in double precision instead of float
+    bool Double = false;
+
+    // approximate math in the force kernel
+    bool FastMath = false;
+
+    // quantized normal and food storage (see Model::SetCompact)
+    bool Compact = false;
+
+    // food diffusion along links, 0 sub-steps = plain random feed (see
+    // Model::SetDiffusion)
+    int DiffusionSteps = 0;
+    float DiffusionRate = 0.5;
+    float DiffusionDecay = 0;
+    FoodSource Source = FoodSource::Random;
+
+    // cell death: cells with more than DeathNeighbors cells within the
+    // radius of influence die, checked every DeathEvery iterations, 0 =
+    // disabled (see Model::SetDeath)
+    int DeathNeighbors = 0;
+    int DeathEvery = 10;
+
+    // out-of-core storage directory, empty = in memory, and the brick size
+    // in multiples of RadiusOfInfluence (see mapped.h, Model::SetBrickSize)
+    std::string OutOfCoreDirectory;
+    float BrickSize = 10;
+
+    // processes to split the form across, see domain.h
+    int Ranks = 1;
+
+    // headless export filename pattern (.stl or .ply) and cadence,
+    // 0 = disabled (see exporter.h)
+    std::string ExportPattern = "out%08d.stl";
+    int ExportIterations = 1000;
+    double ExportSeconds = 0;
+    uint64_t ExportBytes = 0;
+
+    // preview decimation of the headless STL and PLY frames, disabled by
+    // default (see decimate.h)
+    DecimateOptions Decimate;
+
+    // seed of the run's random draws, and the replay log to record the run
+    // to, empty = disabled (see replay.h)
+    unsigned int Seed = 0;
+    std::string RecordPath;
+
+    // headless checkpoint file and cadence in iterations, 0 = disabled (see
+    // checkpoint.h)
+    std::string CheckpointPath = "checkpoint.bin";
+    int CheckpointIterations = 1000;
+
+    // headless metrics file (.jsonl or .prom) and window in iterations,
+    // empty = disabled (see metrics.h)
+    std::string MetricsPath;
+    int MetricsIterations = 100;
+};
+
+// RandomizeSettings sets the link rest length to the average edge length of
+// the seed triangles and draws the other model parameters at random, using
+// the calling thread's generator
+void RandomizeSettings(
+    Settings &settings, const std::vector<Triangle> &triangles);
+
+// SetSetting sets a model parameter or run option by its field name, e.g.
+// SplitThreshold, Double, FastMath or FoodSource, from its text value,
+// returning false if the key is unknown. Sweeps and the Python bindings take
+// these.
+bool SetSetting(
+    Settings &settings, const std::string &key, const std::string &value);
+
+template <typename T>
+Model<T> MakeModel(
+    const std::vector<Triangle> &triangles, const Settings &settings,
+    ThreadPool &pool);
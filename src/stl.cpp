@@ -2,10 +2,30 @@
 
 #include <boost/interprocess/file_mapping.hpp>
 #include <boost/interprocess/mapped_region.hpp>
-#include <fstream>
+#include <cstring>
+
+#include "util.h"
 
 using namespace boost::interprocess;
 
+namespace {
+
+void WriteRecord(uint8_t *dst, const Triangle &t) {
+    const glm::vec3 normal = t.Normal();
+    memcpy(dst + 0, &normal, 12);
+    memcpy(dst + 12, &t.A(), 12);
+    memcpy(dst + 24, &t.B(), 12);
+    memcpy(dst + 36, &t.C(), 12);
+}
+
+void Finish(mapped_region &mr, const STLOptions &options) {
+    if (options.Sync) {
+        mr.flush(0, 0, false);
+    }
+}
+
+}
+
 std::vector<Triangle> LoadBinarySTL(std::string path) {
     file_mapping fm(path.c_str(), read_only);
     mapped_region mr(fm, read_only);
@@ -34,31 +54,143 @@ std::vector<Triangle> LoadBinarySTL(std::string path) {
 
 void SaveBinarySTL(std::string path, const std::vector<Triangle> &triangles) {
     const uint64_t numBytes = uint64_t(triangles.size()) * 50 + 84;
+    CreateFile(path, numBytes);
 
-    {
-        file_mapping::remove(path.c_str());
-        std::filebuf fbuf;
-        fbuf.open(path.c_str(),
-            std::ios_base::in | std::ios_base::out | std::ios_base::trunc |
-            std::ios_base::binary);
-        fbuf.pubseekoff(numBytes - 1, std::ios_base::beg);
-        fbuf.sputc(0);
+    file_mapping fm(path.c_str(), read_write);
+    mapped_region mr(fm, read_write);
+    uint8_t *dst = (uint8_t *)mr.get_address();
+
+    const uint32_t count = triangles.size();
+    memcpy(dst + 80, &count, 4);
+
+    for (uint32_t i = 0; i < triangles.size(); i++) {
+        WriteRecord(dst + 84 + uint64_t(i) * 50, triangles[i]);
     }
+}
+
+void SaveBinarySTL(
+    std::string path, const std::vector<Triangle> &triangles,
+    ThreadPool &pool, const STLOptions &options)
+{
+    const uint64_t numBytes = uint64_t(triangles.size()) * 50 + 84;
+    CreateFile(path, numBytes);
 
     file_mapping fm(path.c_str(), read_write);
     mapped_region mr(fm, read_write);
+    if (options.Sequential) {
+        mr.advise(mapped_region::advice_sequential);
+    }
     uint8_t *dst = (uint8_t *)mr.get_address();
 
     const uint32_t count = triangles.size();
     memcpy(dst + 80, &count, 4);
 
-    for (uint32_t i = 0; i < triangles.size(); i++) {
-        const Triangle &t = triangles[i];
-        const glm::vec3 normal = t.Normal();
-        const uint64_t idx = 84 + i * 50;
-        memcpy(dst + idx + 0, &normal, 12);
-        memcpy(dst + idx + 12, &t.A(), 12);
-        memcpy(dst + idx + 24, &t.B(), 12);
-        memcpy(dst + idx + 36, &t.C(), 12);
+    pool.Run(pool.NumThreads(), [&triangles, dst](const int wi, const int wn) {
+        const uint64_t i0 = triangles.size() * wi / wn;
+        const uint64_t i1 = triangles.size() * (wi + 1) / wn;
+        for (uint64_t i = i0; i < i1; i++) {
+            WriteRecord(dst + 84 + i * 50, triangles[i]);
+        }
+    });
+
+    Finish(mr, options);
+}
+
+template <typename T>
+void SaveBinarySTL(
+    std::string path, const Model<T> &model,
+    ThreadPool &pool, const STLOptions &options)
+{
+    const auto &positions = model.Positions();
+    const auto offsets = model.TriangleOffsets(pool);
+    const uint64_t numTriangles = offsets.back();
+    const uint64_t numBytes = numTriangles * 50 + 84;
+    CreateFile(path, numBytes);
+
+    file_mapping fm(path.c_str(), read_write);
+    mapped_region mr(fm, read_write);
+    if (options.Sequential) {
+        mr.advise(mapped_region::advice_sequential);
+    }
+    uint8_t *dst = (uint8_t *)mr.get_address();
+
+    const uint32_t count = numTriangles;
+    memcpy(dst + 80, &count, 4);
+
+    model.ForEachTriangle(pool, offsets,
+        [&positions, dst](
+            const uint64_t t, const int a, const int b, const int c)
+        {
+            const Triangle triangle(
+                glm::vec3(positions[a]),
+                glm::vec3(positions[b]),
+                glm::vec3(positions[c]));
+            WriteRecord(dst + 84 + t * 50, triangle);
+        });
+
+    Finish(mr, options);
+}
+
+template void SaveBinarySTL(
+    std::string path, const Model<float> &model,
+    ThreadPool &pool, const STLOptions &options);
+template void SaveBinarySTL(
+    std::string path, const Model<double> &model,
+    ThreadPool &pool, const STLOptions &options);
+
+STLWriter::STLWriter(const std::string &path) :
+    m_Path(path),
+    m_File(fopen(path.c_str(), "wb")),
+    m_Count(0)
+{
+    if (!m_File) {
+        Panic("failed to create " + path);
+    }
+    const uint8_t header[84] = {0};
+    if (fwrite(header, 1, 84, m_File) != 84) {
+        Panic("failed to write " + path);
+    }
+}
+
+STLWriter::~STLWriter() {
+    Close();
+}
+
+void STLWriter::Write(
+    const std::vector<Triangle> &triangles, ThreadPool &pool)
+{
+    if (!m_File) {
+        Panic("write to closed STLWriter: " + m_Path);
+    }
+    m_Buffer.resize(triangles.size() * 50);
+    uint8_t *dst = m_Buffer.data();
+    pool.Run(pool.NumThreads(), [&triangles, dst](const int wi, const int wn) {
+        const uint64_t i0 = triangles.size() * wi / wn;
+        const uint64_t i1 = triangles.size() * (wi + 1) / wn;
+        for (uint64_t i = i0; i < i1; i++) {
+            WriteRecord(dst + i * 50, triangles[i]);
+        }
+    });
+    if (fwrite(dst, 1, m_Buffer.size(), m_File) != m_Buffer.size()) {
+        Panic("failed to write " + m_Path);
+    }
+    m_Count += triangles.size();
+}
+
+void STLWriter::Close() {
+    if (!m_File) {
+        return;
+    }
+    const uint32_t count = m_Count;
+    FILE *file = m_File;
+    m_File = nullptr;
+    if (fseek(file, 80, SEEK_SET) != 0 ||
+        fwrite(&count, 4, 1, file) != 1)
+    {
+        fclose(file);
+        Panic("failed to write " + m_Path);
+    }
+    if (fclose(file) != 0) {
+        Panic("failed to write " + m_Path);
     }
 }
@@ -1,11 +1,61 @@
 #pragma once
 
+#include <cstdint>
+#include <cstdio>
 #include <glm/glm.hpp>
 #include <string>
 #include <vector>
 
+#include "model.h"
+#include "pool.h"
 #include "triangle.h"
 
+// options for the memory-mapped STL writers
+struct STLOptions {
+    // madvise the mapping for sequential access
+    bool Sequential = false;
+
+    // msync the mapping before returning instead of leaving the dirty pages
+    // to the kernel's writeback
+    bool Sync = false;
+};
+
 std::vector<Triangle> LoadBinarySTL(std::string path);
 
 void SaveBinarySTL(std::string path, const std::vector<Triangle> &triangles);
+
+// SaveBinarySTL with a pool splits the record fill into disjoint ranges of
+// the mapped file, one per thread
+void SaveBinarySTL(
+    std::string path, const std::vector<Triangle> &triangles,
+    ThreadPool &pool, const STLOptions &options = STLOptions());
+
+// SaveBinarySTL with a model streams triangles straight from the link rings
+// into the mapped file in parallel, without building a Triangle vector
+template <typename T>
+void SaveBinarySTL(
+    std::string path, const Model<T> &model,
+    ThreadPool &pool, const STLOptions &options = STLOptions());
+
+// STLWriter writes a binary STL in chunks so the full mesh never has to be
+// in memory. Each chunk is encoded in parallel into a reusable buffer and
+// appended with a sequential write; Close patches the triangle count into
+// the header.
+class STLWriter {
+public:
+    STLWriter(const std::string &path);
+
+    ~STLWriter();
+
+    void Write(const std::vector<Triangle> &triangles, ThreadPool &pool);
+
+    void Close();
+
+    uint64_t Count() const { return m_Count; }
+
+private:
+    std::string m_Path;
+    FILE *m_File;
+    uint64_t m_Count;
+    std::vector<uint8_t> m_Buffer;
+};
@@ -0,0 +1,241 @@
+#include "sweep.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+#include "model.h"
+#include "pool.h"
+#include "stl.h"
+#include "util.h"
+
+namespace {
+
+typedef std::vector<std::pair<std::string, std::string>> Config;
+
+// Job is one parameter set of a sweep and its results
+struct Job {
+    Config Values;
+    Settings Params;
+    unsigned int Seed = 0;
+    uint64_t MaxIterations = 0;
+    uint64_t MaxCells = 0;
+
+    uint64_t Iterations = 0;
+    uint64_t Cells = 0;
+    double Seconds = 0;
+};
+
+std::vector<Config> ParseSweep(const std::string &path) {
+    std::ifstream file(path);
+    if (!file) {
+        Panic("failed to open " + path);
+    }
+
+    std::vector<Config> configs;
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(file, line)) {
+        lineNumber++;
+        line = line.substr(0, line.find('#'));
+
+        std::vector<std::pair<std::string, std::vector<std::string>>> axes;
+        std::istringstream tokens(line);
+        std::string token;
+        while (tokens >> token) {
+            const auto eq = token.find('=');
+            if (eq == std::string::npos || eq == 0 || eq + 1 == token.size()) {
+                Panic(path + ":" + std::to_string(lineNumber) +
+                    ": expected key=value, got " + token);
+            }
+            std::vector<std::string> values;
+            std::istringstream list(token.substr(eq + 1));
+            std::string value;
+            while (std::getline(list, value, ',')) {
+                values.push_back(value);
+            }
+            axes.emplace_back(token.substr(0, eq), values);
+        }
+        if (axes.empty()) {
+            continue;
+        }
+
+        // expand the grid, last key varying fastest
+        std::vector<int> digits(axes.size(), 0);
+        while (1) {
+            Config config;
+            for (int i = 0; i < axes.size(); i++) {
+                config.emplace_back(axes[i].first, axes[i].second[digits[i]]);
+            }
+            configs.push_back(config);
+            int i = axes.size() - 1;
+            for (; i >= 0; i--) {
+                if (++digits[i] < axes[i].second.size()) {
+                    break;
+                }
+                digits[i] = 0;
+            }
+            if (i < 0) {
+                break;
+            }
+        }
+    }
+    return configs;
+}
+
+// SetValue applies one key=value pair to a job, returning false if the key
+// is unknown
+bool SetValue(Job &job, const std::string &key, const std::string &value) {
+    if (key == "Seed") {
+        job.Seed = std::stoul(value);
+    } else if (key == "Iterations") {
+        job.MaxIterations = std::stoull(value);
+    } else if (key == "Cells") {
+        job.MaxCells = std::stoull(value);
+    } else {
+        return SetSetting(job.Params, key, value);
+    }
+    return true;
+}
+
+template <typename T>
+void RunJob(
+    Job &job, const std::vector<Triangle> &triangles,
+    ThreadPool &pool, const int maxWorkers, const std::string &meshPath)
+{
+    // draw the unset parameters, then the run itself, from the job's seed
+    SeedRandom(job.Seed);
+    RandomizeSettings(job.Params, triangles);
+    for (const auto &value : job.Values) {
+        SetValue(job, value.first, value.second);
+    }
+
+    const auto startTime = std::chrono::steady_clock::now();
+    Model<T> model = MakeModel<T>(triangles, job.Params, pool);
+    model.SetMaxWorkers(maxWorkers);
+    model.Calibrate(pool);
+    while ((job.MaxIterations == 0 || job.Iterations < job.MaxIterations) &&
+        (job.MaxCells == 0 || model.NumCells() < job.MaxCells))
+    {
+        model.Update(pool);
+        job.Iterations++;
+    }
+    const std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - startTime;
+    job.Seconds = elapsed.count();
+    job.Cells = model.NumCells();
+
+    SaveBinarySTL(meshPath, model, pool);
+}
+
+void WriteSummary(const std::string &path, const std::vector<Job> &jobs) {
+    std::ofstream file(path);
+    if (!file) {
+        Panic("failed to create " + path);
+    }
+    file << "set\tseed\tdouble\tSplitThreshold\tLinkRestLength\t"
+        << "RadiusOfInfluence\tRepulsionFactor\tSpringFactor\t"
+        << "PlanarFactor\tBulgeFactor\titerations\tcells\tseconds\t"
+        << "iterations_per_second" << std::endl;
+    for (int i = 0; i < jobs.size(); i++) {
+        const Job &job = jobs[i];
+        const Settings &s = job.Params;
+        file
+            << i << "\t" << job.Seed << "\t" << s.Double << "\t"
+            << s.SplitThreshold << "\t" << s.LinkRestLength << "\t"
+            << s.RadiusOfInfluence << "\t" << s.RepulsionFactor << "\t"
+            << s.SpringFactor << "\t" << s.PlanarFactor << "\t"
+            << s.BulgeFactor << "\t" << job.Iterations << "\t"
+            << job.Cells << "\t" << job.Seconds << "\t"
+            << job.Iterations / job.Seconds << std::endl;
+    }
+}
+
+}
+
+void RunSweep(
+    const std::string &path, const std::vector<Triangle> &triangles,
+    const Settings &settings, const int jobs)
+{
+    const auto configs = ParseSweep(path);
+    if (configs.empty()) {
+        Panic("no parameter sets in " + path);
+    }
+
+    std::vector<Job> sweep(configs.size());
+    for (int i = 0; i < configs.size(); i++) {
+        Job &job = sweep[i];
+        job.Values = configs[i];
+        job.Params = settings;
+        job.Seed = i;
+        for (const auto &value : job.Values) {
+            if (!SetValue(job, value.first, value.second)) {
+                Panic("unknown sweep key: " + value.first);
+            }
+        }
+        if (job.MaxIterations == 0 && job.MaxCells == 0) {
+            Panic("sweep set " + std::to_string(i) +
+                " needs Iterations or Cells");
+        }
+    }
+
+    // <name>.tsv and <name>NNNN.stl next to the sweep file
+    const auto slash = path.rfind('/');
+    const auto dot = path.rfind('.');
+    const bool extension = dot != std::string::npos &&
+        (slash == std::string::npos || dot > slash);
+    const std::string name = extension ? path.substr(0, dot) : path;
+
+    // each driver thread runs its batch 0 itself, so the pool gets the rest
+    // of the cores and every model an equal share of them
+    const int cores = std::max(1u, std::thread::hardware_concurrency());
+    const int numDrivers = std::max(1, std::min<int>(jobs, sweep.size()));
+    const int maxWorkers = std::max(1, cores / numDrivers);
+    ThreadPool pool(std::max(1, cores - numDrivers));
+
+    std::cout << "sweeping " << sweep.size() << " parameter sets, "
+        << numDrivers << " at a time" << std::endl;
+
+    std::atomic<int> next(0);
+    std::mutex mutex;
+    int finished = 0;
+    std::vector<std::thread> drivers;
+    for (int d = 0; d < numDrivers; d++) {
+        drivers.emplace_back([&]() {
+            while (1) {
+                const int i = next++;
+                if (i >= sweep.size()) {
+                    return;
+                }
+                char meshPath[1024];
+                snprintf(meshPath, sizeof(meshPath),
+                    "%s%04d.stl", name.c_str(), i);
+                Job &job = sweep[i];
+                if (job.Params.Double) {
+                    RunJob<double>(job, triangles, pool, maxWorkers, meshPath);
+                } else {
+                    RunJob<float>(job, triangles, pool, maxWorkers, meshPath);
+                }
+                std::lock_guard<std::mutex> guard(mutex);
+                finished++;
+                std::cout
+                    << finished << "/" << sweep.size() << " "
+                    << meshPath << " "
+                    << job.Iterations << " "
+                    << job.Cells << " "
+                    << job.Seconds << std::endl;
+            }
+        });
+    }
+    for (auto &driver : drivers) {
+        driver.join();
+    }
+
+    WriteSummary(name + ".tsv", sweep);
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "settings.h"
+#include "triangle.h"
+
+// RunSweep runs every parameter set listed in the file at path, headless
+// and several at a time on one shared thread pool.
+//
+// Each line holds space separated key=value pairs; # starts a comment. A
+// value may be a comma separated list, in which case the line expands to
+// every combination of its values. Keys are the Settings model parameters
+// (SplitThreshold, RepulsionFactor, ...), Double (1 to simulate in double
+// precision), FastMath, Compact, DiffusionSteps, DiffusionRate,
+// DiffusionDecay, FoodSource, DeathNeighbors, DeathEvery,
+// MaxSplitsPerUpdate and SplitTimeBudget, plus:
+//
+//   Seed        seeds the draws for unset parameters and the run itself
+//               (default: the parameter set's number)
+//   Iterations  stop after this many iterations
+//   Cells       stop once the form has at least this many cells
+//
+// Every set needs Iterations or Cells. Unset model parameters are drawn as
+// in RandomizeSettings.
+//
+// jobs sets run at once, each capped at an equal share of the pool so that
+// their batches interleave. The final mesh of set N is written to
+// <name>NNNN.stl and a timing summary to <name>.tsv, where <name> is path
+// without its extension.
+void RunSweep(
+    const std::string &path, const std::vector<Triangle> &triangles,
+    const Settings &settings, const int jobs);
@@ -0,0 +1,195 @@
+#include "transport.h"
+
+#include <cerrno>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "util.h"
+
+std::vector<Buffer> Transport::AllGather(const Buffer &buffer) {
+    return Exchange(std::vector<Buffer>(Size(), buffer));
+}
+
+std::vector<double> Transport::Sum(const std::vector<double> &values) {
+    Buffer buffer(values.size() * sizeof(double));
+    memcpy(buffer.data(), values.data(), buffer.size());
+    std::vector<double> result(values.size(), 0);
+    for (const Buffer &other : AllGather(buffer)) {
+        BufferReader reader(other);
+        for (double &value : result) {
+            value += reader.Read<double>();
+        }
+    }
+    return result;
+}
+
+void BufferReader::Fail() const {
+    Panic("truncated transport buffer");
+}
+
+std::unique_ptr<SocketTransport> SocketTransport::Fork(const int size) {
+    // sockets[i][j] is rank i's end of the pair connecting i and j
+    std::vector<std::vector<int>> sockets(size, std::vector<int>(size, -1));
+    for (int i = 0; i < size; i++) {
+        for (int j = i + 1; j < size; j++) {
+            int pair[2];
+            if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) != 0) {
+                Panic("socketpair failed");
+            }
+            sockets[i][j] = pair[0];
+            sockets[j][i] = pair[1];
+        }
+    }
+
+    // closeOthers closes every end that doesn't belong to rank
+    const auto closeOthers = [&sockets, size](const int rank) {
+        for (int i = 0; i < size; i++) {
+            for (int j = 0; j < size; j++) {
+                if (i != rank && sockets[i][j] >= 0) {
+                    close(sockets[i][j]);
+                }
+            }
+        }
+    };
+
+    std::vector<pid_t> children;
+    for (int rank = 1; rank < size; rank++) {
+        const pid_t pid = fork();
+        if (pid < 0) {
+            Panic("fork failed");
+        }
+        if (pid == 0) {
+            closeOthers(rank);
+            return std::unique_ptr<SocketTransport>(
+                new SocketTransport(rank, sockets[rank]));
+        }
+        children.push_back(pid);
+    }
+    closeOthers(0);
+    std::unique_ptr<SocketTransport> transport(
+        new SocketTransport(0, sockets[0]));
+    transport->m_Children = children;
+    return transport;
+}
+
+SocketTransport::SocketTransport(const int rank, std::vector<int> sockets) :
+    m_Rank(rank),
+    m_Sockets(std::move(sockets))
+{
+}
+
+SocketTransport::~SocketTransport() {
+    for (const int fd : m_Sockets) {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+    for (const pid_t pid : m_Children) {
+        waitpid(pid, nullptr, 0);
+    }
+}
+
+std::vector<Buffer> SocketTransport::Exchange(
+    const std::vector<Buffer> &send)
+{
+    const int size = Size();
+    if (send.size() != size) {
+        Panic("Exchange needs one buffer per rank");
+    }
+
+    // each message is its size followed by its bytes. The sockets are
+    // written and read as they become ready, without blocking, so that
+    // large messages can't deadlock two ranks writing to each other.
+    const uint64_t header = sizeof(uint64_t);
+    std::vector<Buffer> result(size);
+    result[m_Rank] = send[m_Rank];
+    std::vector<uint64_t> outSizes(size);
+    std::vector<uint64_t> inSizes(size, 0);
+    std::vector<uint64_t> sent(size, 0);
+    std::vector<uint64_t> received(size, 0);
+    for (int q = 0; q < size; q++) {
+        outSizes[q] = send[q].size();
+    }
+    const auto sendDone = [&](const int q) {
+        return sent[q] == header + outSizes[q];
+    };
+    const auto receiveDone = [&](const int q) {
+        return received[q] >= header && received[q] == header + inSizes[q];
+    };
+
+    std::vector<pollfd> fds;
+    std::vector<int> peers;
+    while (1) {
+        fds.clear();
+        peers.clear();
+        for (int q = 0; q < size; q++) {
+            if (q == m_Rank) {
+                continue;
+            }
+            const short events =
+                (sendDone(q) ? 0 : POLLOUT) | (receiveDone(q) ? 0 : POLLIN);
+            if (events) {
+                fds.push_back({m_Sockets[q], events, 0});
+                peers.push_back(q);
+            }
+        }
+        if (fds.empty()) {
+            break;
+        }
+        if (poll(fds.data(), fds.size(), -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            Panic("transport poll failed");
+        }
+
+        for (int k = 0; k < fds.size(); k++) {
+            const int q = peers[k];
+            const int fd = fds[k].fd;
+            const short ready = fds[k].revents;
+            while (ready && !sendDone(q)) {
+                const uint8_t *data = sent[q] < header ?
+                    (const uint8_t *)&outSizes[q] + sent[q] :
+                    send[q].data() + (sent[q] - header);
+                const uint64_t count = sent[q] < header ?
+                    header - sent[q] : outSizes[q] - (sent[q] - header);
+                const ssize_t n = ::send(
+                    fd, data, count, MSG_DONTWAIT | MSG_NOSIGNAL);
+                if (n < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                    break;
+                }
+                if (n <= 0) {
+                    Panic("transport write failed");
+                }
+                sent[q] += n;
+            }
+            while (ready && !receiveDone(q)) {
+                uint8_t *data = received[q] < header ?
+                    (uint8_t *)&inSizes[q] + received[q] :
+                    result[q].data() + (received[q] - header);
+                const uint64_t count = received[q] < header ?
+                    header - received[q] : inSizes[q] - (received[q] - header);
+                const ssize_t n = recv(fd, data, count, MSG_DONTWAIT);
+                if (n < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                    break;
+                }
+                if (n <= 0) {
+                    Panic("transport read failed, a rank has exited");
+                }
+                received[q] += n;
+                if (received[q] == header) {
+                    result[q].resize(inSizes[q]);
+                }
+            }
+        }
+    }
+    return result;
+}
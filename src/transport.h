@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+
+typedef std::vector<uint8_t> Buffer;
+
+// Transport connects the processes of a domain decomposed run (see
+// domain.h). Its one primitive is a collective all-to-all exchange of byte
+// buffers, which maps directly onto MPI_Alltoall of the sizes followed by
+// MPI_Alltoallv of the data, so an MPI transport only has to implement
+// Exchange.
+class Transport {
+public:
+    virtual ~Transport() {}
+
+    virtual int Rank() const = 0;
+
+    virtual int Size() const = 0;
+
+    // Exchange sends send[q] to rank q and returns what every rank sent to
+    // this one. Every rank must call it, in the same order.
+    virtual std::vector<Buffer> Exchange(const std::vector<Buffer> &send) = 0;
+
+    // AllGather sends the same buffer to every rank
+    std::vector<Buffer> AllGather(const Buffer &buffer);
+
+    // Sum adds up values element-wise across all ranks
+    std::vector<double> Sum(const std::vector<double> &values);
+};
+
+// SocketTransport connects the ranks with a Unix socket pair per pair of
+// ranks, for runs on one machine
+class SocketTransport : public Transport {
+public:
+    // Fork starts size - 1 child processes and returns in each of the size
+    // processes with its own rank. It must be called before any threads
+    // are started. Rank 0 is the calling process and waits for the others
+    // when its transport is destroyed.
+    static std::unique_ptr<SocketTransport> Fork(const int size);
+
+    ~SocketTransport();
+
+    int Rank() const override { return m_Rank; }
+
+    int Size() const override { return m_Sockets.size(); }
+
+    std::vector<Buffer> Exchange(const std::vector<Buffer> &send) override;
+
+private:
+    SocketTransport(const int rank, std::vector<int> sockets);
+
+    int m_Rank;
+
+    // socket connected to each rank, -1 for this one
+    std::vector<int> m_Sockets;
+
+    // child processes, on rank 0
+    std::vector<pid_t> m_Children;
+};
+
+// BufferWriter and BufferReader append and consume plain values
+class BufferWriter {
+public:
+    BufferWriter(Buffer &buffer) : m_Buffer(buffer) {}
+
+    template <typename V>
+    void Write(const V &value) {
+        const size_t offset = m_Buffer.size();
+        m_Buffer.resize(offset + sizeof(V));
+        memcpy(m_Buffer.data() + offset, &value, sizeof(V));
+    }
+
+private:
+    Buffer &m_Buffer;
+};
+
+class BufferReader {
+public:
+    BufferReader(const Buffer &buffer) : m_Buffer(buffer), m_Offset(0) {}
+
+    bool Done() const { return m_Offset >= m_Buffer.size(); }
+
+    template <typename V>
+    V Read() {
+        V value;
+        if (m_Offset + sizeof(V) > m_Buffer.size()) {
+            Fail();
+        }
+        memcpy(&value, m_Buffer.data() + m_Offset, sizeof(V));
+        m_Offset += sizeof(V);
+        return value;
+    }
+
+private:
+    void Fail() const;
+
+    const Buffer &m_Buffer;
+    size_t m_Offset;
+};
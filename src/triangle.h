@@ -5,6 +5,10 @@
 
 class Triangle {
 public:
+    // leaves the vertices uninitialized so that exactly sized vectors can be
+    // allocated and then filled in parallel
+    Triangle() {}
+
     Triangle(const glm::vec3 &a, const glm::vec3 &b, const glm::vec3 &c) :
         m_A(a), m_B(b), m_C(c) {}
 
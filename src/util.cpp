@@ -1,36 +1,95 @@
 #include "util.h"
 
 #include <chrono>
-#include <functional>
+#include <cstdio>
+#include <fstream>
 #include <iostream>
 #include <random>
+#include <sstream>
+#include <unistd.h>
+
+#ifdef __APPLE__
+#include <mach/mach.h>
+#endif
 
 void Panic(const std::string &message) {
     std::cerr << message << std::endl;
     std::exit(1);
 }
 
-std::function<void()> Timed(const std::string &message) {
-    const auto startTime = std::chrono::steady_clock::now();
-    return [message, startTime]() {
-        return;
-        const std::chrono::duration<double> elapsed =
-            std::chrono::steady_clock::now() - startTime;
-        const double millis = elapsed.count() * 1000;
-        std::cerr << message << ": " << millis << "ms" << std::endl;
-    };
+void CreateFile(const std::string &path, const uint64_t numBytes) {
+    // a new file rather than truncating the old one, which a reader may
+    // still have mapped
+    std::remove(path.c_str());
+    std::filebuf fbuf;
+    if (!fbuf.open(path.c_str(),
+        std::ios_base::in | std::ios_base::out | std::ios_base::trunc |
+        std::ios_base::binary))
+    {
+        Panic("failed to create " + path);
+    }
+    if (fbuf.pubseekoff(numBytes - 1, std::ios_base::beg) < 0 ||
+        fbuf.sputc(0) == std::filebuf::traits_type::eof() ||
+        !fbuf.close())
+    {
+        Panic("failed to size " + path);
+    }
 }
 
-double Random(const double lo, const double hi) {
+uint64_t ResidentBytes() {
+#ifdef __APPLE__
+    mach_task_basic_info info;
+    mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+    if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO,
+        (task_info_t)&info, &count) != KERN_SUCCESS)
+    {
+        return 0;
+    }
+    return info.resident_size;
+#else
+    std::ifstream file("/proc/self/statm");
+    uint64_t size, resident;
+    if (!(file >> size >> resident)) {
+        return 0;
+    }
+    return resident * sysconf(_SC_PAGESIZE);
+#endif
+}
+
+namespace {
+
+std::mt19937 &Generator() {
     // static thread_local std::mt19937 gen(0);
     static thread_local std::mt19937 gen(std::chrono::high_resolution_clock::now().time_since_epoch().count());
+    return gen;
+}
+
+}
+
+void SeedRandom(const unsigned int seed) {
+    Generator().seed(seed);
+}
+
+std::string RandomState() {
+    std::ostringstream stream;
+    stream << Generator();
+    return stream.str();
+}
+
+void SetRandomState(const std::string &state) {
+    std::istringstream stream(state);
+    stream >> Generator();
+    if (!stream) {
+        Panic("invalid random state");
+    }
+}
+
+double Random(const double lo, const double hi) {
     std::uniform_real_distribution<double> dist(lo, hi);
-    return dist(gen);
+    return dist(Generator());
 }
 
 int RandomIntN(const int n) {
-    // static thread_local std::mt19937 gen(0);
-    static thread_local std::mt19937 gen(std::chrono::high_resolution_clock::now().time_since_epoch().count());
     std::uniform_int_distribution<int> dist(0, n - 1);
-    return dist(gen);
+    return dist(Generator());
 }
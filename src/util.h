@@ -1,11 +1,25 @@
 #pragma once
 
-#include <functional>
+#include <cstdint>
 #include <string>
 
 void Panic(const std::string &message);
 
-std::function<void()> Timed(const std::string &message);
+// CreateFile replaces the file at path with one of numBytes zero bytes,
+// ready to be memory-mapped and filled
+void CreateFile(const std::string &path, const uint64_t numBytes);
+
+// ResidentBytes returns the process's resident set size, or 0 if unknown
+uint64_t ResidentBytes();
+
+// SeedRandom reseeds the calling thread's generator
+void SeedRandom(const unsigned int seed);
+
+// RandomState / SetRandomState save and restore the calling thread's
+// generator so that a resumed run continues the same sequence
+std::string RandomState();
+
+void SetRandomState(const std::string &state);
 
 double Random(const double lo, const double hi);
 
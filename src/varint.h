@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// LEB128 varints: 7 bits per byte, low bits first, the high bit set on
+// every byte but the last. Signed values are zigzag coded first so that
+// small magnitudes of either sign stay short.
+
+inline void WriteVarint(std::vector<uint8_t> &buffer, uint64_t value) {
+    while (value >= 0x80) {
+        buffer.push_back(uint8_t(value) | 0x80);
+        value >>= 7;
+    }
+    buffer.push_back(uint8_t(value));
+}
+
+inline void WriteSignedVarint(std::vector<uint8_t> &buffer, int64_t value) {
+    WriteVarint(buffer, (uint64_t(value) << 1) ^ uint64_t(value >> 63));
+}
+
+// ReadVarint returns false if the varint runs past the end of data
+inline bool ReadVarint(
+    const std::vector<uint8_t> &data, size_t &offset, uint64_t &value)
+{
+    value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (offset >= data.size()) {
+            return false;
+        }
+        const uint8_t byte = data[offset++];
+        value |= uint64_t(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+inline bool ReadSignedVarint(
+    const std::vector<uint8_t> &data, size_t &offset, int64_t &value)
+{
+    uint64_t zigzag;
+    if (!ReadVarint(data, offset, zigzag)) {
+        return false;
+    }
+    value = int64_t(zigzag >> 1) ^ -int64_t(zigzag & 1);
+    return true;
+}